@@ -5,6 +5,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef __APPLE__
 #include <OpenCL/opencl.h>
@@ -15,9 +16,36 @@
 
 
 #include "err_code.h"
+#include "device_info.h"
 
-int main() {   
+// Prints the capabilities of every device as a JSON array
+void dump_json(cl_platform_id *platform, cl_uint num_platforms) {
   cl_int err;
+  int first = 1;
+  printf("[");
+  for (int i = 0; i < num_platforms; i++) {
+    cl_uint num_devices;
+    err = clGetDeviceIDs(platform[i], CL_DEVICE_TYPE_ALL, 0, NULL, &num_devices);
+    checkError(err, "Finding devices");
+    cl_device_id device[num_devices];
+    err = clGetDeviceIDs(platform[i], CL_DEVICE_TYPE_ALL, num_devices, device, NULL);
+    checkError(err, "Getting devices");
+
+    for (int j = 0; j < num_devices; j++) {
+      device_caps caps;
+      err = query_device_caps(device[j], &caps);
+      checkError(err, "Querying device capabilities");
+      printf(first ? "\n  " : ",\n  ");
+      print_device_caps_json(stdout, &caps);
+      first = 0;
+    }
+  }
+  printf("\n]\n");
+}
+
+int main(int argc, char** argv) {
+  cl_int err;
+  int json = (argc > 1 && !strcmp(argv[1], "--json"));
   // Find the number of OpenCL platforms
   cl_uint num_platforms;
   err = clGetPlatformIDs(0, NULL, &num_platforms);
@@ -32,6 +60,11 @@ int main() {
   err = clGetPlatformIDs(num_platforms, platform, NULL);
   checkError(err, "Getting platforms\n");
 
+  if (json) {
+    dump_json(platform, num_platforms);
+    return 0;
+  }
+
   printf("Number of OpenCL platforms: %d\n", num_platforms);
   printf("------------------------\n");
   
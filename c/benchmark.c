@@ -0,0 +1,645 @@
+/*
+ * Roofline benchmark
+ *
+ * Measures the device's achievable bandwidth and peak FMA throughput, then
+ * sweeps the vadd variants from 1K to 1G elements and rates the GEMM and
+ * GEMV variants against that roofline. Operands are generated in place on the
+ * device, nothing is uploaded. The host backend's vadd and GEMM run beside
+ * them on the same operands, for a head-to-head with the OpenCL CPU device.
+ * Last, GEMM, vadd and sum run in fp32, native fp64 where the device has it
+ * and emulated float-float, with their error against a host double reference.
+ *
+ *   benchmark [options] [N ...]    GEMM orders, default 256 512 1024
+ *
+ *   --save FILE        append every trial to a JSON-lines results store
+ *   --compare FILE     test this run against the latest stored run of another
+ *                      commit on this device; exits nonzero on a regression
+ *   --baseline COMMIT  compare against that commit's latest run instead
+ *   --threshold PCT    median slowdown that counts, default 5
+ *   --selftest         check the results store and its statistics, then exit
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<sys/types.h>
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#include <unistd.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "err_code.h"
+#include "device_info.h"
+#include "kernel_cache.h"
+#include "gemm.h"
+#include "roofline.h"
+#include "vector_ops.h"
+#include "rng.h"
+#include "perfdb.h"
+#include "host_ops.h"
+#include "fp64.h"
+#include "mat_lib.h"
+
+#ifndef DEVICE
+#define DEVICE CL_DEVICE_TYPE_DEFAULT
+#endif
+
+extern double wtime();
+
+#define REPS  (10)
+#define HOST_VADD_MAX (1 << 25)  // Longest vadd the host backend runs, its operands live in host memory
+
+static const unsigned int vadd_lengths[] = {1 << 10, 1 << 13, 1 << 16, 1 << 19, 1 << 22, 1 << 25, 1 << 28, 1 << 30};
+static const int vadd_widths[] = {1, 4, 8};
+static const int default_orders[] = {256, 512, 1024};
+static const int splitk_depths[] = {1 << 16, 1 << 20};  // K of the 64 x 64 split-K runs
+static const int gemv_orders[] = {1024, 4096, 8192};     // Square GEMV matrices
+#define GEMV_BATCH_COUNT (64)   // Matrices of the batched GEMV run
+#define GEMV_BATCH_ORDER (256)  // and their order
+static const int prec_orders[] = {256, 1024};           // GEMM orders of the precision runs
+#define PREC_COUNT (1 << 22)    // vadd and sum length of the precision runs
+
+// Precisions of the precision runs, fp32 then the fp64_ctx modes
+#define PREC_FP32 (-1)
+static const int prec_modes[] = {PREC_FP32, FP64_NATIVE, FP64_EMULATED};
+#define PREC_MODES (3)
+#define PREC_GEMM  (0)
+#define PREC_VADD  (1)
+#define PREC_SUM   (2)
+
+double best_of(const double *trials) {
+  double best = trials[0];
+  for (int r = 1; r < REPS; r++) {
+    if (trials[r] < best)
+      best = trials[r];
+  }
+  return best;
+}
+
+// Best-of-REPS seconds for one launch, after a warm-up; all REPS go to trials
+double time_kernel(cl_command_queue commands, cl_kernel kernel, cl_uint dims, const size_t *global, const size_t *local, double *trials) {
+  int err;
+  for (int r = 0; r <= REPS; r++) {
+    double t = wtime();
+    err = clEnqueueNDRangeKernel(commands, kernel, dims, NULL, global, local, 0, NULL, NULL);
+    checkError(err, "Enqueueing kernel");
+    err = clFinish(commands);
+    checkError(err, "Waiting for kernel to finish");
+    t = wtime() - t;
+    if (r > 0)
+      trials[r-1] = t;
+  }
+  return best_of(trials);
+}
+
+double time_vadd(cl_command_queue commands, vec_ctx *v, cl_mem *d, unsigned int count, double *trials) {
+  int err;
+  for (int r = 0; r <= REPS; r++) {
+    double t = wtime();
+    err = vec_add(v, commands, d[0], d[1], d[2], count);
+    checkError(err, "Enqueueing vadd");
+    err = clFinish(commands);
+    checkError(err, "Waiting for vadd to finish");
+    t = wtime() - t;
+    if (r > 0)
+      trials[r-1] = t;
+  }
+  return best_of(trials);
+}
+
+double time_gemm(cl_command_queue commands, gemm_ctx *g, cl_mem d_a, cl_mem d_b, cl_mem d_c, int n, double *trials) {
+  int err;
+  for (int r = 0; r <= REPS; r++) {
+    double t = wtime();
+    err = gemm(g, commands, d_a, d_b, d_c, n);
+    checkError(err, "Enqueueing GEMM");
+    err = clFinish(commands);
+    checkError(err, "Waiting for GEMM to finish");
+    t = wtime() - t;
+    if (r > 0)
+      trials[r-1] = t;
+  }
+  return best_of(trials);
+}
+
+// Host backend counterparts of time_vadd and time_gemm, on host arrays h
+double time_host_vadd(thread_pool *p, float **h, unsigned int count, double *trials) {
+  for (int r = 0; r <= REPS; r++) {
+    double t = wtime();
+    host_vadd(p, h[0], h[1], h[2], count);
+    t = wtime() - t;
+    if (r > 0)
+      trials[r-1] = t;
+  }
+  return best_of(trials);
+}
+
+double time_host_gemm(thread_pool *p, float **h, int n, double *trials) {
+  for (int r = 0; r <= REPS; r++) {
+    double t = wtime();
+    host_gemm(p, h[0], h[1], h[2], n, n, n);
+    t = wtime() - t;
+    if (r > 0)
+      trials[r-1] = t;
+  }
+  return best_of(trials);
+}
+
+// Best-of-REPS seconds for one GEMM of order n, vadd or sum of n elements
+// on buf, in fp32 through g and v when d is NULL, otherwise through d
+double time_prec(cl_command_queue commands, gemm_ctx *g, vec_ctx *v, fp64_ctx *d, int op, cl_mem *buf, unsigned int n,
+                 double *sum, double *trials) {
+  int err;
+  for (int r = 0; r <= REPS; r++) {
+    double t = wtime();
+    if (op == PREC_GEMM)
+      err = d ? fp64_gemm(d, commands, buf[0], buf[1], buf[2], n) : gemm(g, commands, buf[0], buf[1], buf[2], n);
+    else if (op == PREC_VADD)
+      err = d ? fp64_add(d, commands, buf[0], buf[1], buf[2], n) : vec_add(v, commands, buf[0], buf[1], buf[2], n);
+    else
+      err = d ? fp64_sum(d, commands, buf[0], n, sum) : vec_sum(v, commands, buf[0], n, sum);
+    checkError(err, "Enqueueing precision run");
+    err = clFinish(commands);
+    checkError(err, "Waiting for precision run to finish");
+    t = wtime() - t;
+    if (r > 0)
+      trials[r-1] = t;
+  }
+  return best_of(trials);
+}
+
+// Relative Frobenius error of count results against a double reference
+double prec_error(const double *ref, const double *c, size_t count) {
+  double diff = 0.0, norm = 0.0;
+  for (size_t i = 0; i < count; i++) {
+    diff += (ref[i] - c[i]) * (ref[i] - c[i]);
+    norm += ref[i] * ref[i];
+  }
+  return sqrt(diff / norm);
+}
+
+// Host arrays for the host backend, a and b filled like the device operands
+void host_operands(float **h, size_t count) {
+  for (int i = 0; i < 3; i++) {
+    h[i] = malloc(sizeof(float) * count);
+    if (!h[i]) {
+      printf("Error: host operand alloc failed\n");
+      exit(1);
+    }
+  }
+  rng_uniform_host(h[0], count, RNG_SEED, 0);
+  rng_uniform_host(h[1], count, RNG_SEED, count);
+}
+
+int main(int argc, char** argv) {
+  int err;
+  int i;
+  const char *save_path = NULL, *compare_path = NULL, *baseline = NULL;
+  double threshold = PERF_THRESHOLD;
+  int first = 1;
+  for (; first < argc && argv[first][0] == '-'; first++) {
+    if (strcmp(argv[first], "--save") == 0 && first + 1 < argc)
+      save_path = argv[++first];
+    else if (strcmp(argv[first], "--compare") == 0 && first + 1 < argc)
+      compare_path = argv[++first];
+    else if (strcmp(argv[first], "--baseline") == 0 && first + 1 < argc)
+      baseline = argv[++first];
+    else if (strcmp(argv[first], "--threshold") == 0 && first + 1 < argc)
+      threshold = atof(argv[++first]) / 100.0;
+    else if (strcmp(argv[first], "--selftest") == 0)
+      return perf_selftest() ? EXIT_FAILURE : 0;
+    else {
+      printf("Unknown option %s\n", argv[first]);
+      return EXIT_FAILURE;
+    }
+  }
+  cl_device_id device_id;
+  cl_context context;
+  cl_command_queue commands;
+
+  // Set up platform and device
+  cl_uint numPlatforms;
+  err = clGetPlatformIDs(0, NULL, &numPlatforms);
+  checkError(err, "Finding platforms");
+  if (numPlatforms == 0) {
+    printf("Found 0 platforms\n");
+    return EXIT_FAILURE;
+  }
+
+  cl_platform_id Platform[numPlatforms];
+  err = clGetPlatformIDs(numPlatforms, Platform, NULL);
+  checkError(err, "Getting platforms");
+
+  for (i = 0; i < numPlatforms; i++) {
+    err = clGetDeviceIDs(Platform[i], DEVICE, 1, &device_id, NULL);
+    if (err == CL_SUCCESS) {
+      break;
+    }
+  }
+
+  if (device_id == NULL)
+    checkError(err, "Finding a device");
+
+  err = output_device_info(device_id);
+  checkError(err, "Finding device output");
+
+  device_caps caps;
+  err = query_device_caps(device_id, &caps);
+  checkError(err, "Querying device capabilities");
+
+  context = clCreateContext(0, 1, &device_id, NULL, NULL, &err);
+  checkError(err, "Creating context");
+
+  commands = clCreateCommandQueue(context, device_id, 0, &err);
+  checkError(err, "Creating command queue");
+
+  // Every timed variant is recorded for the results store
+  perf_run run;
+  perf_begin(&run, caps.name);
+  double trials[REPS];
+  char shape[64];
+
+  roofline roof;
+  err = roofline_measure(context, device_id, commands, &caps, &roof);
+  checkError(err, "Measuring roofline");
+  roofline_print(&roof);
+
+  rng_ctx rng;
+  err = rng_init(&rng, context, device_id);
+  checkError(err, "Creating RNG kernels");
+
+  thread_pool pool;
+  int threads = pool_init(&pool, 0);
+  printf("Host backend: %d thread%s\n\n", threads, threads == 1 ? "" : "s");
+
+  // vadd: 1 flop and 3 floats of traffic per element, scalar against the
+  // grid-stride float4/float8 kernels, as a fraction of STREAM triad, then
+  // the host backend and the rate a and b are generated at on the device
+  vec_ctx vadd[3];
+  for (int w = 0; w < 3; w++) {
+    err = vec_init(&vadd[w], context, device_id, &caps, vadd_widths[w]);
+    checkError(err, "Creating vadd kernel");
+  }
+  printf("%-24s %12s %12s %12s %9s %12s %12s\n", "vadd GB/s", "scalar", "float4", "float8", "of triad", "host", "rng fill");
+  for (int v = 0; v < sizeof(vadd_lengths) / sizeof(vadd_lengths[0]); v++) {
+    unsigned int count = vadd_lengths[v];
+    size_t bytes = sizeof(float) * (size_t)count;
+    if (bytes > caps.max_alloc || 3 * bytes > caps.global_mem_size)
+      break;
+
+    cl_mem d[3];
+    for (i = 0; i < 3; i++) {
+      d[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+      checkError(err, "Creating vadd buffer");
+    }
+    double fill = wtime();
+    for (i = 0; i < 2; i++) {
+      err = rng_uniform(&rng, commands, d[i], count, RNG_SEED, (uint64_t)i * count);
+      checkError(err, "Generating vadd operand");
+    }
+    err = clFinish(commands);
+    checkError(err, "Waiting for RNG");
+    fill = wtime() - fill;
+
+    double gbs[3], best = 0.0;
+    for (int w = 0; w < 3; w++) {
+      double t = time_vadd(commands, &vadd[w], d, count, trials);
+      snprintf(shape, sizeof(shape), "%u", count);
+      perf_add(&run, vadd_widths[w] == 1 ? "vadd" : (vadd_widths[w] == 4 ? "vadd4" : "vadd8"), shape, trials, REPS);
+      gbs[w] = 3.0 * bytes / t * 1e-9;
+      if (gbs[w] > best)
+        best = gbs[w];
+    }
+    double host_gbs = 0.0;
+    if (count <= HOST_VADD_MAX) {
+      float *h[3];
+      host_operands(h, count);
+      host_gbs = 3.0 * bytes / time_host_vadd(&pool, h, count, trials) * 1e-9;
+      perf_add(&run, "host_vadd", shape, trials, REPS);
+      for (i = 0; i < 3; i++)
+        free(h[i]);
+    }
+    printf("%-24u %12.2f %12.2f %12.2f %8.1f%% %12.2f %12.2f\n", count, gbs[0], gbs[1], gbs[2], 100.0 * best / roof.triad_gbs,
+      host_gbs, 2.0 * bytes / fill * 1e-9);
+
+    for (i = 0; i < 3; i++)
+      clReleaseMemObject(d[i]);
+  }
+  for (int w = 0; w < 3; w++)
+    vec_release(&vadd[w]);
+  printf("\n");
+  roofline_header();
+
+  // GEMM: 2n^3 flops against the compulsory 3n^2 floats of traffic
+  gemm_ctx g;
+  err = gemm_init(&g, context, device_id, 0);
+  checkError(err, "Creating GEMM driver");
+
+  int num_orders = (argc > first) ? argc - first : sizeof(default_orders) / sizeof(default_orders[0]);
+  for (int o = 0; o < num_orders; o++) {
+    int n = (argc > first) ? atoi(argv[first + o]) : default_orders[o];
+    snprintf(shape, sizeof(shape), "%d", n);
+    size_t bytes = sizeof(float) * n * n;
+    double flops = 2.0 * n * n * n;
+    char name[64];
+
+    cl_mem d_a = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    checkError(err, "Creating buffer d_a");
+    cl_mem d_b = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    checkError(err, "Creating buffer d_b");
+    cl_mem d_c = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    checkError(err, "Creating buffer d_c");
+    err = rng_uniform(&rng, commands, d_a, n * n, RNG_SEED, 0);
+    err |= rng_uniform(&rng, commands, d_b, n * n, RNG_SEED, (uint64_t)n * n);
+    checkError(err, "Generating GEMM operands");
+
+    // Naive kernel with N at runtime
+    cl_kernel ko_mmul = get_kernel(context, device_id, "kernel.cl", "mmul", NULL, &err);
+    checkError(err, "Creating mmul kernel");
+    err = clSetKernelArg(ko_mmul, 0, sizeof(cl_mem), &d_a);
+    err |= clSetKernelArg(ko_mmul, 1, sizeof(cl_mem), &d_b);
+    err |= clSetKernelArg(ko_mmul, 2, sizeof(cl_mem), &d_c);
+    err |= clSetKernelArg(ko_mmul, 3, sizeof(int), &n);
+    checkError(err, "Setting mmul arguments");
+    const size_t global[2] = {n, n};
+    snprintf(name, sizeof(name), "mmul %d", n);
+    roofline_report(&roof, name, flops, 3.0 * bytes, time_kernel(commands, ko_mmul, 2, global, NULL, trials));
+    perf_add(&run, "mmul", shape, trials, REPS);
+    clReleaseKernel(ko_mmul);
+
+    // Every B layout through the GEMM driver
+    int layouts[] = {B_ROW_MAJOR, B_TRANSPOSED, B_PANELS};
+    for (int l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+      g.b_layout = layouts[l];
+      double t = time_gemm(commands, &g, d_a, d_b, d_c, n, trials);
+      snprintf(name, sizeof(name), "%s %s %d", g.plan.kernel, b_layout_name(layouts[l]), n);
+      roofline_report(&roof, name, flops, 3.0 * bytes, t);
+      // Keyed by the layout asked for: the plan may fall back (panels on an
+      // untiled order run row-major), which would repeat a key
+      snprintf(name, sizeof(name), "gemm/%s", b_layout_name(layouts[l]));
+      perf_add(&run, name, shape, trials, REPS);
+    }
+
+    // Host backend on the same operands
+    float *h[3];
+    host_operands(h, (size_t)n * n);
+    snprintf(name, sizeof(name), "host_gemm %d", n);
+    roofline_report(&roof, name, flops, 3.0 * bytes, time_host_gemm(&pool, h, n, trials));
+    perf_add(&run, "host_gemm", shape, trials, REPS);
+    for (i = 0; i < 3; i++)
+      free(h[i]);
+
+    clReleaseMemObject(d_a);
+    clReleaseMemObject(d_b);
+    clReleaseMemObject(d_c);
+  }
+
+  // GEMV: 2mk flops against one read of a plus x and y, memory-bound, so the
+  // last two columns are the ones to watch. Straight, transposed and a batch
+  // of small matrices.
+  for (int o = 0; o <= sizeof(gemv_orders) / sizeof(gemv_orders[0]); o++) {
+    int batched = (o == sizeof(gemv_orders) / sizeof(gemv_orders[0]));
+    int n = batched ? GEMV_BATCH_ORDER : gemv_orders[o];
+    int batch = batched ? GEMV_BATCH_COUNT : 1;
+    size_t a_bytes = sizeof(float) * n * (size_t)n * batch;
+    if (a_bytes > caps.max_alloc)
+      continue;
+    double flops = 2.0 * n * (double)n * batch;
+    double bytes = a_bytes + 2.0 * sizeof(float) * n * batch;
+    char name[64];
+
+    cl_mem d_a = clCreateBuffer(context, CL_MEM_READ_WRITE, a_bytes, NULL, &err);
+    checkError(err, "Creating buffer d_a");
+    cl_mem d_x = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * n * batch, NULL, &err);
+    checkError(err, "Creating buffer d_x");
+    cl_mem d_y = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * n * batch, NULL, &err);
+    checkError(err, "Creating buffer d_y");
+    err = rng_uniform(&rng, commands, d_a, n * n * batch, RNG_SEED, 0);
+    err |= rng_uniform(&rng, commands, d_x, n * batch, RNG_SEED, (uint64_t)n * n * batch);
+    checkError(err, "Generating GEMV operands");
+
+    snprintf(shape, sizeof(shape), batched ? "%dx%d" : "%d", batch, n);
+    for (int trans = 0; trans < 2; trans++) {
+      for (int r = 0; r <= REPS; r++) {
+        double t = wtime();
+        err = gemv_batched(&g.gemv, commands, trans, d_a, d_x, d_y, n, n, batch);
+        checkError(err, "Enqueueing GEMV");
+        err = clFinish(commands);
+        checkError(err, "Waiting for GEMV to finish");
+        t = wtime() - t;
+        if (r > 0)
+          trials[r-1] = t;
+      }
+      if (batched)
+        snprintf(name, sizeof(name), "gemv%s %dx%d", trans ? "^T" : "", batch, n);
+      else
+        snprintf(name, sizeof(name), "gemv%s %d", trans ? "^T" : "", n);
+      roofline_report(&roof, name, flops, bytes, best_of(trials));
+      perf_add(&run, trans ? "gemv_t" : "gemv_n", shape, trials, REPS);
+    }
+
+    clReleaseMemObject(d_a);
+    clReleaseMemObject(d_x);
+    clReleaseMemObject(d_y);
+  }
+
+  // Split-K: 64 x 64 output over a long K, unsplit against the automatic split
+  for (int s = 0; s < sizeof(splitk_depths) / sizeof(splitk_depths[0]); s++) {
+    int m = 64, k = splitk_depths[s];
+    size_t ab_bytes = sizeof(float) * m * (size_t)k;
+    if (ab_bytes > caps.max_alloc || 2 * ab_bytes > caps.global_mem_size)
+      break;
+    double flops = 2.0 * m * m * (double)k;
+    double bytes = 2.0 * ab_bytes + sizeof(float) * m * m;
+    char name[64];
+
+    cl_mem d_a = clCreateBuffer(context, CL_MEM_READ_WRITE, ab_bytes, NULL, &err);
+    checkError(err, "Creating buffer d_a");
+    cl_mem d_b = clCreateBuffer(context, CL_MEM_READ_WRITE, ab_bytes, NULL, &err);
+    checkError(err, "Creating buffer d_b");
+    cl_mem d_c = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * m * m, NULL, &err);
+    checkError(err, "Creating buffer d_c");
+    err = rng_uniform(&rng, commands, d_a, m * k, RNG_SEED, 0);
+    err |= rng_uniform(&rng, commands, d_b, m * k, RNG_SEED, (uint64_t)m * k);
+    checkError(err, "Generating split-K operands");
+
+    for (int f = 1; f >= 0; f--) {
+      g.split_k = f;
+      for (int r = 0; r <= REPS; r++) {
+        double t = wtime();
+        err = gemm_mnk(&g, commands, d_a, d_b, d_c, m, m, k);
+        checkError(err, "Enqueueing split-K GEMM");
+        err = clFinish(commands);
+        checkError(err, "Waiting for split-K GEMM to finish");
+        t = wtime() - t;
+        if (r > 0)
+          trials[r-1] = t;
+      }
+      snprintf(name, sizeof(name), "splitk %dx%dx%d /%d", m, m, k, g.splits);
+      roofline_report(&roof, name, flops, bytes, best_of(trials));
+      snprintf(shape, sizeof(shape), "%dx%dx%d", m, m, k);
+      perf_add(&run, f ? "splitk/1" : "splitk/auto", shape, trials, REPS);
+    }
+
+    clReleaseMemObject(d_a);
+    clReleaseMemObject(d_b);
+    clReleaseMemObject(d_c);
+  }
+
+  // Precision: the same double operands through fp32 (rounded on upload),
+  // fp64 and float-float. GEMM counts 2n^3 flops over 3n^2 elements, vadd
+  // 1 flop over 3 elements and sum 1 flop over 1 element, of 4 or 8 bytes.
+  g.b_layout = B_AUTO;
+  fp64_ctx prec[PREC_MODES];
+  int have[PREC_MODES] = {1, 0, 0};
+  for (int m = 1; m < PREC_MODES; m++) {
+    err = fp64_init(&prec[m], context, device_id, &caps, prec_modes[m]);
+    if (err == CL_INVALID_DEVICE && prec_modes[m] == FP64_NATIVE)
+      continue;
+    checkError(err, "Creating fp64 kernels");
+    have[m] = 1;
+  }
+  vec_ctx v32;
+  err = vec_init(&v32, context, device_id, &caps, 1);
+  checkError(err, "Creating vadd kernel");
+
+  int prec_rows = sizeof(prec_orders) / sizeof(prec_orders[0]) + 2;
+  double prec_err[prec_rows][PREC_MODES];
+  char prec_label[prec_rows][32];
+  for (int row = 0; row < prec_rows; row++) {
+    int op = (row < prec_rows - 2) ? PREC_GEMM : (row == prec_rows - 2 ? PREC_VADD : PREC_SUM);
+    unsigned int n = (op == PREC_GEMM) ? prec_orders[row] : PREC_COUNT;
+    size_t count = (op == PREC_GEMM) ? (size_t)n * n : n;
+    const char *op_name = (op == PREC_GEMM) ? "gemm" : (op == PREC_VADD ? "vadd" : "sum");
+    snprintf(prec_label[row], sizeof(prec_label[row]), "%s %u", op_name, n);
+    snprintf(shape, sizeof(shape), "%u", n);
+    double flops = (op == PREC_GEMM) ? 2.0 * n * n * (double)n : (double)n;
+    double elems = (op == PREC_GEMM || op == PREC_VADD) ? 3.0 * count : (double)count;
+
+    // Host operands and the reference, the sum's in long double
+    double *h[3];
+    for (i = 0; i < 3; i++) {
+      h[i] = malloc(sizeof(double) * count);
+      if (!h[i]) {
+        printf("Error: precision operand alloc failed\n");
+        exit(1);
+      }
+    }
+    double *ref = malloc(sizeof(double) * count);
+    float *h32 = malloc(sizeof(float) * count);
+    if (!ref || !h32) {
+      printf("Error: precision reference alloc failed\n");
+      exit(1);
+    }
+    rng_uniform_host_double(h[0], count, RNG_SEED, 0);
+    rng_uniform_host_double(h[1], count, RNG_SEED, count);
+    if (op == PREC_GEMM) {
+      sequential_dgemm(h[0], h[1], ref, n, n, n);
+    } else if (op == PREC_VADD) {
+      for (size_t e = 0; e < count; e++)
+        ref[e] = h[0][e] + h[1][e];
+    } else {
+      long double acc = 0.0L;
+      for (size_t e = 0; e < count; e++)
+        acc += h[0][e];
+      ref[0] = (double)acc;
+    }
+
+    for (int m = 0; m < PREC_MODES; m++) {
+      prec_err[row][m] = -1.0;
+      if (!have[m])
+        continue;
+      fp64_ctx *d = (prec_modes[m] == PREC_FP32) ? NULL : &prec[m];
+      size_t elem = d ? sizeof(double) : sizeof(float);
+      if (elem * count > caps.max_alloc)
+        continue;
+      cl_mem buf[3];
+      for (i = 0; i < 3; i++) {
+        buf[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, elem * count, NULL, &err);
+        checkError(err, "Creating precision buffer");
+      }
+      for (i = 0; i < 2; i++) {
+        if (d) {
+          err = fp64_write(d, commands, buf[i], h[i], count);
+        } else {
+          for (size_t e = 0; e < count; e++)
+            h32[e] = (float)h[i][e];
+          err = clEnqueueWriteBuffer(commands, buf[i], CL_TRUE, 0, elem * count, h32, 0, NULL, NULL);
+        }
+        checkError(err, "Writing precision operand");
+      }
+
+      double sum = 0.0;
+      double t = time_prec(commands, &g, &v32, d, op, buf, n, &sum, trials);
+      const char *prec_name = d ? fp64_mode_name(prec_modes[m]) : "fp32";
+      char name[64];
+      snprintf(name, sizeof(name), "%s %s %u", op_name, prec_name, n);
+      roofline_report(&roof, name, flops, elems * elem, t);
+      snprintf(name, sizeof(name), "%s/%s", op_name, prec_name);
+      perf_add(&run, name, shape, trials, REPS);
+
+      if (op == PREC_SUM) {
+        prec_err[row][m] = prec_error(ref, &sum, 1);
+      } else {
+        if (d) {
+          err = fp64_read(d, commands, buf[2], h[2], count);
+        } else {
+          err = clEnqueueReadBuffer(commands, buf[2], CL_TRUE, 0, elem * count, h32, 0, NULL, NULL);
+          for (size_t e = 0; e < count; e++)
+            h[2][e] = h32[e];
+        }
+        checkError(err, "Reading precision result");
+        prec_err[row][m] = prec_error(ref, h[2], count);
+      }
+      for (i = 0; i < 3; i++)
+        clReleaseMemObject(buf[i]);
+    }
+    for (i = 0; i < 3; i++)
+      free(h[i]);
+    free(ref);
+    free(h32);
+  }
+
+  printf("\n%-24s %12s %12s %12s\n", "rel err vs double", "fp32", "fp64", "float-float");
+  for (int row = 0; row < prec_rows; row++) {
+    printf("%-24s", prec_label[row]);
+    for (int m = 0; m < PREC_MODES; m++) {
+      if (prec_err[row][m] < 0.0)
+        printf(" %12s", "-");
+      else
+        printf(" %12.3e", prec_err[row][m]);
+    }
+    printf("\n");
+  }
+  for (int m = 1; m < PREC_MODES; m++) {
+    if (have[m])
+      fp64_release(&prec[m]);
+  }
+  vec_release(&v32);
+
+  gemm_release(&g);
+  rng_release(&rng);
+  pool_release(&pool);
+  release_programs();
+  clReleaseCommandQueue(commands);
+  clReleaseContext(context);
+
+  // Gate against the stored baseline, then store this run
+  int regressions = 0;
+  if (compare_path) {
+    perf_run base;
+    if (perf_load_baseline(&base, compare_path, run.device, run.commit, baseline))
+      regressions = perf_compare(&base, &run, threshold, PERF_ALPHA);
+    else
+      printf("\nNo baseline run in %s for %s\n", compare_path, run.device);
+    perf_free(&base);
+  }
+  if (save_path)
+    perf_save(&run, save_path);
+  perf_free(&run);
+
+  return regressions ? EXIT_FAILURE : 0;
+}
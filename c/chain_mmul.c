@@ -0,0 +1,198 @@
+/*
+ * Matrix chain product (a0 a1 ... an-1) in the cheapest order
+ *
+ *   chain_mmul [d0 d1 ... dn]    matrix i is di x di+1, default below
+ *
+ * Runs the chain in the order plan_chain picks and left to right, with
+ * intermediates kept on the device, and reports flops and time for both.
+ * Exits nonzero if either result is off the host reference.
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include<sys/types.h>
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#include <unistd.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "err_code.h"
+#include "device_info.h"
+#include "kernel_cache.h"
+#include "mat_lib.h"
+#include "matchain.h"
+#include "rng.h"
+
+#ifndef DEVICE
+#define DEVICE CL_DEVICE_TYPE_DEFAULT
+#endif
+
+extern double wtime();
+
+#define TOL   (0.0001) // Relative Frobenius error allowed against the host
+#define REPS  (5)      // Timed runs per order
+
+// Long thin chain where left to right builds 2048 x 2048 intermediates
+static const int default_dims[] = {2048, 32, 2048, 32, 2048, 32};
+
+// The chain on the host in p's order, for the reference
+float* host_chain(const chain_plan *p, float **h) {
+  float *temp[CHAIN_MAX - 1];
+  for (int t = 0; t < p->steps; t++) {
+    const chain_step *st = &p->step[t];
+    float *a = CHAIN_IS_TEMP(st->left) ? temp[CHAIN_STEP(st->left)] : h[st->left];
+    float *b = CHAIN_IS_TEMP(st->right) ? temp[CHAIN_STEP(st->right)] : h[st->right];
+    temp[t] = (float *) calloc((size_t)st->m * st->n, sizeof(float));
+    sequential_gemm(a, b, temp[t], st->m, st->n, st->k);
+  }
+  for (int t = 0; t < p->steps - 1; t++)
+    free(temp[t]);
+  return temp[p->steps - 1];
+}
+
+double chain_error(const float *ref, const float *c, size_t count) {
+  double diff = 0.0, norm = 0.0;
+  for (size_t i = 0; i < count; i++) {
+    diff += ((double)ref[i] - c[i]) * ((double)ref[i] - c[i]);
+    norm += (double)ref[i] * ref[i];
+  }
+  return sqrt(diff / norm);
+}
+
+int main(int argc, char** argv) {
+  int err;
+  int i;
+  int dims[CHAIN_MAX + 1];
+  int count = (argc > 1) ? argc - 2 : (int)(sizeof(default_dims) / sizeof(default_dims[0])) - 1;
+  if (count > CHAIN_MAX) {
+    printf("At most %d matrices\n", CHAIN_MAX);
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i <= count; i++)
+    dims[i] = (argc > 1) ? atoi(argv[i + 1]) : default_dims[i];
+
+  chain_plan plan, naive;
+  if (plan_chain(&plan, dims, count) != 0 || plan_chain_naive(&naive, dims, count) != 0) {
+    printf("Need 2 or more matrices with positive dimensions\n");
+    return EXIT_FAILURE;
+  }
+
+  // Operands from consecutive ranges of one stream
+  float *h[CHAIN_MAX];
+  uint64_t offset = 0;
+  for (i = 0; i < count; i++) {
+    size_t size = (size_t)dims[i] * dims[i+1];
+    h[i] = (float *) calloc(size, sizeof(float));
+    rng_uniform_host(h[i], size, RNG_SEED, offset);
+    offset += size;
+  }
+  size_t out_count = (size_t)dims[0] * dims[count];
+  float *h_ref = host_chain(&plan, h);
+  float *h_c = (float *) calloc(out_count, sizeof(float));
+
+  cl_device_id device_id;
+  cl_context context;
+  cl_command_queue commands;
+
+  // Set up platform and GPU device
+  cl_uint numPlatforms;
+  err = clGetPlatformIDs(0, NULL, &numPlatforms);
+  checkError(err, "Finding platforms");
+  if (numPlatforms == 0) {
+    printf("Found 0 platforms\n");
+    return EXIT_FAILURE;
+  }
+
+  // Get all platforms
+  cl_platform_id Platform[numPlatforms];
+  err = clGetPlatformIDs(numPlatforms, Platform, NULL);
+  checkError(err, "Getting platforms");
+
+  // Secure a GPU
+  for (i = 0; i < numPlatforms; i++) {
+    err = clGetDeviceIDs(Platform[i], DEVICE, 1, &device_id, NULL);
+    if (err == CL_SUCCESS) {
+      break;
+    }
+  }
+
+  if (device_id == NULL)
+    checkError(err, "Finding a device");
+
+  err = output_device_info(device_id);
+  checkError(err, "Finding device output");
+
+  context = clCreateContext(0, 1, &device_id, NULL, NULL, &err);
+  checkError(err, "Creating context");
+
+  commands = clCreateCommandQueue(context, device_id, 0, &err);
+  checkError(err, "Creating command queue");
+
+  cl_mem d[CHAIN_MAX];
+  for (i = 0; i < count; i++) {
+    d[i] = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+      sizeof(float) * dims[i] * dims[i+1], h[i], &err);
+    checkError(err, "Creating operand buffer");
+  }
+  cl_mem d_c = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(float) * out_count, NULL, &err);
+  checkError(err, "Creating buffer d_c");
+
+  chain_ctx chain;
+  err = chain_init(&chain, context, device_id);
+  checkError(err, "Creating chain executor");
+
+  printf("\n%d matrices:", count);
+  for (i = 0; i < count; i++)
+    printf(" %dx%d", dims[i], dims[i+1]);
+  printf("\n");
+
+  struct {
+    const char *label;
+    chain_plan *plan;
+  } orders[] = {{"planned", &plan}, {"naive", &naive}};
+  double seconds[2];
+  int failures = 0;
+  for (int o = 0; o < 2; o++) {
+    printf("%-8s ", orders[o].label);
+    chain_print(orders[o].plan);
+
+    // Warm-up run builds the kernels and sizes the slots
+    err = chain_mmul(&chain, commands, orders[o].plan, d, d_c);
+    checkError(err, "Enqueueing chain");
+    err = clFinish(commands);
+    checkError(err, "Waiting for chain to finish");
+
+    double rtime = wtime();
+    for (int r = 0; r < REPS; r++) {
+      err = chain_mmul(&chain, commands, orders[o].plan, d, d_c);
+      checkError(err, "Enqueueing chain");
+    }
+    err = clFinish(commands);
+    checkError(err, "Waiting for chain to finish");
+    seconds[o] = (wtime() - rtime) / REPS;
+
+    err = clEnqueueReadBuffer(commands, d_c, CL_TRUE, 0, sizeof(float) * out_count, h_c, 0, NULL, NULL);
+    checkError(err, "Reading chain result");
+    double rel = chain_error(h_ref, h_c, out_count);
+    failures += !(rel < TOL);
+    printf("%-8s %12lf s %10.2f GFLOPS  rel err %.3e\n", "", seconds[o], orders[o].plan->flops / seconds[o] * 1e-9, rel);
+  }
+  printf("planned order: %.1fx fewer flops, %.2fx faster\n", naive.flops / plan.flops, seconds[1] / seconds[0]);
+
+  chain_release(&chain);
+  for (i = 0; i < count; i++) {
+    clReleaseMemObject(d[i]);
+    free(h[i]);
+  }
+  clReleaseMemObject(d_c);
+  release_programs();
+  clReleaseCommandQueue(commands);
+  clReleaseContext(context);
+  free(h_ref);
+  free(h_c);
+
+  return failures ? EXIT_FAILURE : 0;
+}
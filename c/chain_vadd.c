@@ -14,6 +14,10 @@
 #endif
 
 #include "err_code.h"
+#include "device_info.h"
+#include "vector_ops.h"
+#include "kernel_cache.h"
+#include "rng.h"
 
 // Pick up device type from compiler commd line or from the default type
 #ifndef DEVICE
@@ -21,26 +25,12 @@
 #endif
 
 extern double wtime();
-extern int output_device_info(cl_device_id);
 
 #define TOL     (0.001) // Tolerance used inf loating point comparisons
 #define LENGTH  (1024)  // Length of vectors a, b, and c
 
 int test_results(float* h_a, float* h_b, float* h_c, int count);
 
-const char *KernelSource = "\n" \
-"__kernel void vadd(                      \n" \
-" __global float* a,                      \n" \
-" __global float* b,                      \n" \
-" __global float* c,                      \n" \
-" const unsigned int count) {             \n" \
-"   int i = get_global_id(0);             \n" \
-"   if (i < count)                        \n" \
-"     c[i] = a[i] + b[i];                 \n" \
-"}                                        \n" \
-"\n";
-
-
 int main(int argc, char** argv) {
   int err;
 
@@ -55,14 +45,10 @@ int main(int argc, char** argv) {
   // Number of correct results
   //unsigned int correct;
   
-  // Global domain size
-  size_t global;
-  
   cl_device_id device_id;
   cl_context context;
   cl_command_queue commands;
-  cl_program program;
-  cl_kernel ko_vadd;            // Compute kernel
+  vec_ctx vadd;                 // Compute kernel and its launch shape
   
   // Device memory used for vectors
   cl_mem d_a; 
@@ -73,15 +59,14 @@ int main(int argc, char** argv) {
   cl_mem d_f;
   cl_mem d_g;
 
-  // Fill vectors a and b with random float values
+  // a, b, e and g are consecutive ranges of one random stream, generated
+  // on the device below; the host copies are only for checking
   int i = 0;
   int count = LENGTH;
-  for (i = 0; i < count; i++) {
-    h_a[i] = rand() / (float)RAND_MAX;
-    h_b[i] = rand() / (float)RAND_MAX;
-    h_e[i] = rand() / (float)RAND_MAX;
-    h_g[i] = rand() / (float)RAND_MAX;
-  }
+  rng_uniform_host(h_a, count, RNG_SEED, 0);
+  rng_uniform_host(h_b, count, RNG_SEED, count);
+  rng_uniform_host(h_e, count, RNG_SEED, 2 * count);
+  rng_uniform_host(h_g, count, RNG_SEED, 3 * count);
 
   // Set up platform and GPU devices
   
@@ -112,6 +97,10 @@ int main(int argc, char** argv) {
   err = output_device_info(device_id); 
   checkError(err, "Finding device output");
 
+  device_caps caps;
+  err = query_device_caps(device_id, &caps);
+  checkError(err, "Querying device capabilities");
+
   // Create a compute context
   context = clCreateContext(0, 1, &device_id, NULL, NULL, &err);
   checkError(err, "Creating context");
@@ -120,34 +109,18 @@ int main(int argc, char** argv) {
   commands = clCreateCommandQueue(context, device_id, 0, &err);
   checkError(err, "Creating command queue");
 
-  // Create the compute program from the source buffer
-  program = clCreateProgramWithSource(context, 1, (const char **) & KernelSource, NULL, &err);
-  checkError(err, "Creating program");
-
-  // Build the program 
-  err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-  if (err != CL_SUCCESS) {
-    size_t len; 
-    char buffer[2048];
-
-    printf("Error: Failed to build program executable!\n%s\n", err_code(err));
-    clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
-    printf("%s\n", buffer);
-    return EXIT_FAILURE;
-  }
-
-  // Create the compute kernel from the program
-  ko_vadd = clCreateKernel(program, "vadd", &err);
+  // Create the compute kernel, vectorised to suit the device
+  err = vec_init(&vadd, context, device_id, &caps, 0);
   checkError(err, "Creating kernel");
 
   // Create the input (a, b, e, g) and output (c, d, f) arrays in device memory
-  d_a = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float) * count, NULL, &err);
+  d_a = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * count, NULL, &err);
   checkError(err, "Creating buffer d_a");
-  d_b = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float) * count, NULL, &err);
+  d_b = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * count, NULL, &err);
   checkError(err, "Creating buffer d_b");
-  d_e = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float) * count, NULL, &err);
+  d_e = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * count, NULL, &err);
   checkError(err, "Creating buffer d_e");
-  d_g = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float) * count, NULL, &err);
+  d_g = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * count, NULL, &err);
   checkError(err, "Creating buffer d_g");
 
   d_c = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * count, NULL, &err);
@@ -157,49 +130,30 @@ int main(int argc, char** argv) {
   d_f = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(float) * count, NULL, &err);
   checkError(err, "Creating buffer d_f");
 
-  // Write vectors into compute device memory 
-  err = clEnqueueWriteBuffer(commands, d_a, CL_TRUE, 0, sizeof(float) * count, h_a, 0, NULL, NULL);
-  checkError(err, "Copying h_a to device at d_a");
-  err = clEnqueueWriteBuffer(commands, d_b, CL_TRUE, 0, sizeof(float) * count, h_b, 0, NULL, NULL);
-  checkError(err, "Copying h_b to device at d_b");
-  err = clEnqueueWriteBuffer(commands, d_e, CL_TRUE, 0, sizeof(float) * count, h_e, 0, NULL, NULL);
-  checkError(err, "Copying h_e to device at d_e");
-  err = clEnqueueWriteBuffer(commands, d_g, CL_TRUE, 0, sizeof(float) * count, h_g, 0, NULL, NULL);
-  checkError(err, "Copying h_g to device at d_g");
-
-  // Set the arguments to our compute kernel
-  err = clSetKernelArg(ko_vadd, 0, sizeof(cl_mem), &d_a);
-  err |= clSetKernelArg(ko_vadd, 1, sizeof(cl_mem), &d_b);
-  err |= clSetKernelArg(ko_vadd, 2, sizeof(cl_mem), &d_c);
-  err |= clSetKernelArg(ko_vadd, 3, sizeof(unsigned int), &count);
-  checkError(err, "Setting kernel arguments");
+  // Generate the inputs in place rather than uploading them
+  rng_ctx rng;
+  err = rng_init(&rng, context, device_id);
+  checkError(err, "Creating RNG kernels");
+  cl_mem inputs[] = {d_a, d_b, d_e, d_g};
+  for (i = 0; i < 4; i++) {
+    err = rng_uniform(&rng, commands, inputs[i], count, RNG_SEED, (uint64_t)i * count);
+    checkError(err, "Generating input vector");
+  }
+  err = clFinish(commands);
+  checkError(err, "Waiting for inputs");
 
   double rtime = wtime();
 
-  // Execute the kernel over the entire range of our 1d input data 
-  // letting the OpenCL runtime choose the work-group size
-  global = count;
-  err = clEnqueueNDRangeKernel(commands, ko_vadd, 1, NULL, &global, NULL, 0, NULL, NULL);
+  // c = a + b
+  err = vec_add(&vadd, commands, d_a, d_b, d_c, count);
   checkError(err, "Enqueueing kernel");
-  
-  // d = c + e
-  err = clSetKernelArg(ko_vadd, 0, sizeof(cl_mem), &d_c);
-  err |= clSetKernelArg(ko_vadd, 1, sizeof(cl_mem), &d_e);
-  err |= clSetKernelArg(ko_vadd, 2, sizeof(cl_mem), &d_d);
-  err |= clSetKernelArg(ko_vadd, 3, sizeof(unsigned int), &count);
-  checkError(err, "Setting kernel arguments");
 
-  err = clEnqueueNDRangeKernel(commands, ko_vadd, 1, NULL, &global, NULL, 0, NULL, NULL);
+  // d = c + e
+  err = vec_add(&vadd, commands, d_c, d_e, d_d, count);
   checkError(err, "Enqueueing kernel");
-  
-  // f = d + g
-  err = clSetKernelArg(ko_vadd, 0, sizeof(cl_mem), &d_d);
-  err |= clSetKernelArg(ko_vadd, 1, sizeof(cl_mem), &d_g);
-  err |= clSetKernelArg(ko_vadd, 2, sizeof(cl_mem), &d_f);
-  err |= clSetKernelArg(ko_vadd, 3, sizeof(unsigned int), &count);
-  checkError(err, "Setting kernel arguments");
 
-  err = clEnqueueNDRangeKernel(commands, ko_vadd, 1, NULL, &global, NULL, 0, NULL, NULL);
+  // f = d + g
+  err = vec_add(&vadd, commands, d_d, d_g, d_f, count);
   checkError(err, "Enqueueing kernel");
 
   // Wait for the commands to complete before stopping the timer
@@ -244,9 +198,12 @@ int main(int argc, char** argv) {
   */
 
   // Summarize results
-  printf("C = A+B: %d out of %d results were correct.\n", test_results(h_a, h_b, h_c, count), count);
-  printf("D = C+E: %d out of %d results were correct.\n", test_results(h_c, h_e, h_d, count), count);
-  printf("F = D+G: %d out of %d results were correct.\n", test_results(h_d, h_g, h_f, count), count);
+  int correct_c = test_results(h_a, h_b, h_c, count);
+  int correct_d = test_results(h_c, h_e, h_d, count);
+  int correct_f = test_results(h_d, h_g, h_f, count);
+  printf("C = A+B: %d out of %d results were correct.\n", correct_c, count);
+  printf("D = C+E: %d out of %d results were correct.\n", correct_d, count);
+  printf("F = D+G: %d out of %d results were correct.\n", correct_f, count);
 
   // Clean up 
   clReleaseMemObject(d_a);
@@ -256,8 +213,9 @@ int main(int argc, char** argv) {
   clReleaseMemObject(d_e);
   clReleaseMemObject(d_f);
   clReleaseMemObject(d_g);
-  clReleaseProgram(program);
-  clReleaseKernel(ko_vadd);
+  vec_release(&vadd);
+  rng_release(&rng);
+  release_programs();
   clReleaseCommandQueue(commands);
   clReleaseContext(context);
   
@@ -269,7 +227,7 @@ int main(int argc, char** argv) {
   free(h_f);
   free(h_g);
 
-  return 0;
+  return (correct_c == count && correct_d == count && correct_f == count) ? 0 : EXIT_FAILURE;
 }
 
 // Test the results
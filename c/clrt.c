@@ -0,0 +1,332 @@
+/*
+ * C runtime entry points for foreign callers
+ *
+ * Wraps the GEMM driver and vector ops behind host pointers so a ctypes
+ * caller (clrt.py) can hand over NumPy arrays without copying them. ctypes
+ * drops the GIL around every call into this library. Without an OpenCL
+ * platform the same calls run on the host backend's thread pool.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "clrt.h"
+#include "kernel_cache.h"
+#include "device_info.h"
+#include "gemm.h"
+#include "vector_ops.h"
+#include "host_ops.h"
+
+#ifndef DEVICE
+#define DEVICE CL_DEVICE_TYPE_DEFAULT
+#endif
+
+#define MAX_PLATFORMS (16)
+
+struct clrt {
+  int backend;
+  thread_pool *pool;            // host backend only
+  pthread_mutex_t lock;         // one call at a time on this handle
+  char host_name[64];
+  cl_device_id device;
+  cl_context context;
+  cl_command_queue commands;
+  device_caps caps;
+  gemm_ctx gemm;
+  vec_ctx vec;
+};
+
+// Kernels, queue and kernel arguments belong to a handle and sit behind its
+// lock; the program cache locks itself. open_lock covers the count of open
+// handles, which decides when the cached programs go.
+static pthread_mutex_t open_lock = PTHREAD_MUTEX_INITIALIZER;
+static int num_open = 0;
+
+// Wraps a caller's array; inputs are only read, so the const is dropped
+static cl_mem wrap(clrt *rt, cl_mem_flags flags, const float *p, size_t count, cl_int *err) {
+  return clCreateBuffer(rt->context, flags | CL_MEM_USE_HOST_PTR, sizeof(float) * count, (void *)p, err);
+}
+
+// Brings a wrapped output back into the caller's array, a no-op on devices
+// that already wrote it in place
+static cl_int sync_out(clrt *rt, cl_mem d, size_t count) {
+  cl_int err;
+  void *p = clEnqueueMapBuffer(rt->commands, d, CL_TRUE, CL_MAP_READ, 0, sizeof(float) * count, 0, NULL, NULL, &err);
+  if (err != CL_SUCCESS)
+    return err;
+  err = clEnqueueUnmapMemObject(rt->commands, d, p, 0, NULL, NULL);
+  if (err != CL_SUCCESS)
+    return err;
+  return clFinish(rt->commands);
+}
+
+// Sets up the OpenCL side of rt on the first device of the DEVICE type
+static cl_int open_opencl(clrt *rt, const char *kernel_dir) {
+  cl_platform_id platforms[MAX_PLATFORMS];
+  cl_uint num_platforms;
+  cl_int err;
+
+  set_kernel_dir(kernel_dir);
+
+  err = clGetPlatformIDs(MAX_PLATFORMS, platforms, &num_platforms);
+  if (err == CL_SUCCESS && num_platforms == 0)
+    err = CL_DEVICE_NOT_FOUND;
+  if (err != CL_SUCCESS)
+    goto fail;
+  if (num_platforms > MAX_PLATFORMS)
+    num_platforms = MAX_PLATFORMS;
+  for (cl_uint i = 0; i < num_platforms; i++) {
+    err = clGetDeviceIDs(platforms[i], DEVICE, 1, &rt->device, NULL);
+    if (err == CL_SUCCESS)
+      break;
+  }
+  if (err != CL_SUCCESS)
+    goto fail;
+
+  err = query_device_caps(rt->device, &rt->caps);
+  if (err != CL_SUCCESS)
+    goto fail;
+  rt->context = clCreateContext(0, 1, &rt->device, NULL, NULL, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  rt->commands = clCreateCommandQueue(rt->context, rt->device, 0, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  err = gemm_init(&rt->gemm, rt->context, rt->device, 0);
+  if (err != CL_SUCCESS)
+    goto fail;
+  err = vec_init(&rt->vec, rt->context, rt->device, &rt->caps, 0);
+  if (err != CL_SUCCESS)
+    goto fail;
+
+  pthread_mutex_lock(&open_lock);
+  num_open++;
+  pthread_mutex_unlock(&open_lock);
+  return CL_SUCCESS;
+
+fail:
+  // Both are zeroed by calloc or their own unwinding, so safe to release
+  gemm_release(&rt->gemm);
+  vec_release(&rt->vec);
+  if (rt->commands)
+    clReleaseCommandQueue(rt->commands);
+  if (rt->context)
+    clReleaseContext(rt->context);
+  rt->commands = NULL;
+  rt->context = NULL;
+  return err;
+}
+
+static cl_int open_host(clrt *rt) {
+  rt->pool = malloc(sizeof(thread_pool));
+  if (!rt->pool)
+    return CL_OUT_OF_HOST_MEMORY;
+  int threads = pool_init(rt->pool, 0);
+  rt->backend = CLRT_HOST;
+  snprintf(rt->host_name, sizeof(rt->host_name), "host (%d thread%s)", threads, threads == 1 ? "" : "s");
+  return CL_SUCCESS;
+}
+
+// CLRT_BACKEND=host or opencl, CLRT_AUTO when it's unset
+static int env_backend(void) {
+  const char *env = getenv("CLRT_BACKEND");
+  if (env && strcmp(env, "host") == 0)
+    return CLRT_HOST;
+  if (env && strcmp(env, "opencl") == 0)
+    return CLRT_OPENCL;
+  return CLRT_AUTO;
+}
+
+// The backend CLRT_BACKEND asks for, otherwise the host when the ICD loader
+// finds no OpenCL platform
+int clrt_select_backend(void) {
+  int backend = env_backend();
+  if (backend != CLRT_AUTO)
+    return backend;
+  cl_uint num_platforms = 0;
+  cl_int err = clGetPlatformIDs(0, NULL, &num_platforms);
+  return (err != CL_SUCCESS || num_platforms == 0) ? CLRT_HOST : CLRT_OPENCL;
+}
+
+// kernel_dir is where the .cl files live, NULL for the working directory.
+// CLRT_AUTO goes by clrt_select_backend and also falls back to the host
+// when no platform has a device of the DEVICE type.
+clrt* clrt_open_backend(const char *kernel_dir, int backend, int *err) {
+  int fallback = (backend == CLRT_AUTO && env_backend() == CLRT_AUTO);
+  clrt *rt = calloc(1, sizeof(clrt));
+  if (!rt) {
+    *err = CL_OUT_OF_HOST_MEMORY;
+    return NULL;
+  }
+  if (backend == CLRT_AUTO)
+    backend = clrt_select_backend();
+  pthread_mutex_init(&rt->lock, NULL);
+
+  if (backend == CLRT_OPENCL) {
+    *err = open_opencl(rt, kernel_dir);
+    if (*err == CL_DEVICE_NOT_FOUND && fallback)
+      backend = CLRT_HOST;
+  }
+  if (backend == CLRT_HOST)
+    *err = open_host(rt);
+  if (*err != CL_SUCCESS) {
+    pthread_mutex_destroy(&rt->lock);
+    free(rt);
+    return NULL;
+  }
+  return rt;
+}
+
+clrt* clrt_open(const char *kernel_dir, int *err) {
+  return clrt_open_backend(kernel_dir, CLRT_AUTO, err);
+}
+
+int clrt_backend(clrt *rt) {
+  return rt->backend;
+}
+
+const char* clrt_device_name(clrt *rt) {
+  if (rt->backend == CLRT_HOST)
+    return rt->host_name;
+  return rt->caps.name;
+}
+
+// c = a * b with a m x k and b k x n
+int clrt_gemm(clrt *rt, const float *a, const float *b, float *c, int m, int n, int k) {
+  cl_int err;
+  cl_mem d_a = NULL, d_b = NULL, d_c = NULL;
+  if (m <= 0 || n <= 0 || k <= 0)
+    return CL_INVALID_VALUE;
+  if (rt->backend == CLRT_HOST) {
+    pthread_mutex_lock(&rt->lock);
+    host_gemm(rt->pool, a, b, c, m, n, k);
+    pthread_mutex_unlock(&rt->lock);
+    return CL_SUCCESS;
+  }
+
+  pthread_mutex_lock(&rt->lock);
+  d_a = wrap(rt, CL_MEM_READ_ONLY, a, (size_t)m * k, &err);
+  if (err != CL_SUCCESS)
+    goto done;
+  d_b = wrap(rt, CL_MEM_READ_ONLY, b, (size_t)k * n, &err);
+  if (err != CL_SUCCESS)
+    goto done;
+  d_c = wrap(rt, CL_MEM_READ_WRITE, c, (size_t)m * n, &err);
+  if (err != CL_SUCCESS)
+    goto done;
+
+  err = gemm_mnk(&rt->gemm, rt->commands, d_a, d_b, d_c, m, n, k);
+  if (err == CL_SUCCESS)
+    err = sync_out(rt, d_c, (size_t)m * n);
+
+done:
+  if (d_a)
+    clReleaseMemObject(d_a);
+  if (d_b)
+    clReleaseMemObject(d_b);
+  if (d_c)
+    clReleaseMemObject(d_c);
+  pthread_mutex_unlock(&rt->lock);
+  return err;
+}
+
+int clrt_vadd(clrt *rt, const float *a, const float *b, float *c, unsigned int count) {
+  cl_int err;
+  cl_mem d_a = NULL, d_b = NULL, d_c = NULL;
+  if (count == 0)
+    return CL_SUCCESS;
+  if (rt->backend == CLRT_HOST) {
+    pthread_mutex_lock(&rt->lock);
+    host_vadd(rt->pool, a, b, c, count);
+    pthread_mutex_unlock(&rt->lock);
+    return CL_SUCCESS;
+  }
+
+  // Buffers overlapping one host region are undefined in OpenCL, so an array
+  // passed twice (c += a) is wrapped once and the handle shared
+  cl_mem_flags in_flags = (c == a || c == b) ? CL_MEM_READ_WRITE : CL_MEM_READ_ONLY;
+  pthread_mutex_lock(&rt->lock);
+  d_a = wrap(rt, in_flags, a, count, &err);
+  if (err != CL_SUCCESS)
+    goto done;
+  if (b == a) {
+    d_b = d_a;
+    clRetainMemObject(d_b);
+  } else {
+    d_b = wrap(rt, in_flags, b, count, &err);
+    if (err != CL_SUCCESS)
+      goto done;
+  }
+  if (c == a || c == b) {
+    d_c = (c == a) ? d_a : d_b;
+    clRetainMemObject(d_c);
+  } else {
+    d_c = wrap(rt, CL_MEM_WRITE_ONLY, c, count, &err);
+    if (err != CL_SUCCESS)
+      goto done;
+  }
+
+  err = vec_add(&rt->vec, rt->commands, d_a, d_b, d_c, count);
+  if (err == CL_SUCCESS)
+    err = sync_out(rt, d_c, count);
+
+done:
+  if (d_a)
+    clReleaseMemObject(d_a);
+  if (d_b)
+    clReleaseMemObject(d_b);
+  if (d_c)
+    clReleaseMemObject(d_c);
+  pthread_mutex_unlock(&rt->lock);
+  return err;
+}
+
+int clrt_sum(clrt *rt, const float *a, unsigned int count, double *sum) {
+  cl_int err;
+  *sum = 0.0;
+  if (count == 0)
+    return CL_SUCCESS;
+  if (rt->backend == CLRT_HOST) {
+    pthread_mutex_lock(&rt->lock);
+    *sum = host_sum(rt->pool, a, count);
+    pthread_mutex_unlock(&rt->lock);
+    return CL_SUCCESS;
+  }
+
+  pthread_mutex_lock(&rt->lock);
+  cl_mem d_a = wrap(rt, CL_MEM_READ_ONLY, a, count, &err);
+  if (err == CL_SUCCESS) {
+    err = vec_sum(&rt->vec, rt->commands, d_a, count, sum);
+    clReleaseMemObject(d_a);
+  }
+  pthread_mutex_unlock(&rt->lock);
+  return err;
+}
+
+void clrt_close(clrt *rt) {
+  if (!rt)
+    return;
+  if (rt->backend == CLRT_HOST) {
+    pool_release(rt->pool);
+    pthread_mutex_destroy(&rt->lock);
+    free(rt->pool);
+    free(rt);
+    return;
+  }
+  pthread_mutex_lock(&rt->lock);
+  clFinish(rt->commands);
+  gemm_release(&rt->gemm);
+  vec_release(&rt->vec);
+  clReleaseCommandQueue(rt->commands);
+  clReleaseContext(rt->context);
+  pthread_mutex_unlock(&rt->lock);
+  pthread_mutex_destroy(&rt->lock);
+  // Cached programs hold on to their contexts, drop them with the last handle
+  pthread_mutex_lock(&open_lock);
+  if (--num_open == 0)
+    release_programs();
+  pthread_mutex_unlock(&open_lock);
+  free(rt);
+}
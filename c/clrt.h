@@ -0,0 +1,31 @@
+#ifndef CLRT
+#define CLRT
+
+#include <stddef.h>
+
+// Host-pointer entry points into the runtime for foreign callers (clrt.py).
+// Arrays are float32, row-major and contiguous; they are wrapped with
+// CL_MEM_USE_HOST_PTR, so devices sharing host memory work on them in place.
+// clrt_vadd's c may be a or b itself; no other arrays may overlap.
+// Calls on one handle are serialised, different handles run concurrently
+// apart from kernel builds, which share one program cache. The kernel_dir
+// of the latest clrt_open applies to every handle.
+// Functions return a cl_int status, CL_SUCCESS (0) on success.
+typedef struct clrt clrt;
+
+// Backends behind a handle: the OpenCL device, or the host's own threads
+#define CLRT_AUTO   (-1)
+#define CLRT_OPENCL (0)
+#define CLRT_HOST   (1)
+
+clrt* clrt_open(const char *kernel_dir, int *err);
+clrt* clrt_open_backend(const char *kernel_dir, int backend, int *err);
+int clrt_select_backend(void);
+int clrt_backend(clrt *rt);
+const char* clrt_device_name(clrt *rt);
+int clrt_gemm(clrt *rt, const float *a, const float *b, float *c, int m, int n, int k);
+int clrt_vadd(clrt *rt, const float *a, const float *b, float *c, unsigned int count);
+int clrt_sum(clrt *rt, const float *a, unsigned int count, double *sum);
+void clrt_close(clrt *rt);
+
+#endif
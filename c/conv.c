@@ -0,0 +1,117 @@
+/*
+ * 2D convolution as an implicit GEMM
+ *
+ * Lowering to an explicit im2col matrix costs r*s times the input in
+ * memory; conv2d_igemm instead computes the im2col index of every element
+ * as it stages the tile, so the only buffers are x, w and y. The kernel is
+ * specialised on the shape like the GEMM kernels are on N, and uses the
+ * same tile. conv2d_fused adds the GEMM epilogue to the store, with the
+ * bias per output channel and the residual shaped like y.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "conv.h"
+#include "kernel_cache.h"
+#include "trace.h"
+
+// tile 0 takes the device's GEMM tile
+cl_int conv_init(conv_ctx *cv, cl_context context, cl_device_id device, int tile) {
+  cl_int err;
+  memset(cv, 0, sizeof(*cv));
+  cv->context = context;
+  cv->device = device;
+  if (tile == 0) {
+    device_caps caps;
+    err = query_device_caps(device, &caps);
+    if (err != CL_SUCCESS)
+      return err;
+    tile = caps_gemm_tile(&caps);
+  }
+  cv->tile = tile;
+  return CL_SUCCESS;
+}
+
+// Builds (or takes from the program cache) the kernel for cs and epi
+static cl_int ensure_kernel(conv_ctx *cv, const conv_shape *cs, const epilogue_spec *epi) {
+  cl_int err;
+  if (cv->ko_conv && memcmp(&cv->shape, cs, sizeof(conv_shape)) == 0 && memcmp(&cv->epi, epi, sizeof(epilogue_spec)) == 0)
+    return CL_SUCCESS;
+  if (cv->ko_conv)
+    clReleaseKernel(cv->ko_conv);
+  cv->ko_conv = NULL;
+
+  char defines[768], epi_defines[256];
+  epilogue_defines(epi, epi_defines, sizeof(epi_defines));
+  snprintf(defines, sizeof(defines),
+    "-D CONV_N=%d -D CONV_C=%d -D CONV_H=%d -D CONV_W=%d -D CONV_K=%d -D CONV_R=%d -D CONV_S=%d "
+    "-D CONV_OH=%d -D CONV_OW=%d -D CONV_STRIDE_H=%d -D CONV_STRIDE_W=%d -D CONV_PAD_H=%d -D CONV_PAD_W=%d "
+    "-D CONV_DIL_H=%d -D CONV_DIL_W=%d %s",
+    cs->n, cs->c, cs->h, cs->w, cs->k, cs->r, cs->s, CONV_OUT_H(cs), CONV_OUT_W(cs),
+    cs->stride_h, cs->stride_w, cs->pad_h, cs->pad_w, cs->dil_h, cs->dil_w, epi_defines);
+  kernel_spec spec = {0};
+  spec.tile = cv->tile;
+  spec.defines = defines;
+  cv->ko_conv = get_kernel(cv->context, cv->device, "conv.cl", "conv2d_igemm", &spec, &err);
+  if (err != CL_SUCCESS) {
+    cv->ko_conv = NULL;
+    return err;
+  }
+  // Rebuild with a smaller tile if the kernel takes less than the device
+  int fit = kernel_tile(cv->ko_conv, cv->device, cv->tile);
+  if (fit < cv->tile) {
+    clReleaseKernel(cv->ko_conv);
+    cv->ko_conv = NULL;
+    cv->tile = fit;
+    return ensure_kernel(cv, cs, epi);
+  }
+  cv->shape = *cs;
+  cv->epi = *epi;
+  return CL_SUCCESS;
+}
+
+// y = conv(x, w): x is n x c x h x w, w is k x c x r x s and y is
+// n x k x oh x ow, all NCHW
+cl_int conv2d(conv_ctx *cv, cl_command_queue commands, const conv_shape *cs, cl_mem d_x, cl_mem d_w, cl_mem d_y) {
+  return conv2d_fused(cv, commands, cs, NULL, d_x, d_w, d_y, NULL, NULL, 1.0f);
+}
+
+// y = act(alpha * conv(x, w) + bias[k]) + residual, the terms epi leaves
+// out unused; bias has one value per output channel and residual is
+// n x k x oh x ow like y. epi NULL is plain conv2d.
+cl_int conv2d_fused(conv_ctx *cv, cl_command_queue commands, const conv_shape *cs, const epilogue_spec *epi,
+                    cl_mem d_x, cl_mem d_w, cl_mem d_y, cl_mem d_bias, cl_mem d_res, float alpha) {
+  cl_int err;
+  epilogue_spec none = {0};
+  if (!epi)
+    epi = &none;
+  if (cs->n <= 0 || cs->c <= 0 || cs->k <= 0 || cs->r <= 0 || cs->s <= 0 || cs->stride_h <= 0 ||
+      cs->stride_w <= 0 || cs->dil_h <= 0 || cs->dil_w <= 0 || cs->pad_h < 0 || cs->pad_w < 0 ||
+      CONV_OUT_H(cs) <= 0 || CONV_OUT_W(cs) <= 0)
+    return CL_INVALID_VALUE;
+  err = ensure_kernel(cv, cs, epi);
+  if (err != CL_SUCCESS)
+    return err;
+
+  err = clSetKernelArg(cv->ko_conv, 0, sizeof(cl_mem), &d_x);
+  err |= clSetKernelArg(cv->ko_conv, 1, sizeof(cl_mem), &d_w);
+  err |= clSetKernelArg(cv->ko_conv, 2, sizeof(cl_mem), &d_y);
+  if (epilogue_enabled(epi))
+    err |= set_epilogue_args(cv->ko_conv, 3, d_bias, d_res, alpha, sizeof(float));
+  if (err != CL_SUCCESS)
+    return err;
+
+  // Columns are output pixels, rows output channels, both padded to the tile
+  size_t tile = cv->tile;
+  size_t cols = (size_t)cs->n * CONV_OUT_H(cs) * CONV_OUT_W(cs);
+  const size_t global[2] = {(cols + tile - 1) / tile * tile, (cs->k + tile - 1) / tile * tile};
+  const size_t local[2] = {tile, tile};
+  return clEnqueueNDRangeKernel(commands, cv->ko_conv, 2, NULL, global, local, 0, NULL, TRACE_EV("kernel", "conv2d_igemm"));
+}
+
+void conv_release(conv_ctx *cv) {
+  if (cv->ko_conv)
+    clReleaseKernel(cv->ko_conv);
+  cv->ko_conv = NULL;
+}
@@ -0,0 +1,59 @@
+#include "kernel_common.clh"
+
+// Implicit-GEMM 2D convolution over NCHW input x with CONV_K x CONV_C x
+// CONV_R x CONV_S filters w. As a GEMM, c (M x N) = w (M x K) * im2col(x)
+// (K x N) with M = CONV_K output channels, K = CONV_C*CONV_R*CONV_S and N =
+// CONV_N*CONV_OH*CONV_OW output pixels. The im2col matrix never exists: the
+// b tile is gathered from x while it is staged in local memory, as in
+// mmul_tiled, with zeros for padding and past the edges. Shape and TILE come
+// in as -D options from conv.c.
+
+#define GEMM_M  CONV_K
+#define GEMM_K  (CONV_C * CONV_R * CONV_S)
+#define GEMM_N  (CONV_N * CONV_OH * CONV_OW)
+#define OUT_HW  (CONV_OH * CONV_OW)
+
+__kernel void conv2d_igemm(__global DTYPE *x, __global DTYPE *w, __global DTYPE *c EPILOGUE_ARGS) {
+  __local DTYPE w_sub[TILE][TILE];
+  __local DTYPE x_sub[TILE][TILE];
+
+  int i = get_global_id(0);   // output pixel, column of c
+  int j = get_global_id(1);   // output channel, row of c
+  int li = get_local_id(0);
+  int lj = get_local_id(1);
+
+  // Where column i's receptive field starts in x
+  int img = i / OUT_HW;
+  int p = i % OUT_HW;
+  int ih0 = (p / CONV_OW) * CONV_STRIDE_H - CONV_PAD_H;
+  int iw0 = (p % CONV_OW) * CONV_STRIDE_W - CONV_PAD_W;
+  __global DTYPE *x_img = x + (size_t)img * CONV_C * CONV_H * CONV_W;
+
+  DTYPE tmp = 0;
+  for (int t = 0; t < GEMM_K; t += TILE) {
+    int kw = t + li;
+    w_sub[lj][li] = (j < GEMM_M && kw < GEMM_K) ? w[j*GEMM_K+kw] : 0;
+
+    // Row kx of im2col is input channel ci at filter tap (r, s)
+    int kx = t + lj;
+    DTYPE v = 0;
+    if (i < GEMM_N && kx < GEMM_K) {
+      int ci = kx / (CONV_R * CONV_S);
+      int rs = kx % (CONV_R * CONV_S);
+      int ih = ih0 + (rs / CONV_S) * CONV_DIL_H;
+      int iw = iw0 + (rs % CONV_S) * CONV_DIL_W;
+      if (ih >= 0 && ih < CONV_H && iw >= 0 && iw < CONV_W)
+        v = x_img[(ci*CONV_H+ih)*CONV_W+iw];
+    }
+    x_sub[lj][li] = v;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int k = 0; k < TILE; k++) {
+      tmp += w_sub[lj][k] * x_sub[k][li];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  // NCHW store; the epilogue's bias is per output channel
+  if (i < GEMM_N && j < GEMM_M)
+    STORE_C(((size_t)img*CONV_K+j)*OUT_HW+p, j, tmp);
+}
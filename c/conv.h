@@ -0,0 +1,31 @@
+#ifndef CONV
+#define CONV
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "mat_lib.h"
+#include "device_info.h"
+#include "epilogue.h"
+
+// Implicit-GEMM convolution: the conv2d_igemm kernel built for the last
+// shape and epilogue seen, on the GEMM tile of the device
+typedef struct {
+  cl_context context;
+  cl_device_id device;
+  int tile;
+  conv_shape shape;
+  epilogue_spec epi;
+  cl_kernel ko_conv;
+} conv_ctx;
+
+cl_int conv_init(conv_ctx *cv, cl_context context, cl_device_id device, int tile);
+cl_int conv2d(conv_ctx *cv, cl_command_queue commands, const conv_shape *cs, cl_mem d_x, cl_mem d_w, cl_mem d_y);
+cl_int conv2d_fused(conv_ctx *cv, cl_command_queue commands, const conv_shape *cs, const epilogue_spec *epi,
+                    cl_mem d_x, cl_mem d_w, cl_mem d_y, cl_mem d_bias, cl_mem d_res, float alpha);
+void conv_release(conv_ctx *cv);
+
+#endif
@@ -0,0 +1,227 @@
+/*
+ * 2D convolution (y = conv(x, w)) as an implicit GEMM
+ *
+ *   conv2d [batch]    batch of the timed layer, default 8
+ *
+ * Checks conv2d_igemm against the host convolution over shapes with
+ * stride, padding, dilation and odd sizes, plain and with a fused
+ * epilogue, and that a filter wider than its padded input is rejected.
+ * Then times a 3x3 layer and reports the memory an explicit im2col would
+ * have taken. Exits nonzero on a mismatch.
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include<sys/types.h>
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#include <unistd.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "err_code.h"
+#include "device_info.h"
+#include "kernel_cache.h"
+#include "mat_lib.h"
+#include "conv.h"
+#include "rng.h"
+
+#ifndef DEVICE
+#define DEVICE CL_DEVICE_TYPE_DEFAULT
+#endif
+
+extern double wtime();
+
+#define TOL   (0.0001) // Relative Frobenius error allowed against the host
+#define REPS  (10)     // Timed launches of the layer
+#define BATCH (8)      // Default batch of the timed layer, override with argv[1]
+
+// n c h w, k r s, stride, pad, dilation
+static const conv_shape checks[] = {
+  {1, 1, 5, 5, 1, 3, 3, 1, 1, 0, 0, 1, 1},
+  {2, 3, 9, 9, 4, 3, 3, 2, 2, 1, 1, 1, 1},
+  {1, 5, 17, 13, 7, 3, 5, 1, 2, 2, 1, 2, 1},
+  {3, 16, 14, 14, 33, 1, 1, 1, 1, 0, 0, 1, 1},
+  {2, 8, 23, 19, 12, 5, 5, 3, 2, 2, 2, 1, 2},
+  {1, 3, 32, 32, 16, 7, 7, 2, 2, 3, 3, 1, 1},
+};
+
+// Dilated 2x2 filter spanning 6 pixels of a 5 pixel input with stride 2,
+// no output; truncating division would make that one pixel
+static const conv_shape too_wide = {1, 1, 5, 5, 1, 2, 2, 2, 2, 0, 0, 5, 5};
+
+// Epilogue of the fused checks: relu(alpha * y + bias[k]) + residual
+static const epilogue_spec fused = {1, 1, ACT_RELU, 1};
+#define FUSED_ALPHA (0.5f)
+
+// ResNet-style 3x3 layer, batch from the command line
+static const conv_shape layer = {BATCH, 64, 56, 56, 64, 3, 3, 1, 1, 1, 1, 1, 1};
+
+// Runs cs on device and host, with epi fused when it isn't NULL, returns
+// the relative error and sets seconds to the mean over reps launches after
+// a warm-up
+double run_conv(conv_ctx *cv, cl_context context, cl_command_queue commands, const conv_shape *cs,
+                const epilogue_spec *epi, int reps, double *seconds) {
+  int err;
+  size_t x_count = (size_t)cs->n * cs->c * cs->h * cs->w;
+  size_t w_count = (size_t)cs->k * cs->c * cs->r * cs->s;
+  size_t y_count = (size_t)cs->n * cs->k * CONV_OUT_H(cs) * CONV_OUT_W(cs);
+  float *h_x = (float *) calloc(x_count, sizeof(float));
+  float *h_w = (float *) calloc(w_count, sizeof(float));
+  float *h_y = (float *) calloc(y_count, sizeof(float));
+  float *h_ref = (float *) calloc(y_count, sizeof(float));
+  float *h_bias = (float *) calloc(cs->k, sizeof(float));
+  float *h_res = (float *) calloc(y_count, sizeof(float));
+  rng_uniform_host(h_x, x_count, RNG_SEED, 0);
+  rng_uniform_host(h_w, w_count, RNG_SEED, x_count);
+  sequential_conv2d(h_x, h_w, h_ref, cs);
+  if (epi) {
+    // Bias in [-0.5, 0.5) so the relu clips some outputs at any depth
+    rng_uniform_host(h_bias, cs->k, RNG_SEED + 1, 0);
+    rng_uniform_host(h_res, y_count, RNG_SEED + 2, 0);
+    size_t hw = (size_t)CONV_OUT_H(cs) * CONV_OUT_W(cs);
+    for (int k = 0; k < cs->k; k++)
+      h_bias[k] -= 0.5f;
+    for (size_t i = 0; i < y_count; i++)
+      h_ref[i] = epilogue_value(h_ref[i], h_bias[i / hw % cs->k], h_res[i], FUSED_ALPHA, epi);
+  }
+
+  cl_mem d_x = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * x_count, h_x, &err);
+  checkError(err, "Creating buffer d_x");
+  cl_mem d_w = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * w_count, h_w, &err);
+  checkError(err, "Creating buffer d_w");
+  cl_mem d_y = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(float) * y_count, NULL, &err);
+  checkError(err, "Creating buffer d_y");
+  cl_mem d_bias = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * cs->k, h_bias, &err);
+  checkError(err, "Creating buffer d_bias");
+  cl_mem d_res = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * y_count, h_res, &err);
+  checkError(err, "Creating buffer d_res");
+
+  err = conv2d_fused(cv, commands, cs, epi, d_x, d_w, d_y, d_bias, d_res, FUSED_ALPHA);
+  checkError(err, "Enqueueing convolution");
+  err = clFinish(commands);
+  checkError(err, "Waiting for convolution to finish");
+
+  double rtime = wtime();
+  for (int r = 0; r < reps; r++) {
+    err = conv2d_fused(cv, commands, cs, epi, d_x, d_w, d_y, d_bias, d_res, FUSED_ALPHA);
+    checkError(err, "Enqueueing convolution");
+  }
+  err = clFinish(commands);
+  checkError(err, "Waiting for convolution to finish");
+  *seconds = reps ? (wtime() - rtime) / reps : 0.0;
+
+  err = clEnqueueReadBuffer(commands, d_y, CL_TRUE, 0, sizeof(float) * y_count, h_y, 0, NULL, NULL);
+  checkError(err, "Reading convolution result");
+  double diff = 0.0, norm = 0.0;
+  for (size_t i = 0; i < y_count; i++) {
+    diff += ((double)h_ref[i] - h_y[i]) * ((double)h_ref[i] - h_y[i]);
+    norm += (double)h_ref[i] * h_ref[i];
+  }
+
+  clReleaseMemObject(d_x);
+  clReleaseMemObject(d_w);
+  clReleaseMemObject(d_y);
+  clReleaseMemObject(d_bias);
+  clReleaseMemObject(d_res);
+  free(h_x);
+  free(h_w);
+  free(h_y);
+  free(h_ref);
+  free(h_bias);
+  free(h_res);
+  return sqrt(diff / norm);
+}
+
+void print_shape(const conv_shape *cs) {
+  printf("%dx%dx%dx%d * %dx%dx%dx%d s%d,%d p%d,%d d%d,%d", cs->n, cs->c, cs->h, cs->w, cs->k, cs->c, cs->r, cs->s,
+    cs->stride_h, cs->stride_w, cs->pad_h, cs->pad_w, cs->dil_h, cs->dil_w);
+}
+
+int main(int argc, char** argv) {
+  int err;
+  int i;
+  conv_shape timed = layer;
+  if (argc > 1)
+    timed.n = atoi(argv[1]);
+
+  cl_device_id device_id;
+  cl_context context;
+  cl_command_queue commands;
+
+  // Set up platform and GPU device
+  cl_uint numPlatforms;
+  err = clGetPlatformIDs(0, NULL, &numPlatforms);
+  checkError(err, "Finding platforms");
+  if (numPlatforms == 0) {
+    printf("Found 0 platforms\n");
+    return EXIT_FAILURE;
+  }
+
+  // Get all platforms
+  cl_platform_id Platform[numPlatforms];
+  err = clGetPlatformIDs(numPlatforms, Platform, NULL);
+  checkError(err, "Getting platforms");
+
+  // Secure a GPU
+  for (i = 0; i < numPlatforms; i++) {
+    err = clGetDeviceIDs(Platform[i], DEVICE, 1, &device_id, NULL);
+    if (err == CL_SUCCESS) {
+      break;
+    }
+  }
+
+  if (device_id == NULL)
+    checkError(err, "Finding a device");
+
+  err = output_device_info(device_id);
+  checkError(err, "Finding device output");
+
+  context = clCreateContext(0, 1, &device_id, NULL, NULL, &err);
+  checkError(err, "Creating context");
+
+  commands = clCreateCommandQueue(context, device_id, 0, &err);
+  checkError(err, "Creating command queue");
+
+  conv_ctx cv;
+  err = conv_init(&cv, context, device_id, 0);
+  checkError(err, "Creating convolution");
+  printf("\nImplicit GEMM, tile %d\n", cv.tile);
+
+  int failures = 0;
+  double seconds;
+  for (int f = 0; f < 2; f++) {
+    for (int c = 0; c < sizeof(checks) / sizeof(checks[0]); c++) {
+      double rel = run_conv(&cv, context, commands, &checks[c], f ? &fused : NULL, 0, &seconds);
+      failures += !(rel < TOL);
+      print_shape(&checks[c]);
+      printf("%s  rel err %.3e%s\n", f ? "  +relu epilogue" : "", rel, rel < TOL ? "" : "  MISMATCH");
+    }
+  }
+  err = conv2d(&cv, commands, &too_wide, NULL, NULL, NULL);
+  failures += (err != CL_INVALID_VALUE);
+  print_shape(&too_wide);
+  printf("  %s\n", err == CL_INVALID_VALUE ? "rejected, no output" : "ACCEPTED");
+
+  // 2 flops per tap; im2col would hold c*r*s rows of n*oh*ow columns
+  const conv_shape *cs = &timed;
+  double rel = run_conv(&cv, context, commands, cs, NULL, REPS, &seconds);
+  failures += !(rel < TOL);
+  double cols = (double)cs->n * CONV_OUT_H(cs) * CONV_OUT_W(cs);
+  double flops = 2.0 * cs->k * cs->c * cs->r * cs->s * cols;
+  double x_mb = sizeof(float) * (double)cs->n * cs->c * cs->h * cs->w / 1048576.0;
+  double im2col_mb = sizeof(float) * (double)cs->c * cs->r * cs->s * cols / 1048576.0;
+  printf("\n");
+  print_shape(cs);
+  printf("\n%12lf s %10.2f GFLOPS  rel err %.3e\n", seconds, flops / seconds * 1e-9, rel);
+  printf("input %.1f MB, an explicit im2col would be %.1f MB more\n", x_mb, im2col_mb);
+
+  conv_release(&cv);
+  release_programs();
+  clReleaseCommandQueue(commands);
+  clReleaseContext(context);
+
+  return failures ? EXIT_FAILURE : 0;
+}
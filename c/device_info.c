@@ -1,111 +1,187 @@
+/*
+ * Device capability query
+ *
+ * query_device_caps() collects what the drivers need to pick kernels and
+ * sizes; output_device_info() prints the short summary the drivers show.
+*/
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#ifdef __APPLE__
-#include <OpenCL/opencl.h>
-#else
-#include <CL/cl.h>
-#endif
-//
-//  define VERBOSE if you want to print info about work groups sizes
-//#define  VERBOSE 1
-#ifdef VERBOSE
-     extern int err_code(cl_int);
-#endif
 
-int output_device_info(cl_device_id device_id)
+#include "device_info.h"
+
+int query_device_caps(cl_device_id device_id, device_caps *caps)
 {
-    int err;                            // error code returned from OpenCL calls
-    cl_device_type device_type;         // Parameter defining the type of the compute device
-    cl_uint comp_units;                 // the max number of compute units on a device
-    cl_char vendor_name[1024] = {0};    // string to hold vendor name for compute device
-    cl_char device_name[1024] = {0};    // string to hold name of compute device
-#ifdef VERBOSE
-    cl_uint          max_work_itm_dims;
-    size_t           max_wrkgrp_size;
-    size_t          *max_loc_size;
-#endif
+    int err;
+    cl_device_local_mem_type local_type;
+    cl_bool unified;
+    size_t ext_size = 0;
 
+    memset(caps, 0, sizeof(*caps));
 
-    err = clGetDeviceInfo(device_id, CL_DEVICE_NAME, sizeof(device_name), &device_name, NULL);
+    err = clGetDeviceInfo(device_id, CL_DEVICE_NAME, sizeof(caps->name), caps->name, NULL);
+    err |= clGetDeviceInfo(device_id, CL_DEVICE_VENDOR, sizeof(caps->vendor), caps->vendor, NULL);
+    err |= clGetDeviceInfo(device_id, CL_DEVICE_VERSION, sizeof(caps->version), caps->version, NULL);
+    err |= clGetDeviceInfo(device_id, CL_DEVICE_TYPE, sizeof(caps->type), &caps->type, NULL);
+    err |= clGetDeviceInfo(device_id, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &caps->compute_units, NULL);
+    err |= clGetDeviceInfo(device_id, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(cl_uint), &caps->clock_mhz, NULL);
+    err |= clGetDeviceInfo(device_id, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &caps->max_work_group_size, NULL);
+    err |= clGetDeviceInfo(device_id, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(caps->max_work_item_sizes), caps->max_work_item_sizes, NULL);
+    err |= clGetDeviceInfo(device_id, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &caps->local_mem_size, NULL);
+    err |= clGetDeviceInfo(device_id, CL_DEVICE_LOCAL_MEM_TYPE, sizeof(local_type), &local_type, NULL);
+    err |= clGetDeviceInfo(device_id, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &caps->global_mem_size, NULL);
+    err |= clGetDeviceInfo(device_id, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &caps->max_alloc, NULL);
+    err |= clGetDeviceInfo(device_id, CL_DEVICE_GLOBAL_MEM_CACHE_SIZE, sizeof(cl_ulong), &caps->global_cache_size, NULL);
+    err |= clGetDeviceInfo(device_id, CL_DEVICE_GLOBAL_MEM_CACHELINE_SIZE, sizeof(cl_uint), &caps->cacheline, NULL);
+    err |= clGetDeviceInfo(device_id, CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT, sizeof(cl_uint), &caps->vec_float, NULL);
+    err |= clGetDeviceInfo(device_id, CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE, sizeof(cl_uint), &caps->vec_double, NULL);
+    err |= clGetDeviceInfo(device_id, CL_DEVICE_EXTENSIONS, 0, NULL, &ext_size);
     if (err != CL_SUCCESS)
     {
-        printf("Error: Failed to access device name!\n");
-        return EXIT_FAILURE;
+        printf("Error: Failed to query device capabilities!\n");
+        return err;
     }
-    printf(" \n Device is  %s ",device_name);
 
-    err = clGetDeviceInfo(device_id, CL_DEVICE_TYPE, sizeof(device_type), &device_type, NULL);
+    // The extension list has no length limit, size it first
+    char *extensions = calloc(ext_size + 1, 1);
+    if (!extensions)
+        return CL_OUT_OF_HOST_MEMORY;
+    err = clGetDeviceInfo(device_id, CL_DEVICE_EXTENSIONS, ext_size, extensions, NULL);
     if (err != CL_SUCCESS)
     {
-        printf("Error: Failed to access device type information!\n");
-        return EXIT_FAILURE;
+        printf("Error: Failed to query device extensions!\n");
+        free(extensions);
+        return err;
     }
-    if(device_type  == CL_DEVICE_TYPE_GPU)
-       printf(" GPU from ");
 
-    else if (device_type == CL_DEVICE_TYPE_CPU)
-       printf("\n CPU from ");
+    // Optional on older (1.0) devices, keep the zero default
+    if (clGetDeviceInfo(device_id, CL_DEVICE_PREFERRED_VECTOR_WIDTH_HALF, sizeof(cl_uint), &caps->vec_half, NULL) != CL_SUCCESS)
+        caps->vec_half = 0;
+    if (clGetDeviceInfo(device_id, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &unified, NULL) == CL_SUCCESS)
+        caps->unified_memory = unified;
 
-    else 
-       printf("\n non  CPU or GPU processor from ");
+    caps->local_mem_dedicated = (local_type == CL_LOCAL);
+    caps->fp16 = strstr(extensions, "cl_khr_fp16") != NULL;
+    caps->fp64 = strstr(extensions, "cl_khr_fp64") != NULL || caps->vec_double > 0;
+    free(extensions);
 
-    err = clGetDeviceInfo(device_id, CL_DEVICE_VENDOR, sizeof(vendor_name), &vendor_name, NULL);
-    if (err != CL_SUCCESS)
-    {
-        printf("Error: Failed to access device vendor name!\n");
-        return EXIT_FAILURE;
-    }
-    printf(" %s ",vendor_name);
+    return CL_SUCCESS;
+}
 
-    err = clGetDeviceInfo(device_id, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &comp_units, NULL);
-    if (err != CL_SUCCESS)
-    {
-        printf("Error: Failed to access device number of compute units !\n");
-        return EXIT_FAILURE;
-    }
-    printf(" with a max of %d compute units \n",comp_units);
+static const char* type_name(cl_device_type type)
+{
+    if (type & CL_DEVICE_TYPE_GPU)
+        return "GPU";
+    if (type & CL_DEVICE_TYPE_CPU)
+        return "CPU";
+    if (type & CL_DEVICE_TYPE_ACCELERATOR)
+        return "accelerator";
+    return "other";
+}
 
-#ifdef VERBOSE
-//
-// Optionally print information about work group sizes
-//
-    err = clGetDeviceInfo( device_id, CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, sizeof(cl_uint), 
-                               &max_work_itm_dims, NULL);
-    if (err != CL_SUCCESS)
-    {
-        printf("Error: Failed to get device Info (CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS)!\n",
-                                                                            err_code(err));
-        return EXIT_FAILURE;
-    }
-    
-    max_loc_size = (size_t*)malloc(max_work_itm_dims * sizeof(size_t));
-    if(max_loc_size == NULL){
-       printf(" malloc failed\n");
-       return EXIT_FAILURE;
+// s as a quoted JSON string, escaping quotes, backslashes and control
+// characters the driver may have put in its strings
+static void json_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            fputc(c, fp);
     }
-    err = clGetDeviceInfo( device_id, CL_DEVICE_MAX_WORK_ITEM_SIZES, max_work_itm_dims* sizeof(size_t), 
-                               max_loc_size, NULL);
-    if (err != CL_SUCCESS)
-    {
-        printf("Error: Failed to get device Info (CL_DEVICE_MAX_WORK_ITEM_SIZES)!\n",err_code(err));
-        return EXIT_FAILURE;
+    fputc('"', fp);
+}
+
+// One JSON object, no trailing newline so callers can build arrays
+void print_device_caps_json(FILE *fp, const device_caps *caps)
+{
+    fprintf(fp, "{\"name\": ");
+    json_string(fp, caps->name);
+    fprintf(fp, ", \"vendor\": ");
+    json_string(fp, caps->vendor);
+    fprintf(fp, ", \"version\": ");
+    json_string(fp, caps->version);
+    fprintf(fp, ", \"type\": \"%s\", ", type_name(caps->type));
+    fprintf(fp, "\"compute_units\": %u, \"clock_mhz\": %u, ", caps->compute_units, caps->clock_mhz);
+    fprintf(fp, "\"max_work_group_size\": %zu, \"max_work_item_sizes\": [%zu, %zu, %zu], ",
+        caps->max_work_group_size, caps->max_work_item_sizes[0], caps->max_work_item_sizes[1], caps->max_work_item_sizes[2]);
+    fprintf(fp, "\"local_mem_size\": %llu, \"local_mem_dedicated\": %s, ",
+        (unsigned long long)caps->local_mem_size, caps->local_mem_dedicated ? "true" : "false");
+    fprintf(fp, "\"global_mem_size\": %llu, \"max_alloc\": %llu, \"global_cache_size\": %llu, \"cacheline\": %u, ",
+        (unsigned long long)caps->global_mem_size, (unsigned long long)caps->max_alloc,
+        (unsigned long long)caps->global_cache_size, caps->cacheline);
+    fprintf(fp, "\"preferred_vector_width\": {\"float\": %u, \"double\": %u, \"half\": %u}, ",
+        caps->vec_float, caps->vec_double, caps->vec_half);
+    fprintf(fp, "\"fp16\": %s, \"fp64\": %s, \"unified_memory\": %s}",
+        caps->fp16 ? "true" : "false", caps->fp64 ? "true" : "false", caps->unified_memory ? "true" : "false");
+}
+
+// Largest GEMM tile whose TILE x TILE work-group fits the device and whose
+// two local tiles fit in local memory. Devices that emulate local memory in
+// global memory gain little from big tiles, so they stay at 16. This is an
+// upper bound: the built kernel may accept less, see kernel_tile.
+int caps_gemm_tile(const device_caps *caps)
+{
+    static const int tiles[] = {32, 16, 8, 4};
+    int max_tile = caps->local_mem_dedicated ? 32 : 16;
+    for (int i = 0; i < sizeof(tiles) / sizeof(tiles[0]); i++) {
+        size_t t = tiles[i];
+        if (t > max_tile)
+            continue;
+        if (t * t <= caps->max_work_group_size && t <= caps->max_work_item_sizes[0] &&
+            t <= caps->max_work_item_sizes[1] && 2 * t * t * sizeof(float) <= caps->local_mem_size)
+            return (int)t;
     }
-    err = clGetDeviceInfo( device_id, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), 
-                               &max_wrkgrp_size, NULL);
+    return 1;
+}
+
+// Largest tile <= tile, halving, whose TILE x TILE work-group the built
+// kernel accepts. CL_KERNEL_WORK_GROUP_SIZE can sit below the device limit
+// for kernels heavy on registers or local memory.
+int kernel_tile(cl_kernel kernel, cl_device_id device, int tile)
+{
+    size_t wg;
+    if (clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(wg), &wg, NULL) != CL_SUCCESS)
+        return tile;
+    while (tile > 1 && (size_t)tile * tile > wg)
+        tile /= 2;
+    return tile;
+}
+
+// 1D work-group size: want, clamped to what the device allows
+size_t caps_work_group(const device_caps *caps, size_t want)
+{
+    size_t wg = want;
+    if (wg > caps->max_work_group_size)
+        wg = caps->max_work_group_size;
+    if (wg > caps->max_work_item_sizes[0])
+        wg = caps->max_work_item_sizes[0];
+    return wg ? wg : 1;
+}
+
+int output_device_info(cl_device_id device_id)
+{
+    int err;
+    device_caps caps;
+
+    err = query_device_caps(device_id, &caps);
     if (err != CL_SUCCESS)
-    {
-        printf("Error: Failed to get device Info (CL_DEVICE_MAX_WORK_GROUP_SIZE)!\n",err_code(err));
-        return EXIT_FAILURE;
-    }
-   printf("work group, work item information");
-   printf("\n max loc dim ");
-   for(int i=0; i< max_work_itm_dims; i++)
-     printf(" %d ",(int)(*(max_loc_size+i)));
-   printf("\n");
-   printf(" Max work group size = %d\n",(int)max_wrkgrp_size);
+        return err;
+
+    printf(" \n Device is  %s  %s from  %s  with a max of %d compute units \n",
+        caps.name, type_name(caps.type), caps.vendor, caps.compute_units);
+
+#ifdef VERBOSE
+    printf(" Max work group size = %d, local memory %llu KB, preferred float vector width %u\n",
+        (int)caps.max_work_group_size, (unsigned long long)caps.local_mem_size / 1024, caps.vec_float);
+    printf(" fp16 %s, fp64 %s, unified memory %s\n",
+        caps.fp16 ? "yes" : "no", caps.fp64 ? "yes" : "no", caps.unified_memory ? "yes" : "no");
 #endif
 
     return CL_SUCCESS;
-
 }
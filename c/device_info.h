@@ -0,0 +1,43 @@
+#ifndef DEVICE_INFO
+#define DEVICE_INFO
+
+#include <stdio.h>
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+// Device capabilities the drivers use to pick kernel variants and sizes
+typedef struct {
+  char name[256];
+  char vendor[256];
+  char version[128];
+  cl_device_type type;
+  cl_uint compute_units;
+  cl_uint clock_mhz;
+  size_t max_work_group_size;
+  size_t max_work_item_sizes[3];
+  cl_ulong local_mem_size;
+  int local_mem_dedicated;     // CL_LOCAL, not emulated in global memory
+  cl_ulong global_mem_size;
+  cl_ulong max_alloc;
+  cl_ulong global_cache_size;
+  cl_uint cacheline;
+  cl_uint vec_float;           // preferred vector widths
+  cl_uint vec_double;
+  cl_uint vec_half;
+  int fp16;
+  int fp64;
+  int unified_memory;
+} device_caps;
+
+int output_device_info(cl_device_id device_id);
+int query_device_caps(cl_device_id device_id, device_caps *caps);
+void print_device_caps_json(FILE *fp, const device_caps *caps);
+int caps_gemm_tile(const device_caps *caps);
+int kernel_tile(cl_kernel kernel, cl_device_id device, int tile);
+size_t caps_work_group(const device_caps *caps, size_t want);
+
+#endif
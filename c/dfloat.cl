@@ -0,0 +1,100 @@
+#include "kernel_common.clh"
+
+// Double-float ("float-float") kernels for devices without cl_khr_fp64. A
+// value is the unevaluated sum hi + lo of a float2 with |lo| <= ulp(hi)/2,
+// about 48 significand bits over the float exponent range. The error-free
+// transforms below rely on IEEE float rounding, so contraction is off and
+// the programs must not be built with -cl-fast-relaxed-math.
+
+#pragma OPENCL FP_CONTRACT OFF
+
+#ifndef TILE
+#define TILE 16
+#endif
+
+typedef float2 dfloat;
+
+// s + e == a + b exactly
+dfloat two_sum(float a, float b) {
+  float s = a + b;
+  float bb = s - a;
+  float e = (a - (s - bb)) + (b - bb);
+  return (dfloat)(s, e);
+}
+
+// two_sum for |a| >= |b|
+dfloat quick_two_sum(float a, float b) {
+  float s = a + b;
+  return (dfloat)(s, b - (s - a));
+}
+
+// p + e == a * b exactly
+dfloat two_prod(float a, float b) {
+  float p = a * b;
+  return (dfloat)(p, fma(a, b, -p));
+}
+
+dfloat df_add(dfloat a, dfloat b) {
+  dfloat s = two_sum(a.x, b.x);
+  dfloat t = two_sum(a.y, b.y);
+  s = quick_two_sum(s.x, s.y + t.x);
+  return quick_two_sum(s.x, s.y + t.y);
+}
+
+dfloat df_mul(dfloat a, dfloat b) {
+  dfloat p = two_prod(a.x, b.x);
+  return quick_two_sum(p.x, p.y + (a.x * b.y + a.y * b.x));
+}
+
+// c = a * b, TILE x TILE blocks staged in local memory as in mmul_tiled,
+// with zeros past the edges so any dim works
+__kernel void df_mmul(__global dfloat *a, __global dfloat *b, __global dfloat *c, const int dim) {
+  __local dfloat a_sub[TILE][TILE];
+  __local dfloat b_sub[TILE][TILE];
+
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  int li = get_local_id(0);
+  int lj = get_local_id(1);
+
+  dfloat tmp = 0;
+  for (int t = 0; t < DIM; t += TILE) {
+    a_sub[lj][li] = (j < DIM && t + li < DIM) ? a[j*DIM+t+li] : (dfloat)0;
+    b_sub[lj][li] = (t + lj < DIM && i < DIM) ? b[(t+lj)*DIM+i] : (dfloat)0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int k = 0; k < TILE; k++) {
+      tmp = df_add(tmp, df_mul(a_sub[lj][k], b_sub[k][li]));
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  if (i < DIM && j < DIM)
+    c[j*DIM+i] = tmp;
+}
+
+__kernel void df_vadd(__global dfloat *a, __global dfloat *b, __global dfloat *c, const unsigned int count) {
+  int i = get_global_id(0);
+  if (i < count)
+    c[i] = df_add(a[i], b[i]);
+}
+
+// Work-group partial sums as in vsum
+__kernel void df_sum(__global dfloat *a, __global dfloat *partial, const unsigned int count, __local dfloat *scratch) {
+  size_t gid = get_global_id(0);
+  size_t lid = get_local_id(0);
+  size_t stride = get_global_size(0);
+
+  dfloat acc = 0;
+  for (size_t i = gid; i < count; i += stride)
+    acc = df_add(acc, a[i]);
+  scratch[lid] = acc;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (size_t s = get_local_size(0) / 2; s > 0; s >>= 1) {
+    if (lid < s)
+      scratch[lid] = df_add(scratch[lid], scratch[lid + s]);
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  if (lid == 0)
+    partial[get_group_id(0)] = scratch[0];
+}
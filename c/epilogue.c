@@ -0,0 +1,83 @@
+/*
+ * Fused GEMM epilogues: build options, kernel arguments and host reference
+*/
+
+#include <stdio.h>
+#include <math.h>
+
+#include "epilogue.h"
+
+int epilogue_enabled(const epilogue_spec *epi) {
+  return epi && (epi->scale || epi->bias || epi->act != ACT_NONE || epi->residual);
+}
+
+// Build options selecting the epilogue in kernel_common.clh, along with the
+// ACT_* values so the kernels and the host share one definition
+void epilogue_defines(const epilogue_spec *epi, char *buf, size_t len) {
+  buf[0] = '\0';
+  if (!epilogue_enabled(epi))
+    return;
+  snprintf(buf, len, "-D EPILOGUE %s%s%s-D EPI_ACT=%d -D ACT_NONE=%d -D ACT_RELU=%d -D ACT_GELU=%d -D ACT_SIGMOID=%d",
+    epi->scale ? "-D EPI_SCALE " : "",
+    epi->bias ? "-D EPI_BIAS " : "",
+    epi->residual ? "-D EPI_RESIDUAL " : "",
+    epi->act, ACT_NONE, ACT_RELU, ACT_GELU, ACT_SIGMOID);
+}
+
+// Sets the bias, residual and alpha arguments that follow the GEMM arguments.
+// Unused buffers may be NULL. elem is the size of the kernel's DTYPE, alpha
+// is passed as a float or a double to match.
+cl_int set_epilogue_args(cl_kernel kernel, cl_uint first, cl_mem bias, cl_mem residual, double alpha, size_t elem) {
+  cl_int err;
+  float alpha_f = (float)alpha;
+  err = clSetKernelArg(kernel, first, sizeof(cl_mem), &bias);
+  err |= clSetKernelArg(kernel, first + 1, sizeof(cl_mem), &residual);
+  if (elem == sizeof(double))
+    err |= clSetKernelArg(kernel, first + 2, sizeof(double), &alpha);
+  else
+    err |= clSetKernelArg(kernel, first + 2, sizeof(float), &alpha_f);
+  return err;
+}
+
+// Host epilogue of one element, the terms epi leaves out are ignored
+float epilogue_value(float acc, float bias, float residual, float alpha, const epilogue_spec *epi) {
+  if (epi->scale)
+    acc *= alpha;
+  if (epi->bias)
+    acc += bias;
+  switch (epi->act) {
+    case ACT_RELU:
+      acc = fmaxf(acc, 0.0f);
+      break;
+    case ACT_GELU:
+      acc = 0.5f * acc * (1.0f + tanhf(0.7978845608f * (acc + 0.044715f * acc * acc * acc)));
+      break;
+    case ACT_SIGMOID:
+      acc = 1.0f / (1.0f + expf(-acc));
+      break;
+  }
+  if (epi->residual)
+    acc += residual;
+  return acc;
+}
+
+// Applies the epilogue in place to a C computed by sequential_mat_mul
+void sequential_epilogue(float *C, float *bias, float *residual, float alpha, const epilogue_spec *epi, int N) {
+  for (int j = 0; j < N; j++) {
+    for (int i = 0; i < N; i++)
+      C[j*N+i] = epilogue_value(C[j*N+i], epi->bias ? bias[i] : 0.0f, epi->residual ? residual[j*N+i] : 0.0f, alpha, epi);
+  }
+}
+
+const char* act_name(int act) {
+  switch (act) {
+    case ACT_RELU:
+      return "relu";
+    case ACT_GELU:
+      return "gelu";
+    case ACT_SIGMOID:
+      return "sigmoid";
+    default:
+      return "none";
+  }
+}
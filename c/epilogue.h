@@ -0,0 +1,32 @@
+#ifndef EPILOGUE_SPEC
+#define EPILOGUE_SPEC
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+// Activations, handed to the kernels as -D options by epilogue_defines
+#define ACT_NONE    0
+#define ACT_RELU    1
+#define ACT_GELU    2
+#define ACT_SIGMOID 3
+
+// Optional work fused into the GEMM store: c = act(alpha * acc + bias) + residual.
+// bias is a length-N vector broadcast down the rows, residual is N x N.
+typedef struct {
+  int scale;      // apply alpha
+  int bias;       // add bias[col]
+  int act;        // ACT_*
+  int residual;   // add residual[row, col]
+} epilogue_spec;
+
+int epilogue_enabled(const epilogue_spec *epi);
+void epilogue_defines(const epilogue_spec *epi, char *buf, size_t len);
+cl_int set_epilogue_args(cl_kernel kernel, cl_uint first, cl_mem bias, cl_mem residual, double alpha, size_t elem);
+float epilogue_value(float acc, float bias, float residual, float alpha, const epilogue_spec *epi);
+void sequential_epilogue(float *C, float *bias, float *residual, float alpha, const epilogue_spec *epi, int N);
+const char* act_name(int act);
+
+#endif
@@ -0,0 +1,226 @@
+/*
+ * Double precision GEMM, vadd and sum
+ *
+ * On devices reporting cl_khr_fp64 the float kernels are rebuilt with
+ * DTYPE=double. Elsewhere dfloat.cl stands in with float-float arithmetic:
+ * about 48 significand bits, so errors around 1e-14 rather than 1e-16, at
+ * some 10-20 float operations per multiply-add, and only over the float
+ * exponent range.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fp64.h"
+#include "kernel_cache.h"
+#include "trace.h"
+
+#define FP64_GROUPS_PER_CU (4)  // Work-groups per compute unit for the sum
+
+static const char *fp64_defines = "-D FP64";
+
+cl_int fp64_init(fp64_ctx *d, cl_context context, cl_device_id device, const device_caps *caps, int mode) {
+  cl_int err;
+  memset(d, 0, sizeof(*d));
+  if (mode == FP64_AUTO)
+    mode = caps->fp64 ? FP64_NATIVE : FP64_EMULATED;
+  if (mode == FP64_NATIVE && !caps->fp64)
+    return CL_INVALID_DEVICE;
+  d->context = context;
+  d->device = device;
+  d->mode = mode;
+
+  // Two tiles of 8-byte elements in local memory
+  d->tile = caps_gemm_tile(caps);
+  while (d->tile > 1 && 2 * d->tile * d->tile * sizeof(double) > caps->local_mem_size)
+    d->tile /= 2;
+  d->local = caps_work_group(caps, FP64_WG);
+  // The sums' tree reduction halves the work-group, keep it a power of two
+  while (d->local & (d->local - 1))
+    d->local &= d->local - 1;
+  d->groups = (size_t)caps->compute_units * FP64_GROUPS_PER_CU;
+
+  kernel_spec spec = {0};
+  if (mode == FP64_NATIVE) {
+    spec.dtype = "double";
+    spec.defines = fp64_defines;
+  }
+  const char *file = (mode == FP64_NATIVE) ? "vadd.cl" : "dfloat.cl";
+  d->ko_add = get_kernel(context, device, file, mode == FP64_NATIVE ? "vadd" : "df_vadd", &spec, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  d->ko_sum = get_kernel(context, device, file, mode == FP64_NATIVE ? "vsum" : "df_sum", &spec, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  d->partial = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(double) * d->groups, NULL, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  return CL_SUCCESS;
+
+fail:
+  fp64_release(d);
+  return err;
+}
+
+// Blocking copies from and to host doubles; emulated buffers hold the
+// float pair hi = (float)x, lo = (float)(x - hi)
+cl_int fp64_write(fp64_ctx *d, cl_command_queue commands, cl_mem buf, const double *h, size_t count) {
+  if (d->mode == FP64_NATIVE)
+    return clEnqueueWriteBuffer(commands, buf, CL_TRUE, 0, sizeof(double) * count, h, 0, NULL, TRACE_EV("transfer", "fp64 write"));
+  float *pairs = malloc(2 * sizeof(float) * count);
+  if (!pairs)
+    return CL_OUT_OF_HOST_MEMORY;
+  for (size_t i = 0; i < count; i++) {
+    pairs[2*i] = (float)h[i];
+    pairs[2*i+1] = (float)(h[i] - (double)pairs[2*i]);
+  }
+  cl_int err = clEnqueueWriteBuffer(commands, buf, CL_TRUE, 0, 2 * sizeof(float) * count, pairs, 0, NULL, TRACE_EV("transfer", "fp64 write"));
+  free(pairs);
+  return err;
+}
+
+cl_int fp64_read(fp64_ctx *d, cl_command_queue commands, cl_mem buf, double *h, size_t count) {
+  if (d->mode == FP64_NATIVE)
+    return clEnqueueReadBuffer(commands, buf, CL_TRUE, 0, sizeof(double) * count, h, 0, NULL, TRACE_EV("transfer", "fp64 read"));
+  float *pairs = malloc(2 * sizeof(float) * count);
+  if (!pairs)
+    return CL_OUT_OF_HOST_MEMORY;
+  cl_int err = clEnqueueReadBuffer(commands, buf, CL_TRUE, 0, 2 * sizeof(float) * count, pairs, 0, NULL, TRACE_EV("transfer", "fp64 read"));
+  for (size_t i = 0; err == CL_SUCCESS && i < count; i++)
+    h[i] = (double)pairs[2*i] + (double)pairs[2*i+1];
+  free(pairs);
+  return err;
+}
+
+// Native: mmul_tiled when n divides into tiles, mmul otherwise, as for
+// float. Emulated: df_mmul, which takes any n.
+static cl_int ensure_gemm(fp64_ctx *d, int n) {
+  cl_int err;
+  if (d->ko_mmul && (d->n == n || d->mode == FP64_EMULATED))
+    return CL_SUCCESS;
+  if (d->ko_mmul)
+    clReleaseKernel(d->ko_mmul);
+  d->ko_mmul = NULL;
+
+  kernel_spec spec;
+  if (d->mode == FP64_NATIVE) {
+    spec = choose_mmul_spec(n, d->tile);
+    spec.dtype = "double";
+    spec.defines = fp64_defines;
+    d->tiled = spec.tile > 0;
+    d->ko_mmul = get_kernel(d->context, d->device, "kernel.cl", d->tiled ? "mmul_tiled" : "mmul", &spec, &err);
+  } else {
+    spec = (kernel_spec){0};
+    spec.tile = d->tile;
+    d->tiled = 1;
+    d->ko_mmul = get_kernel(d->context, d->device, "dfloat.cl", "df_mmul", &spec, &err);
+  }
+  if (err != CL_SUCCESS) {
+    d->ko_mmul = NULL;
+    return err;
+  }
+  // Rebuild with a smaller tile if the kernel takes less than the device
+  int fit = d->tiled ? kernel_tile(d->ko_mmul, d->device, d->tile) : d->tile;
+  if (fit < d->tile) {
+    clReleaseKernel(d->ko_mmul);
+    d->ko_mmul = NULL;
+    d->tile = fit;
+    return ensure_gemm(d, n);
+  }
+  d->n = n;
+  return CL_SUCCESS;
+}
+
+// c = a * b, all n x n row-major
+cl_int fp64_gemm(fp64_ctx *d, cl_command_queue commands, cl_mem d_a, cl_mem d_b, cl_mem d_c, int n) {
+  cl_int err = ensure_gemm(d, n);
+  if (err != CL_SUCCESS)
+    return err;
+  err = clSetKernelArg(d->ko_mmul, 0, sizeof(cl_mem), &d_a);
+  err |= clSetKernelArg(d->ko_mmul, 1, sizeof(cl_mem), &d_b);
+  err |= clSetKernelArg(d->ko_mmul, 2, sizeof(cl_mem), &d_c);
+  err |= clSetKernelArg(d->ko_mmul, 3, sizeof(int), &n);
+  if (err != CL_SUCCESS)
+    return err;
+
+  if (!d->tiled) {
+    const size_t global[2] = {n, n};
+    return clEnqueueNDRangeKernel(commands, d->ko_mmul, 2, NULL, global, NULL, 0, NULL, TRACE_EV("kernel", "mmul fp64"));
+  }
+  // df_mmul guards the edges, so the grid rounds up to whole tiles
+  size_t tile = d->tile;
+  const size_t global[2] = {(n + tile - 1) / tile * tile, (n + tile - 1) / tile * tile};
+  const size_t local[2] = {tile, tile};
+  return clEnqueueNDRangeKernel(commands, d->ko_mmul, 2, NULL, global, local, 0, NULL,
+    TRACE_EV("kernel", d->mode == FP64_NATIVE ? "mmul_tiled fp64" : "df_mmul"));
+}
+
+cl_int fp64_add(fp64_ctx *d, cl_command_queue commands, cl_mem d_a, cl_mem d_b, cl_mem d_c, unsigned int count) {
+  cl_int err;
+  err = clSetKernelArg(d->ko_add, 0, sizeof(cl_mem), &d_a);
+  err |= clSetKernelArg(d->ko_add, 1, sizeof(cl_mem), &d_b);
+  err |= clSetKernelArg(d->ko_add, 2, sizeof(cl_mem), &d_c);
+  err |= clSetKernelArg(d->ko_add, 3, sizeof(unsigned int), &count);
+  if (err != CL_SUCCESS)
+    return err;
+  size_t global = (count + d->local - 1) / d->local * d->local;
+  if (global == 0)
+    global = d->local;
+  return clEnqueueNDRangeKernel(commands, d->ko_add, 1, NULL, &global, &d->local, 0, NULL,
+    TRACE_EV("kernel", d->mode == FP64_NATIVE ? "vadd fp64" : "df_vadd"));
+}
+
+// Device partial sums per work-group, finished on the host in double
+cl_int fp64_sum(fp64_ctx *d, cl_command_queue commands, cl_mem d_a, unsigned int count, double *sum) {
+  cl_int err;
+  err = clSetKernelArg(d->ko_sum, 0, sizeof(cl_mem), &d_a);
+  err |= clSetKernelArg(d->ko_sum, 1, sizeof(cl_mem), &d->partial);
+  err |= clSetKernelArg(d->ko_sum, 2, sizeof(unsigned int), &count);
+  err |= clSetKernelArg(d->ko_sum, 3, sizeof(double) * d->local, NULL);
+  if (err != CL_SUCCESS)
+    return err;
+
+  size_t groups = (count + d->local - 1) / d->local;
+  if (groups > d->groups)
+    groups = d->groups;
+  if (groups == 0)
+    groups = 1;
+  size_t global = groups * d->local;
+  err = clEnqueueNDRangeKernel(commands, d->ko_sum, 1, NULL, &global, &d->local, 0, NULL,
+    TRACE_EV("kernel", d->mode == FP64_NATIVE ? "vsum fp64" : "df_sum"));
+  if (err != CL_SUCCESS)
+    return err;
+
+  double partial[groups];
+  err = fp64_read(d, commands, d->partial, partial, groups);
+  if (err != CL_SUCCESS)
+    return err;
+  *sum = 0.0;
+  for (size_t g = 0; g < groups; g++)
+    *sum += partial[g];
+  return CL_SUCCESS;
+}
+
+void fp64_release(fp64_ctx *d) {
+  if (d->ko_mmul)
+    clReleaseKernel(d->ko_mmul);
+  if (d->ko_add)
+    clReleaseKernel(d->ko_add);
+  if (d->ko_sum)
+    clReleaseKernel(d->ko_sum);
+  if (d->partial)
+    clReleaseMemObject(d->partial);
+  memset(d, 0, sizeof(*d));
+}
+
+const char* fp64_mode_name(int mode) {
+  switch (mode) {
+    case FP64_NATIVE:
+      return "fp64";
+    case FP64_EMULATED:
+      return "float-float";
+    default:
+      return "auto";
+  }
+}
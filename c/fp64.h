@@ -0,0 +1,46 @@
+#ifndef FP64_OPS
+#define FP64_OPS
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "device_info.h"
+
+// Arithmetic behind the double precision kernels
+#define FP64_AUTO     (-1)  // native when the device has cl_khr_fp64, else emulated
+#define FP64_NATIVE   (0)   // double kernels
+#define FP64_EMULATED (1)   // float-float kernels from dfloat.cl
+
+#define FP64_WG (256)  // Work-group size asked of the device by vadd and sum
+
+// Double precision GEMM, vadd and sum. Buffers hold 8 bytes per element in
+// either mode, a double or a (hi, lo) float pair, and go through fp64_write
+// and fp64_read, which convert for the mode.
+typedef struct {
+  cl_context context;
+  cl_device_id device;
+  int mode;
+  int tile;
+  size_t local;
+  size_t groups;    // fixed work-group count of the sum
+  int n;            // order the GEMM kernel was built for
+  int tiled;
+  cl_kernel ko_mmul;
+  cl_kernel ko_add;
+  cl_kernel ko_sum;
+  cl_mem partial;   // one partial sum per work-group
+} fp64_ctx;
+
+cl_int fp64_init(fp64_ctx *d, cl_context context, cl_device_id device, const device_caps *caps, int mode);
+cl_int fp64_write(fp64_ctx *d, cl_command_queue commands, cl_mem buf, const double *h, size_t count);
+cl_int fp64_read(fp64_ctx *d, cl_command_queue commands, cl_mem buf, double *h, size_t count);
+cl_int fp64_gemm(fp64_ctx *d, cl_command_queue commands, cl_mem d_a, cl_mem d_b, cl_mem d_c, int n);
+cl_int fp64_add(fp64_ctx *d, cl_command_queue commands, cl_mem d_a, cl_mem d_b, cl_mem d_c, unsigned int count);
+cl_int fp64_sum(fp64_ctx *d, cl_command_queue commands, cl_mem d_a, unsigned int count, double *sum);
+void fp64_release(fp64_ctx *d);
+const char* fp64_mode_name(int mode);
+
+#endif
@@ -0,0 +1,361 @@
+/*
+ * GEMM driver (c = a * b, square row-major)
+ *
+ * Picks the kernel variant for the order and device, and inserts a
+ * transpose or panel-pack of B in front of it when that pays off.
+ * Rectangular products go through gemm_mnk, which runs a tiled kernel
+ * with edge guards, splits K across work-groups when m x n alone can't
+ * fill the device and hands matrix-vector shapes to the GEMV kernels.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gemm.h"
+#include "trace.h"
+
+// Tiled orders pack B into panels once B outgrows the device cache and the
+// strided tile loads start to miss; odd orders on CPU devices transpose B so
+// each work-item streams rows. GPUs keep B row-major on the untiled path
+// because neighbouring work-items already read neighbouring columns.
+gemm_plan plan_gemm(int n, int tile, const device_caps *caps, int b_layout) {
+  gemm_plan plan;
+  plan.n = n;
+  plan.spec = choose_mmul_spec(n, tile);
+  plan.tiled = plan.spec.tile > 0;
+
+  if (b_layout == B_AUTO) {
+    size_t b_bytes = sizeof(float) * n * n;
+    int big = caps->global_cache_size ? b_bytes > caps->global_cache_size : n >= GEMM_PACK_MIN;
+    if (plan.tiled)
+      b_layout = big ? B_PANELS : B_ROW_MAJOR;
+    else
+      b_layout = (caps->type & CL_DEVICE_TYPE_CPU) ? B_TRANSPOSED : B_ROW_MAJOR;
+  }
+  if (b_layout == B_PANELS && !plan.tiled)
+    b_layout = B_ROW_MAJOR;
+  plan.b_layout = b_layout;
+
+  if (plan.tiled)
+    plan.kernel = (b_layout == B_PANELS) ? "mmul_tiled_packed" : "mmul_tiled";
+  else
+    plan.kernel = (b_layout == B_TRANSPOSED) ? "mmul_bt" : "mmul";
+
+  // The tiled kernels only read b row-major or packed
+  if (plan.tiled && b_layout == B_TRANSPOSED) {
+    plan.b_layout = B_ROW_MAJOR;
+    plan.kernel = "mmul_tiled";
+  }
+  return plan;
+}
+
+// Number of K slices for an m x n x k product: enough work-items to give each
+// compute unit GEMM_SPLITK_ITEMS_PER_CU, no slice shorter than
+// GEMM_SPLITK_MIN_SLICE and a workspace that fits in one allocation
+int plan_splitk(int m, int n, int k, const device_caps *caps) {
+  size_t items = (size_t)m * n;
+  size_t want = (size_t)caps->compute_units * GEMM_SPLITK_ITEMS_PER_CU;
+  if (items >= want)
+    return 1;
+
+  size_t splits = (want + items - 1) / items;
+  if (splits > k / GEMM_SPLITK_MIN_SLICE)
+    splits = k / GEMM_SPLITK_MIN_SLICE;
+  while (splits > 1 && sizeof(float) * items * splits > caps->max_alloc)
+    splits /= 2;
+  return splits > 1 ? (int)splits : 1;
+}
+
+// tile 0 picks the tile from the device capabilities
+cl_int gemm_init(gemm_ctx *g, cl_context context, cl_device_id device, int tile) {
+  cl_int err;
+  memset(g, 0, sizeof(*g));
+  g->context = context;
+  g->device = device;
+  g->b_layout = B_AUTO;
+  g->planned_layout = B_AUTO;
+  g->splits = 1;
+
+  err = query_device_caps(device, &g->caps);
+  if (err != CL_SUCCESS)
+    return err;
+  g->tile = tile ? tile : caps_gemm_tile(&g->caps);
+
+  g->ko_splitk = get_kernel(context, device, "splitk.cl", "mmul_splitk", NULL, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  g->ko_reduce = get_kernel(context, device, "splitk.cl", "splitk_reduce", NULL, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  err = gemv_init(&g->gemv, context, device, &g->caps);
+  if (err != CL_SUCCESS)
+    goto fail;
+  err = layout_init(&g->layout, context, device, g->tile);
+  if (err != CL_SUCCESS)
+    goto fail;
+  return CL_SUCCESS;
+
+fail:
+  gemm_release(g);
+  return err;
+}
+
+static cl_int replan(gemm_ctx *g, int n) {
+  cl_int err;
+  if (g->ko_mmul)
+    clReleaseKernel(g->ko_mmul);
+  g->plan = plan_gemm(n, g->tile, &g->caps, g->b_layout);
+  g->planned_layout = g->b_layout;
+  g->ko_mmul = get_kernel(g->context, g->device, "kernel.cl", g->plan.kernel, &g->plan.spec, &err);
+  if (err != CL_SUCCESS) {
+    g->ko_mmul = NULL;
+    return err;
+  }
+
+  // caps_gemm_tile only knows the device limits; if the built kernel takes
+  // a smaller work-group, shrink the tile, with the panel width, and rebuild
+  int fit = g->plan.tiled ? kernel_tile(g->ko_mmul, g->device, g->tile) : g->tile;
+  if (fit < g->tile) {
+    g->tile = fit;
+    layout_release(&g->layout);
+    err = layout_init(&g->layout, g->context, g->device, g->tile);
+    if (err != CL_SUCCESS)
+      return err;
+    return replan(g, n);
+  }
+
+  size_t bytes = sizeof(float) * n * n;
+  if (g->plan.b_layout != B_ROW_MAJOR && g->scratch_size < bytes) {
+    if (g->scratch)
+      clReleaseMemObject(g->scratch);
+    g->scratch = clCreateBuffer(g->context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    g->scratch_size = (err == CL_SUCCESS) ? bytes : 0;
+  }
+  return err;
+}
+
+static cl_int ensure_plan(gemm_ctx *g, int n) {
+  if (n != g->plan.n || g->b_layout != g->planned_layout)
+    return replan(g, n);
+  return CL_SUCCESS;
+}
+
+// Writes b in the plan's layout to out, which is b itself for row-major
+static cl_int relayout_b(gemm_ctx *g, cl_command_queue commands, cl_mem b, cl_mem out, int n) {
+  if (g->plan.b_layout == B_TRANSPOSED)
+    return layout_transpose(commands, &g->layout, b, out, n, n);
+  if (g->plan.b_layout == B_PANELS)
+    return layout_pack_panels(commands, &g->layout, b, out, n, n);
+  return CL_SUCCESS;
+}
+
+// Runs the planned kernel with b already in the plan's layout
+static cl_int launch(gemm_ctx *g, cl_command_queue commands, cl_mem d_a, cl_mem b, cl_mem d_c, int n) {
+  cl_int err;
+  err = clSetKernelArg(g->ko_mmul, 0, sizeof(cl_mem), &d_a);
+  err |= clSetKernelArg(g->ko_mmul, 1, sizeof(cl_mem), &b);
+  err |= clSetKernelArg(g->ko_mmul, 2, sizeof(cl_mem), &d_c);
+  err |= clSetKernelArg(g->ko_mmul, 3, sizeof(int), &n);
+  if (err != CL_SUCCESS)
+    return err;
+
+  const size_t global[2] = {n, n};
+  const size_t local[2] = {g->tile, g->tile};
+  return clEnqueueNDRangeKernel(commands, g->ko_mmul, 2, NULL, global, g->plan.tiled ? local : NULL, 0, NULL, TRACE_EV("kernel", g->plan.kernel));
+}
+
+// c = a * b. A transposed or panel plan relays b out into scratch on every
+// call, one extra read and write of n^2 elements; callers multiplying by
+// the same b repeatedly should go through gemm_cached, which keeps the
+// relaid-out copy.
+cl_int gemm(gemm_ctx *g, cl_command_queue commands, cl_mem d_a, cl_mem d_b, cl_mem d_c, int n) {
+  cl_int err = ensure_plan(g, n);
+  if (err != CL_SUCCESS)
+    return err;
+
+  cl_mem b = (g->plan.b_layout == B_ROW_MAJOR) ? d_b : g->scratch;
+  err = relayout_b(g, commands, d_b, b, n);
+  if (err != CL_SUCCESS)
+    return err;
+  return launch(g, commands, d_a, b, d_c, n);
+}
+
+// c = a * h_b with h_b a host matrix that repeats across calls. Its device
+// copy, already in the plan's layout, comes from the operand cache; only a
+// miss uploads and relays it out. key 0 hashes h_b, otherwise key and
+// version identify it and the caller bumps version when h_b changes.
+cl_int gemm_cached(gemm_ctx *g, cl_command_queue commands, operand_cache *oc, cl_mem d_a, const float *h_b,
+                   uint64_t key, uint64_t version, cl_mem d_c, int n) {
+  cl_int err = ensure_plan(g, n);
+  if (err != CL_SUCCESS)
+    return err;
+
+  size_t bytes = sizeof(float) * n * n;
+  if (key == 0) {
+    TRACE("cache", "opcache_hash", key = opcache_hash(h_b, bytes));
+    version = 0;
+  }
+  int layout = g->plan.b_layout;
+  // Panels are packed for one tile width and ensure_mnk can shrink the tile
+  // mid-session, so the width is part of the entry's layout
+  int cached_layout = (layout == B_PANELS) ? OPCACHE_LAYOUT(layout, g->tile) : layout;
+  cl_mem b = opcache_lookup(oc, key, version, n, n, cached_layout);
+  if (b == NULL) {
+    b = opcache_insert(oc, key, version, n, n, cached_layout, bytes, &err);
+    if (err != CL_SUCCESS)
+      return err;
+    // Row-major goes straight into the entry, the others via scratch
+    cl_mem upload = (layout == B_ROW_MAJOR) ? b : g->scratch;
+    err = clEnqueueWriteBuffer(commands, upload, CL_TRUE, 0, bytes, h_b, 0, NULL, TRACE_EV("transfer", "operand upload"));
+    if (err == CL_SUCCESS)
+      err = relayout_b(g, commands, upload, b, n);
+    if (err != CL_SUCCESS) {
+      opcache_drop(oc, b);
+      return err;
+    }
+  }
+  return launch(g, commands, d_a, b, d_c, n);
+}
+
+// Builds mmul_tiled_mnk for the current tile, shrinking the tile as in replan
+static cl_int ensure_mnk(gemm_ctx *g) {
+  cl_int err;
+  if (g->ko_mnk && g->mnk_tile == g->tile)
+    return CL_SUCCESS;
+  if (g->ko_mnk)
+    clReleaseKernel(g->ko_mnk);
+  kernel_spec spec = {0};
+  spec.tile = g->tile;
+  g->ko_mnk = get_kernel(g->context, g->device, "kernel.cl", "mmul_tiled_mnk", &spec, &err);
+  if (err != CL_SUCCESS) {
+    g->ko_mnk = NULL;
+    return err;
+  }
+  g->mnk_tile = kernel_tile(g->ko_mnk, g->device, g->tile);
+  if (g->mnk_tile < g->tile) {
+    g->tile = g->mnk_tile;
+    layout_release(&g->layout);
+    err = layout_init(&g->layout, g->context, g->device, g->tile);
+    g->plan.n = 0;  // the square plan was built for the old tile
+    if (err != CL_SUCCESS)
+      return err;
+    return ensure_mnk(g);
+  }
+  return CL_SUCCESS;
+}
+
+static cl_int launch_mnk(gemm_ctx *g, cl_command_queue commands, cl_mem d_a, cl_mem d_b, cl_mem d_c, int m, int n, int k) {
+  cl_int err = ensure_mnk(g);
+  if (err != CL_SUCCESS)
+    return err;
+  int c_off = 0;
+  err = clSetKernelArg(g->ko_mnk, 0, sizeof(cl_mem), &d_a);
+  err |= clSetKernelArg(g->ko_mnk, 1, sizeof(cl_mem), &d_b);
+  err |= clSetKernelArg(g->ko_mnk, 2, sizeof(cl_mem), &d_c);
+  err |= clSetKernelArg(g->ko_mnk, 3, sizeof(int), &m);
+  err |= clSetKernelArg(g->ko_mnk, 4, sizeof(int), &n);
+  err |= clSetKernelArg(g->ko_mnk, 5, sizeof(int), &k);
+  err |= clSetKernelArg(g->ko_mnk, 6, sizeof(int), &n);
+  err |= clSetKernelArg(g->ko_mnk, 7, sizeof(int), &c_off);
+  if (err != CL_SUCCESS)
+    return err;
+
+  size_t tile = g->tile;
+  const size_t global[2] = {(n + tile - 1) / tile * tile, (m + tile - 1) / tile * tile};
+  const size_t local[2] = {tile, tile};
+  return clEnqueueNDRangeKernel(commands, g->ko_mnk, 2, NULL, global, local, 0, NULL, TRACE_EV("kernel", "mmul_tiled_mnk"));
+}
+
+// c = a * b with a m x k and b k x n, row-major. Square unsplit products take
+// the tuned gemm path and other unsplit shapes the tiled rectangular kernel;
+// otherwise each K slice writes a partial product to the workspace and a
+// second kernel sums them into c.
+cl_int gemm_mnk(gemm_ctx *g, cl_command_queue commands, cl_mem d_a, cl_mem d_b, cl_mem d_c, int m, int n, int k) {
+  cl_int err;
+  // A column b is y = a x; a row a is y^T = a b, i.e. y = b^T a^T
+  if (n == 1 || m == 1) {
+    g->splits = 1;
+    if (n == 1)
+      return gemv(&g->gemv, commands, 0, d_a, d_b, d_c, m, k);
+    return gemv(&g->gemv, commands, 1, d_b, d_a, d_c, k, n);
+  }
+  int splits = g->split_k ? g->split_k : plan_splitk(m, n, k, &g->caps);
+  if (splits > k)
+    splits = k;
+  if (splits < 1)
+    splits = 1;
+  g->splits = splits;
+  if (splits == 1 && m == n && n == k)
+    return gemm(g, commands, d_a, d_b, d_c, n);
+  if (splits == 1)
+    return launch_mnk(g, commands, d_a, d_b, d_c, m, n, k);
+
+  int kslice = (k + splits - 1) / splits;
+  int mn = m * n;
+  size_t bytes = sizeof(float) * mn * splits;
+  if (g->workspace_size < bytes) {
+    if (g->workspace)
+      clReleaseMemObject(g->workspace);
+    g->workspace = clCreateBuffer(g->context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    g->workspace_size = (err == CL_SUCCESS) ? bytes : 0;
+    if (err != CL_SUCCESS)
+      return err;
+  }
+
+  err = clSetKernelArg(g->ko_splitk, 0, sizeof(cl_mem), &d_a);
+  err |= clSetKernelArg(g->ko_splitk, 1, sizeof(cl_mem), &d_b);
+  err |= clSetKernelArg(g->ko_splitk, 2, sizeof(cl_mem), &g->workspace);
+  err |= clSetKernelArg(g->ko_splitk, 3, sizeof(int), &m);
+  err |= clSetKernelArg(g->ko_splitk, 4, sizeof(int), &n);
+  err |= clSetKernelArg(g->ko_splitk, 5, sizeof(int), &k);
+  err |= clSetKernelArg(g->ko_splitk, 6, sizeof(int), &kslice);
+  if (err != CL_SUCCESS)
+    return err;
+
+  const size_t global[3] = {n, m, splits};
+  err = clEnqueueNDRangeKernel(commands, g->ko_splitk, 3, NULL, global, NULL, 0, NULL, TRACE_EV("kernel", "mmul_splitk"));
+  if (err != CL_SUCCESS)
+    return err;
+
+  err = clSetKernelArg(g->ko_reduce, 0, sizeof(cl_mem), &g->workspace);
+  err |= clSetKernelArg(g->ko_reduce, 1, sizeof(cl_mem), &d_c);
+  err |= clSetKernelArg(g->ko_reduce, 2, sizeof(int), &mn);
+  err |= clSetKernelArg(g->ko_reduce, 3, sizeof(int), &splits);
+  if (err != CL_SUCCESS)
+    return err;
+
+  const size_t global_mn = mn;
+  return clEnqueueNDRangeKernel(commands, g->ko_reduce, 1, NULL, &global_mn, NULL, 0, NULL, TRACE_EV("kernel", "splitk_reduce"));
+}
+
+void gemm_release(gemm_ctx *g) {
+  if (g->ko_mmul)
+    clReleaseKernel(g->ko_mmul);
+  if (g->scratch)
+    clReleaseMemObject(g->scratch);
+  if (g->workspace)
+    clReleaseMemObject(g->workspace);
+  if (g->ko_mnk)
+    clReleaseKernel(g->ko_mnk);
+  if (g->ko_splitk)
+    clReleaseKernel(g->ko_splitk);
+  if (g->ko_reduce)
+    clReleaseKernel(g->ko_reduce);
+  gemv_release(&g->gemv);
+  layout_release(&g->layout);
+  memset(g, 0, sizeof(*g));
+}
+
+const char* b_layout_name(int b_layout) {
+  switch (b_layout) {
+    case B_ROW_MAJOR:
+      return "row-major";
+    case B_TRANSPOSED:
+      return "transposed";
+    case B_PANELS:
+      return "panels";
+    default:
+      return "auto";
+  }
+}
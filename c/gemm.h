@@ -0,0 +1,71 @@
+#ifndef GEMM
+#define GEMM
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "kernel_cache.h"
+#include "layout.h"
+#include "device_info.h"
+#include "operand_cache.h"
+#include "gemv.h"
+
+// Layout B is handed to the kernel in
+#define B_AUTO       (-1)
+#define B_ROW_MAJOR  (0)
+#define B_TRANSPOSED (1)
+#define B_PANELS     (2)
+
+#define GEMM_PACK_MIN (512)  // Order where packing B pays off when the cache size is unknown
+
+#define GEMM_SPLITK_ITEMS_PER_CU (1024)  // Work-items per compute unit split-K aims for
+#define GEMM_SPLITK_MIN_SLICE    (256)   // Shortest K slice worth a partial sum
+
+// Kernel and B layout chosen for one matrix order
+typedef struct {
+  int n;
+  int b_layout;
+  int tiled;
+  kernel_spec spec;
+  const char *kernel;
+} gemm_plan;
+
+// GEMM driver state: the plan for the last order seen, its kernel and the
+// scratch buffer holding the relaid-out copy of B
+typedef struct {
+  cl_context context;
+  cl_device_id device;
+  device_caps caps;
+  int tile;
+  int b_layout;         // B_AUTO, or a layout to force
+  int planned_layout;   // b_layout the current plan was made for
+  gemm_plan plan;
+  cl_kernel ko_mmul;
+  layout_kernels layout;
+  cl_mem scratch;
+  size_t scratch_size;
+  int split_k;          // 0 picks the K split from the shape, or a split to force
+  int splits;           // K slices of the last gemm_mnk call
+  cl_kernel ko_mnk;     // tiled rectangular kernel for unsplit products
+  int mnk_tile;         // tile ko_mnk was built for
+  cl_kernel ko_splitk;
+  cl_kernel ko_reduce;
+  cl_mem workspace;     // splits partial m x n products
+  size_t workspace_size;
+  gemv_ctx gemv;        // m = 1 and n = 1 products
+} gemm_ctx;
+
+gemm_plan plan_gemm(int n, int tile, const device_caps *caps, int b_layout);
+int plan_splitk(int m, int n, int k, const device_caps *caps);
+cl_int gemm_init(gemm_ctx *g, cl_context context, cl_device_id device, int tile);
+cl_int gemm(gemm_ctx *g, cl_command_queue commands, cl_mem d_a, cl_mem d_b, cl_mem d_c, int n);
+cl_int gemm_cached(gemm_ctx *g, cl_command_queue commands, operand_cache *oc, cl_mem d_a, const float *h_b,
+                   uint64_t key, uint64_t version, cl_mem d_c, int n);
+cl_int gemm_mnk(gemm_ctx *g, cl_command_queue commands, cl_mem d_a, cl_mem d_b, cl_mem d_c, int m, int n, int k);
+void gemm_release(gemm_ctx *g);
+const char* b_layout_name(int b_layout);
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * Matrix-vector products, y = a x and y = a^T x, single and batched
+ *
+ * GEMV reads every element of a once and does one FMA with it, so it is
+ * bound by memory bandwidth; the kernels are laid out so that reads of a
+ * are contiguous across a work-group and x is reused from registers or
+ * cache, and the K sums are reduced in local memory rather than run
+ * serially per output.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "gemv.h"
+#include "kernel_cache.h"
+#include "trace.h"
+
+static size_t pow2_floor(size_t x) {
+  while (x & (x - 1))
+    x &= x - 1;
+  return x;
+}
+
+cl_int gemv_init(gemv_ctx *v, cl_context context, cl_device_id device, const device_caps *caps) {
+  cl_int err;
+  char defines[64];
+  kernel_spec spec = {0};
+  snprintf(defines, sizeof(defines), "-D GEMV_ROWS=%d", GEMV_ROWS);
+  spec.defines = defines;
+
+  memset(v, 0, sizeof(*v));
+  v->local = pow2_floor(caps_work_group(caps, GEMV_WG));
+  v->cols = (v->local < GEMV_COLS) ? v->local : GEMV_COLS;
+  v->ko_n = get_kernel(context, device, "gemv.cl", "gemv_n", &spec, &err);
+  if (err != CL_SUCCESS)
+    return err;
+  v->ko_t = get_kernel(context, device, "gemv.cl", "gemv_t", &spec, &err);
+  if (err != CL_SUCCESS)
+    gemv_release(v);
+  return err;
+}
+
+// a is m x k row-major; trans 0 gives y (m) = a x (k), trans 1 y (k) = a^T x (m).
+// batch such products on operands stored back to back.
+cl_int gemv_batched(gemv_ctx *v, cl_command_queue commands, int trans, cl_mem d_a, cl_mem d_x, cl_mem d_y,
+                    int m, int k, int batch) {
+  cl_int err;
+  cl_kernel kernel = trans ? v->ko_t : v->ko_n;
+  if (m <= 0 || k <= 0 || batch <= 0)
+    return CL_INVALID_VALUE;
+
+  if (!trans) {
+    // No more work-items per row block than there are columns, and one per
+    // row of the block at least for the final stores
+    size_t wg = v->local;
+    while (wg > GEMV_ROWS && wg / 2 >= (size_t)k)
+      wg /= 2;
+    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_a);
+    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_x);
+    err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_y);
+    err |= clSetKernelArg(kernel, 3, sizeof(int), &m);
+    err |= clSetKernelArg(kernel, 4, sizeof(int), &k);
+    err |= clSetKernelArg(kernel, 5, sizeof(float) * GEMV_ROWS * wg, NULL);
+    if (err != CL_SUCCESS)
+      return err;
+    const size_t global[2] = {(m + GEMV_ROWS - 1) / GEMV_ROWS * wg, batch};
+    const size_t local[2] = {wg, 1};
+    return clEnqueueNDRangeKernel(commands, kernel, 2, NULL, global, local, 0, NULL, TRACE_EV("kernel", "gemv_n"));
+  }
+
+  // Row slices, no more than there are rows
+  size_t slices = v->local / v->cols;
+  while (slices > 1 && slices / 2 >= (size_t)m)
+    slices /= 2;
+  err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_a);
+  err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_x);
+  err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_y);
+  err |= clSetKernelArg(kernel, 3, sizeof(int), &m);
+  err |= clSetKernelArg(kernel, 4, sizeof(int), &k);
+  err |= clSetKernelArg(kernel, 5, sizeof(float) * v->cols * slices, NULL);
+  if (err != CL_SUCCESS)
+    return err;
+  const size_t global[3] = {(k + v->cols - 1) / v->cols * v->cols, slices, batch};
+  const size_t local[3] = {v->cols, slices, 1};
+  return clEnqueueNDRangeKernel(commands, kernel, 3, NULL, global, local, 0, NULL, TRACE_EV("kernel", "gemv_t"));
+}
+
+cl_int gemv(gemv_ctx *v, cl_command_queue commands, int trans, cl_mem d_a, cl_mem d_x, cl_mem d_y, int m, int k) {
+  return gemv_batched(v, commands, trans, d_a, d_x, d_y, m, k, 1);
+}
+
+void gemv_release(gemv_ctx *v) {
+  if (v->ko_n)
+    clReleaseKernel(v->ko_n);
+  if (v->ko_t)
+    clReleaseKernel(v->ko_t);
+  memset(v, 0, sizeof(*v));
+}
@@ -0,0 +1,80 @@
+#include "kernel_common.clh"
+
+// Rows per work-group of gemv_n, set from gemv.h with -D GEMV_ROWS=...
+#ifndef GEMV_ROWS
+#define GEMV_ROWS 4
+#endif
+
+// y = a x for a batch of m x k row-major matrices stored back to back, x
+// and y likewise; dim 1 of the range is the batch. One work-group per
+// GEMV_ROWS rows: consecutive work-items read consecutive floats of each
+// row, reuse every x element across the rows, and the per-row partial sums
+// are reduced in local memory. The local size must be a power of two.
+__kernel void gemv_n(__global const DTYPE *a, __global const DTYPE *x, __global DTYPE *y,
+                     const int m, const int k, __local DTYPE *scratch) {
+  int lid = get_local_id(0);
+  int wg = get_local_size(0);
+  int row0 = get_group_id(0) * GEMV_ROWS;
+  size_t b = get_global_id(1);
+  a += b * m * k;
+  x += b * k;
+  y += b * m;
+
+  DTYPE acc[GEMV_ROWS];
+  for (int r = 0; r < GEMV_ROWS; r++)
+    acc[r] = 0;
+  for (int i = lid; i < k; i += wg) {
+    DTYPE xi = x[i];
+    for (int r = 0; r < GEMV_ROWS; r++) {
+      if (row0 + r < m)
+        acc[r] += a[(size_t)(row0 + r) * k + i] * xi;
+    }
+  }
+  for (int r = 0; r < GEMV_ROWS; r++)
+    scratch[r * wg + lid] = acc[r];
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (int s = wg / 2; s > 0; s >>= 1) {
+    if (lid < s) {
+      for (int r = 0; r < GEMV_ROWS; r++)
+        scratch[r * wg + lid] += scratch[r * wg + lid + s];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  if (lid < GEMV_ROWS && row0 + lid < m)
+    y[row0 + lid] = scratch[lid * wg];
+}
+
+// y = a^T x for a batch of m x k row-major matrices, so x has m and y has k
+// entries; dim 2 of the range is the batch. A work-group is a block of
+// columns (dim 0) by a set of row slices (dim 1, a power of two): each row
+// of the group reads consecutive floats of a, and the slices' partial sums
+// are reduced in local memory.
+__kernel void gemv_t(__global const DTYPE *a, __global const DTYPE *x, __global DTYPE *y,
+                     const int m, const int k, __local DTYPE *scratch) {
+  int lc = get_local_id(0);
+  int lr = get_local_id(1);
+  int cols = get_local_size(0);
+  int slices = get_local_size(1);
+  int j = get_global_id(0);
+  size_t b = get_global_id(2);
+  a += b * m * k;
+  x += b * m;
+  y += b * k;
+
+  DTYPE acc = 0;
+  if (j < k) {
+    for (int i = lr; i < m; i += slices)
+      acc += a[(size_t)i * k + j] * x[i];
+  }
+  scratch[lr * cols + lc] = acc;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (int s = slices / 2; s > 0; s >>= 1) {
+    if (lr < s)
+      scratch[lr * cols + lc] += scratch[(lr + s) * cols + lc];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  if (lr == 0 && j < k)
+    y[j] = scratch[lc];
+}
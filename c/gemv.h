@@ -0,0 +1,30 @@
+#ifndef GEMV
+#define GEMV
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "device_info.h"
+
+#define GEMV_WG   (256)  // Work-group size asked of the device
+#define GEMV_ROWS (4)    // Rows per gemv_n work-group, each x element is reused this often
+#define GEMV_COLS (32)   // Columns per gemv_t work-group, the rest of the group splits the rows
+
+// Matrix-vector kernels from gemv.cl and their launch shape
+typedef struct {
+  size_t local;         // power of two
+  size_t cols;          // gemv_t columns per work-group
+  cl_kernel ko_n;
+  cl_kernel ko_t;
+} gemv_ctx;
+
+cl_int gemv_init(gemv_ctx *v, cl_context context, cl_device_id device, const device_caps *caps);
+cl_int gemv(gemv_ctx *v, cl_command_queue commands, int trans, cl_mem d_a, cl_mem d_x, cl_mem d_y, int m, int k);
+cl_int gemv_batched(gemv_ctx *v, cl_command_queue commands, int trans, cl_mem d_a, cl_mem d_x, cl_mem d_y,
+                    int m, int k, int batch);
+void gemv_release(gemv_ctx *v);
+
+#endif
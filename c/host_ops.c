@@ -0,0 +1,160 @@
+/*
+ * Host backend: vector ops and GEMM on the work-stealing pool
+ *
+ * Each call is an NDRange of tile tasks, the pool standing in for the
+ * device's compute units and GCC vector types for its SIMD lanes.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_ops.h"
+
+typedef float v8f __attribute__((vector_size(32)));
+
+// Unaligned loads and stores; memcpy compiles to a single vector move.
+// Macros, since a 32-byte vector passed or returned by value changes the
+// ABI on builds without AVX and GCC warns about it (-Wpsabi).
+#define LOAD8(v, p)  memcpy(&(v), (p), sizeof(v8f))
+#define STORE8(p, v) memcpy((p), &(v), sizeof(v8f))
+
+typedef struct {
+  const float *a;
+  const float *b;
+  float *c;
+  double *partial;
+  unsigned int count;
+  int m, n, k;
+  int tiles_n;
+} host_job;
+
+static void vadd_task(void *arg, long begin, long end) {
+  host_job *j = arg;
+  size_t lo = (size_t)begin * HOST_CHUNK, hi = (size_t)end * HOST_CHUNK, i;
+  if (hi > j->count)
+    hi = j->count;
+  for (i = lo; i + 8 <= hi; i += 8) {
+    v8f a, b;
+    LOAD8(a, j->a + i);
+    LOAD8(b, j->b + i);
+    a += b;
+    STORE8(j->c + i, a);
+  }
+  for (; i < hi; i++)
+    j->c[i] = j->a[i] + j->b[i];
+}
+
+void host_vadd(thread_pool *p, const float *a, const float *b, float *c, unsigned int count) {
+  host_job j = {a, b, c, NULL, count, 0, 0, 0, 0};
+  pool_run(p, ((long)count + HOST_CHUNK - 1) / HOST_CHUNK, 4, vadd_task, &j);
+}
+
+// One partial per chunk, so the result doesn't depend on who ran what
+static void sum_task(void *arg, long begin, long end) {
+  host_job *j = arg;
+  for (long t = begin; t < end; t++) {
+    size_t lo = (size_t)t * HOST_CHUNK, hi = lo + HOST_CHUNK, i;
+    if (hi > j->count)
+      hi = j->count;
+    v8f acc = {0}, a;
+    for (i = lo; i + 8 <= hi; i += 8) {
+      LOAD8(a, j->a + i);
+      acc += a;
+    }
+    double s = 0.0;
+    for (int l = 0; l < 8; l++)
+      s += acc[l];
+    for (; i < hi; i++)
+      s += j->a[i];
+    j->partial[t] = s;
+  }
+}
+
+double host_sum(thread_pool *p, const float *a, unsigned int count) {
+  long tasks = ((long)count + HOST_CHUNK - 1) / HOST_CHUNK;
+  double sum = 0.0;
+  if (tasks == 0)
+    return sum;
+  host_job j = {a, NULL, NULL, calloc(tasks, sizeof(double)), count, 0, 0, 0, 0};
+  if (!j.partial)
+    return sum;
+  pool_run(p, tasks, 4, sum_task, &j);
+  for (long t = 0; t < tasks; t++)
+    sum += j.partial[t];
+  free(j.partial);
+  return sum;
+}
+
+// C[i..i+4, jj..jj+32] += A[i..i+4, p0..p1] * B[p0..p1, jj..jj+32]
+static void micro_4x32(const host_job *j, int i, int jj, int p0, int p1) {
+  const float *a = j->a + (size_t)i * j->k;
+  float *c = j->c + (size_t)i * j->n + jj;
+  v8f acc[HOST_MR][4];
+  for (int r = 0; r < HOST_MR; r++)
+    for (int v = 0; v < 4; v++)
+      LOAD8(acc[r][v], c + (size_t)r * j->n + 8 * v);
+
+  for (int p = p0; p < p1; p++) {
+    const float *b = j->b + (size_t)p * j->n + jj;
+    v8f b0, b1, b2, b3;
+    LOAD8(b0, b);
+    LOAD8(b1, b + 8);
+    LOAD8(b2, b + 16);
+    LOAD8(b3, b + 24);
+    for (int r = 0; r < HOST_MR; r++) {
+      float s = a[(size_t)r * j->k + p];
+      v8f av = {s, s, s, s, s, s, s, s};
+      acc[r][0] += av * b0;
+      acc[r][1] += av * b1;
+      acc[r][2] += av * b2;
+      acc[r][3] += av * b3;
+    }
+  }
+
+  for (int r = 0; r < HOST_MR; r++)
+    for (int v = 0; v < 4; v++)
+      STORE8(c + (size_t)r * j->n + 8 * v, acc[r][v]);
+}
+
+// Rows and columns the micro-kernel doesn't cover
+static void edge(const host_job *j, int i0, int i1, int j0, int j1, int p0, int p1) {
+  for (int i = i0; i < i1; i++) {
+    float *c = j->c + (size_t)i * j->n;
+    for (int p = p0; p < p1; p++) {
+      float s = j->a[(size_t)i * j->k + p];
+      const float *b = j->b + (size_t)p * j->n;
+      for (int jj = j0; jj < j1; jj++)
+        c[jj] += s * b[jj];
+    }
+  }
+}
+
+// One task per HOST_TILE x HOST_TILE block of C, K walked in HOST_KC blocks
+// so the A and B panels of a block stay in cache
+static void gemm_task(void *arg, long begin, long end) {
+  host_job *j = arg;
+  for (long t = begin; t < end; t++) {
+    int i0 = (int)(t / j->tiles_n) * HOST_TILE, j0 = (int)(t % j->tiles_n) * HOST_TILE;
+    int i1 = (i0 + HOST_TILE < j->m) ? i0 + HOST_TILE : j->m;
+    int j1 = (j0 + HOST_TILE < j->n) ? j0 + HOST_TILE : j->n;
+    int im = i0 + (i1 - i0) / HOST_MR * HOST_MR, jm = j0 + (j1 - j0) / HOST_NR * HOST_NR;
+
+    for (int i = i0; i < i1; i++)
+      memset(j->c + (size_t)i * j->n + j0, 0, sizeof(float) * (j1 - j0));
+    for (int p0 = 0; p0 < j->k; p0 += HOST_KC) {
+      int p1 = (p0 + HOST_KC < j->k) ? p0 + HOST_KC : j->k;
+      for (int i = i0; i < im; i += HOST_MR)
+        for (int jj = j0; jj < jm; jj += HOST_NR)
+          micro_4x32(j, i, jj, p0, p1);
+      edge(j, i0, im, jm, j1, p0, p1);
+      edge(j, im, i1, j0, j1, p0, p1);
+    }
+  }
+}
+
+// c = a * b with a m x k and b k x n
+void host_gemm(thread_pool *p, const float *a, const float *b, float *c, int m, int n, int k) {
+  host_job j = {a, b, c, NULL, 0, m, n, k, (n + HOST_TILE - 1) / HOST_TILE};
+  long tiles = (long)((m + HOST_TILE - 1) / HOST_TILE) * j.tiles_n;
+  pool_run(p, tiles, 1, gemm_task, &j);
+}
@@ -0,0 +1,19 @@
+#ifndef HOST_OPS
+#define HOST_OPS
+
+#include "threadpool.h"
+
+#define HOST_CHUNK (16384)  // Elements per vector-op task
+#define HOST_TILE  (64)     // C tile per GEMM task, HOST_TILE x HOST_TILE
+#define HOST_KC    (256)    // K block a C tile accumulates at a time
+#define HOST_MR    (4)      // Micro-kernel rows
+#define HOST_NR    (32)     // Micro-kernel columns, four 8-float vectors
+
+// The vector ops and GEMM on host threads, for machines without an OpenCL
+// platform. Same shapes and layouts as the device versions: float32,
+// row-major, contiguous.
+void host_vadd(thread_pool *p, const float *a, const float *b, float *c, unsigned int count);
+double host_sum(thread_pool *p, const float *a, unsigned int count);
+void host_gemm(thread_pool *p, const float *a, const float *b, float *c, int m, int n, int k);
+
+#endif
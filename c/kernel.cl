@@ -1,13 +1,114 @@
+#include "kernel_common.clh"
+
 // OpenCL Kernel
-__kernel void mmul(__global float *a, __global float *b, __global float *c, const int N) {
+__kernel void mmul(__global DTYPE *a, __global DTYPE *b, __global DTYPE *c, const int dim EPILOGUE_ARGS) {
+  int k;
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+
+  DTYPE tmp = 0;
+  for (k = 0; k < DIM; k++) {
+    tmp += a[j*DIM+k] * b[k*DIM+i]; 
+  }
+  STORE_C(j*DIM+i, i, tmp);
+}
+
+// Same as mmul with b given transposed (bt = b^T), so every work-item
+// streams a contiguous row of bt instead of a column of b
+__kernel void mmul_bt(__global DTYPE *a, __global DTYPE *bt, __global DTYPE *c, const int dim EPILOGUE_ARGS) {
   int k;
   int i = get_global_id(0);
   int j = get_global_id(1);
 
-  float tmp = 0.0;
-  for (k = 0; k < N; k++) {
-    tmp += a[j*N+k] * b[k*N+i]; 
+  DTYPE tmp = 0;
+  for (k = 0; k < DIM; k++) {
+    tmp += a[j*DIM+k] * bt[i*DIM+k];
+  }
+  STORE_C(j*DIM+i, i, tmp);
+}
+
+#ifdef TILE
+// Tiled kernel, each work-group stages a TILE x TILE block of a and b in local
+// memory. Only built when TILE is defined and needs DIM to be a multiple of TILE.
+__kernel void mmul_tiled(__global DTYPE *a, __global DTYPE *b, __global DTYPE *c, const int dim EPILOGUE_ARGS) {
+  __local DTYPE a_sub[TILE][TILE];
+  __local DTYPE b_sub[TILE][TILE];
+
+  int k, t;
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  int li = get_local_id(0);
+  int lj = get_local_id(1);
+
+  DTYPE tmp = 0;
+  for (t = 0; t < DIM; t += TILE) {
+    a_sub[lj][li] = a[j*DIM+t+li];
+    b_sub[lj][li] = b[(t+lj)*DIM+i];
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (k = 0; k < TILE; k++) {
+      tmp += a_sub[lj][k] * b_sub[k][li];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
   }
-  c[j*N+i] = tmp;
+  STORE_C(j*DIM+i, i, tmp);
 }
 
+// Tiled kernel with b pre-packed into column panels of width TILE (see
+// pack_panels in transpose.cl), so each b tile is one contiguous block
+__kernel void mmul_tiled_packed(__global DTYPE *a, __global DTYPE *bp, __global DTYPE *c, const int dim EPILOGUE_ARGS) {
+  __local DTYPE a_sub[TILE][TILE];
+  __local DTYPE b_sub[TILE][TILE];
+
+  int k, t;
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  int li = get_local_id(0);
+  int lj = get_local_id(1);
+  __global DTYPE *panel = bp + (i/TILE)*DIM*TILE;
+
+  DTYPE tmp = 0;
+  for (t = 0; t < DIM; t += TILE) {
+    a_sub[lj][li] = a[j*DIM+t+li];
+    b_sub[lj][li] = panel[(t+lj)*TILE+li];
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (k = 0; k < TILE; k++) {
+      tmp += a_sub[lj][k] * b_sub[k][li];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  STORE_C(j*DIM+i, i, tmp);
+}
+
+// Rectangular tiled kernel: a is m x k and b k x n, row-major, any shape.
+// Tiles past the edges read as zero and only in-range elements are stored,
+// so the grid rounds up to whole tiles. c is the block at c_off of a matrix
+// with row pitch ldc, which lets a product (or, with the epilogue's scale
+// and residual, an update) land inside a bigger matrix.
+__kernel void mmul_tiled_mnk(__global DTYPE *a, __global DTYPE *b, __global DTYPE *c, const int m, const int n,
+                             const int k, const int ldc, const int c_off EPILOGUE_ARGS) {
+  __local DTYPE a_sub[TILE][TILE];
+  __local DTYPE b_sub[TILE][TILE];
+
+  int kk, t;
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  int li = get_local_id(0);
+  int lj = get_local_id(1);
+
+  DTYPE tmp = 0;
+  for (t = 0; t < k; t += TILE) {
+    a_sub[lj][li] = (j < m && t + li < k) ? a[j*k+t+li] : (DTYPE)0;
+    b_sub[lj][li] = (t + lj < k && i < n) ? b[(t+lj)*n+i] : (DTYPE)0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (kk = 0; kk < TILE; kk++) {
+      tmp += a_sub[lj][kk] * b_sub[kk][li];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  if (i < n && j < m)
+    STORE_C(c_off + j*ldc + i, i, tmp);
+}
+#endif
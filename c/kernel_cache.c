@@ -0,0 +1,157 @@
+/*
+ * Build cache for specialised kernel programs
+ *
+ * Programs are keyed by context, device, kernel file and the -D options
+ * produced from a kernel_spec, so each specialisation is compiled once per
+ * device per run.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "kernel_cache.h"
+#include "mat_lib.h"
+#include "trace.h"
+
+#define MAX_OPTIONS  (1024)
+
+typedef struct {
+  cl_context context;
+  cl_device_id device;
+  char filename[1280];
+  char options[MAX_OPTIONS];
+  cl_program program;
+} program_entry;
+
+// Grows as specialisations are built, every entry lives until
+// release_programs. lock guards the table and kernel_dir, so handles on
+// different threads can build through it.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static program_entry *cache = NULL;
+static int num_cached = 0;
+static int cache_size = 0;
+static char kernel_dir[1024] = "";
+
+// Directory kernel files are loaded from, the working directory by default
+void set_kernel_dir(const char *dir) {
+  pthread_mutex_lock(&lock);
+  snprintf(kernel_dir, sizeof(kernel_dir), "%s", dir ? dir : "");
+  pthread_mutex_unlock(&lock);
+}
+
+// Writes the build options for spec into buf
+void spec_options(const kernel_spec *spec, char *buf, size_t len) {
+  int n = 0;
+  buf[0] = '\0';
+  if (!spec)
+    return;
+  if (spec->n > 0)
+    n += snprintf(buf + n, len - n, "-D N=%d ", spec->n);
+  if (spec->tile > 0 && n < len)
+    n += snprintf(buf + n, len - n, "-D TILE=%d ", spec->tile);
+  if (spec->dtype && n < len)
+    n += snprintf(buf + n, len - n, "-D DTYPE=%s ", spec->dtype);
+  if (spec->defines && n < len)
+    snprintf(buf + n, len - n, "%s", spec->defines);
+}
+
+// Fully specialised tiled variant when n divides into tiles, otherwise the
+// generic kernel with N passed at runtime
+kernel_spec choose_mmul_spec(int n, int tile) {
+  kernel_spec spec = {0};
+  if (tile > 0 && n % tile == 0) {
+    spec.n = n;
+    spec.tile = tile;
+  }
+  return spec;
+}
+
+static cl_program find_or_build(cl_context context, cl_device_id device, const char *name, const kernel_spec *spec, cl_int *err) {
+  char options[MAX_OPTIONS];
+  spec_options(spec, options, sizeof(options));
+
+  char filename[1280];
+  if (kernel_dir[0])
+    snprintf(filename, sizeof(filename), "%s/%s", kernel_dir, name);
+  else
+    snprintf(filename, sizeof(filename), "%s", name);
+
+  for (int i = 0; i < num_cached; i++) {
+    if (cache[i].context == context && cache[i].device == device && !strcmp(cache[i].filename, filename) && !strcmp(cache[i].options, options)) {
+      *err = CL_SUCCESS;
+      return cache[i].program;
+    }
+  }
+
+  TRACE_BEGIN("build", "load source");
+  char *source = load_kernel_source(filename);
+  TRACE_END();
+  if (!source) {
+    *err = CL_INVALID_PROGRAM;
+    return NULL;
+  }
+  cl_program program = clCreateProgramWithSource(context, 1, (const char**) &source, NULL, err);
+  free(source);
+  if (*err != CL_SUCCESS)
+    return NULL;
+
+  TRACE("build", "clBuildProgram", *err = clBuildProgram(program, 1, &device, options, NULL, NULL));
+  if (*err != CL_SUCCESS) {
+    size_t len;
+    char buffer[2048];
+
+    printf("Error: Failed to build %s with options \"%s\"\n", filename, options);
+    clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+    printf("%s\n", buffer);
+    clReleaseProgram(program);
+    return NULL;
+  }
+
+  if (num_cached == cache_size) {
+    int size = cache_size ? 2 * cache_size : 64;
+    program_entry *grown = realloc(cache, sizeof(program_entry) * size);
+    if (!grown) {
+      clReleaseProgram(program);
+      *err = CL_OUT_OF_HOST_MEMORY;
+      return NULL;
+    }
+    cache = grown;
+    cache_size = size;
+  }
+  program_entry *entry = &cache[num_cached++];
+  entry->context = context;
+  entry->device = device;
+  snprintf(entry->filename, sizeof(entry->filename), "%s", filename);
+  snprintf(entry->options, sizeof(entry->options), "%s", options);
+  entry->program = program;
+  return program;
+}
+
+cl_program get_program(cl_context context, cl_device_id device, const char *name, const kernel_spec *spec, cl_int *err) {
+  pthread_mutex_lock(&lock);
+  cl_program program = find_or_build(context, device, name, spec, err);
+  pthread_mutex_unlock(&lock);
+  return program;
+}
+
+// Creates kernel name from the cached program for spec. The caller owns the
+// returned kernel and releases it as usual.
+cl_kernel get_kernel(cl_context context, cl_device_id device, const char *filename, const char *name, const kernel_spec *spec, cl_int *err) {
+  cl_program program = get_program(context, device, filename, spec, err);
+  if (!program)
+    return NULL;
+  return clCreateKernel(program, name, err);
+}
+
+void release_programs(void) {
+  pthread_mutex_lock(&lock);
+  for (int i = 0; i < num_cached; i++)
+    clReleaseProgram(cache[i].program);
+  free(cache);
+  cache = NULL;
+  num_cached = 0;
+  cache_size = 0;
+  pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,26 @@
+#ifndef KERNEL_CACHE
+#define KERNEL_CACHE
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+// Compile-time specialisation of a kernel file. Every field left at zero/NULL
+// keeps the generic behaviour of the kernel source.
+typedef struct {
+  int n;               // matrix order passed as -D N=..., 0 for runtime N
+  int tile;            // work-group tile passed as -D TILE=..., 0 for none
+  const char *dtype;   // element type passed as -D DTYPE=..., NULL for float
+  const char *defines; // extra build options appended verbatim
+} kernel_spec;
+
+void set_kernel_dir(const char *dir);
+void spec_options(const kernel_spec *spec, char *buf, size_t len);
+kernel_spec choose_mmul_spec(int n, int tile);
+cl_program get_program(cl_context context, cl_device_id device, const char *name, const kernel_spec *spec, cl_int *err);
+cl_kernel get_kernel(cl_context context, cl_device_id device, const char *filename, const char *name, const kernel_spec *spec, cl_int *err);
+void release_programs(void);
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * Transpose and row-major / column-major / panel layout conversion
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "layout.h"
+#include "kernel_cache.h"
+#include "trace.h"
+
+static size_t round_up(size_t x, size_t m) {
+  return (x + m - 1) / m * m;
+}
+
+cl_int layout_init(layout_kernels *lk, cl_context context, cl_device_id device, int panel) {
+  cl_int err;
+  char defines[64];
+  snprintf(defines, sizeof(defines), "-D TDIM=%d -D PANEL=%d", TDIM, panel);
+  kernel_spec spec = {0};
+  spec.defines = defines;
+
+  memset(lk, 0, sizeof(*lk));
+  lk->panel = panel;
+  lk->ko_transpose = get_kernel(context, device, "transpose.cl", "transpose", &spec, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  lk->ko_transpose_inplace = get_kernel(context, device, "transpose.cl", "transpose_inplace", &spec, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  lk->ko_pack = get_kernel(context, device, "transpose.cl", "pack_panels", &spec, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  lk->ko_unpack = get_kernel(context, device, "transpose.cl", "unpack_panels", &spec, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  return CL_SUCCESS;
+
+fail:
+  layout_release(lk);
+  return err;
+}
+
+// out = in^T for a rows x cols in
+cl_int layout_transpose(cl_command_queue commands, layout_kernels *lk, cl_mem in, cl_mem out, int rows, int cols) {
+  cl_int err;
+  const size_t global[2] = {round_up(cols, TDIM), round_up(rows, TDIM)};
+  const size_t local[2] = {TDIM, TDIM};
+  err = clSetKernelArg(lk->ko_transpose, 0, sizeof(cl_mem), &in);
+  err |= clSetKernelArg(lk->ko_transpose, 1, sizeof(cl_mem), &out);
+  err |= clSetKernelArg(lk->ko_transpose, 2, sizeof(int), &rows);
+  err |= clSetKernelArg(lk->ko_transpose, 3, sizeof(int), &cols);
+  if (err != CL_SUCCESS)
+    return err;
+  return clEnqueueNDRangeKernel(commands, lk->ko_transpose, 2, NULL, global, local, 0, NULL, TRACE_EV("kernel", "transpose"));
+}
+
+cl_int layout_transpose_inplace(cl_command_queue commands, layout_kernels *lk, cl_mem a, int n) {
+  cl_int err;
+  const size_t global[2] = {round_up(n, TDIM), round_up(n, TDIM)};
+  const size_t local[2] = {TDIM, TDIM};
+  err = clSetKernelArg(lk->ko_transpose_inplace, 0, sizeof(cl_mem), &a);
+  err |= clSetKernelArg(lk->ko_transpose_inplace, 1, sizeof(int), &n);
+  if (err != CL_SUCCESS)
+    return err;
+  return clEnqueueNDRangeKernel(commands, lk->ko_transpose_inplace, 2, NULL, global, local, 0, NULL, TRACE_EV("kernel", "transpose_inplace"));
+}
+
+static cl_int panels(cl_command_queue commands, cl_kernel kernel, cl_mem in, cl_mem out, int rows, int cols) {
+  cl_int err;
+  const size_t global[2] = {cols, rows};
+  err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &in);
+  err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &out);
+  err |= clSetKernelArg(kernel, 2, sizeof(int), &rows);
+  err |= clSetKernelArg(kernel, 3, sizeof(int), &cols);
+  if (err != CL_SUCCESS)
+    return err;
+  return clEnqueueNDRangeKernel(commands, kernel, 2, NULL, global, NULL, 0, NULL, TRACE_EV("kernel", "panels"));
+}
+
+// Row-major to column panels of width lk->panel, cols must be a multiple of it
+cl_int layout_pack_panels(cl_command_queue commands, layout_kernels *lk, cl_mem in, cl_mem out, int rows, int cols) {
+  if (cols % lk->panel)
+    return CL_INVALID_VALUE;
+  return panels(commands, lk->ko_pack, in, out, rows, cols);
+}
+
+cl_int layout_unpack_panels(cl_command_queue commands, layout_kernels *lk, cl_mem in, cl_mem out, int rows, int cols) {
+  if (cols % lk->panel)
+    return CL_INVALID_VALUE;
+  return panels(commands, lk->ko_unpack, in, out, rows, cols);
+}
+
+void layout_release(layout_kernels *lk) {
+  if (lk->ko_transpose)
+    clReleaseKernel(lk->ko_transpose);
+  if (lk->ko_transpose_inplace)
+    clReleaseKernel(lk->ko_transpose_inplace);
+  if (lk->ko_pack)
+    clReleaseKernel(lk->ko_pack);
+  if (lk->ko_unpack)
+    clReleaseKernel(lk->ko_unpack);
+  memset(lk, 0, sizeof(*lk));
+}
@@ -0,0 +1,32 @@
+#ifndef LAYOUT
+#define LAYOUT
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#define TDIM (16)  // Transpose tile edge
+
+// Transpose and layout conversion kernels from transpose.cl
+typedef struct {
+  int panel;
+  cl_kernel ko_transpose;
+  cl_kernel ko_transpose_inplace;
+  cl_kernel ko_pack;
+  cl_kernel ko_unpack;
+} layout_kernels;
+
+cl_int layout_init(layout_kernels *lk, cl_context context, cl_device_id device, int panel);
+cl_int layout_transpose(cl_command_queue commands, layout_kernels *lk, cl_mem in, cl_mem out, int rows, int cols);
+cl_int layout_transpose_inplace(cl_command_queue commands, layout_kernels *lk, cl_mem a, int n);
+cl_int layout_pack_panels(cl_command_queue commands, layout_kernels *lk, cl_mem in, cl_mem out, int rows, int cols);
+cl_int layout_unpack_panels(cl_command_queue commands, layout_kernels *lk, cl_mem in, cl_mem out, int rows, int cols);
+void layout_release(layout_kernels *lk);
+
+// Row-major <-> column-major is a transpose with the dimensions swapped
+#define layout_row_to_col(q, lk, in, out, rows, cols) layout_transpose(q, lk, in, out, rows, cols)
+#define layout_col_to_row(q, lk, in, out, rows, cols) layout_transpose(q, lk, in, out, cols, rows)
+
+#endif
@@ -0,0 +1,326 @@
+/*
+ * Mixed-precision LU solver
+ *
+ * Factors in fp32 with the O(n^3) work in the trailing GEMM updates, then
+ * refines the solution on the host with fp64 residuals until it is
+ * accurate to fp64 backward error.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "lu.h"
+#include "kernel_cache.h"
+#include "trace.h"
+
+// The trailing update as one tiled rectangular GEMM whose epilogue scales
+// the product by alpha = -1 and adds A22 back as the residual, so
+// A22 -= L21 * U12 is written in place with no product buffer. The tile
+// shrinks until the built kernel accepts its work-group.
+static cl_int build_update(lu_ctx *lu, cl_device_id device) {
+  cl_int err;
+  char defines[256];
+  epilogue_spec epi = {0};
+  epi.scale = 1;
+  epi.residual = 1;
+  epilogue_defines(&epi, defines, sizeof(defines));
+  kernel_spec spec = {0};
+  spec.defines = defines;
+
+  for (;;) {
+    spec.tile = lu->tile;
+    lu->ko_update = get_kernel(lu->context, device, "kernel.cl", "mmul_tiled_mnk", &spec, &err);
+    if (err != CL_SUCCESS) {
+      lu->ko_update = NULL;
+      return err;
+    }
+    int fit = kernel_tile(lu->ko_update, device, lu->tile);
+    if (fit == lu->tile)
+      return CL_SUCCESS;
+    clReleaseKernel(lu->ko_update);
+    lu->ko_update = NULL;
+    lu->tile = fit;
+  }
+}
+
+// nb 0 uses LU_BLOCK
+cl_int lu_init(lu_ctx *lu, cl_context context, cl_device_id device, int nb) {
+  cl_int err;
+  device_caps caps;
+  memset(lu, 0, sizeof(*lu));
+  lu->context = context;
+  lu->nb = nb ? nb : LU_BLOCK;
+
+  err = query_device_caps(device, &caps);
+  if (err != CL_SUCCESS)
+    return err;
+  lu->tile = caps_gemm_tile(&caps);
+  err = build_update(lu, device);
+  if (err != CL_SUCCESS)
+    goto fail;
+  lu->ko_laswp = get_kernel(context, device, "lu.cl", "laswp", NULL, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  lu->ko_trsm = get_kernel(context, device, "lu.cl", "trsm_lunit", NULL, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  lu->ipiv = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(int) * lu->nb, NULL, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  return CL_SUCCESS;
+
+fail:
+  lu_release(lu);
+  return err;
+}
+
+static void release_scratch(lu_ctx *lu) {
+  if (lu->l21)
+    clReleaseMemObject(lu->l21);
+  if (lu->u12)
+    clReleaseMemObject(lu->u12);
+  lu->l21 = lu->u12 = NULL;
+  lu->scratch_n = 0;
+}
+
+static cl_int alloc_scratch(lu_ctx *lu, int n) {
+  cl_int err;
+  release_scratch(lu);
+  lu->l21 = clCreateBuffer(lu->context, CL_MEM_READ_WRITE, sizeof(float) * n * lu->nb, NULL, &err);
+  if (err != CL_SUCCESS)
+    return err;
+  lu->u12 = clCreateBuffer(lu->context, CL_MEM_READ_WRITE, sizeof(float) * n * lu->nb, NULL, &err);
+  if (err != CL_SUCCESS)
+    return err;
+  lu->scratch_n = n;
+  return CL_SUCCESS;
+}
+
+// Unblocked LU with partial pivoting of the m x kb panel p (row-major),
+// whose first row is row k of the matrix. Pivots are stored as absolute rows.
+static void factor_panel(float *p, int m, int kb, int k, int *piv, int *info) {
+  for (int j = 0; j < kb && j < m; j++) {
+    int r = j;
+    for (int i = j + 1; i < m; i++) {
+      if (fabsf(p[i*kb+j]) > fabsf(p[r*kb+j]))
+        r = i;
+    }
+    piv[j] = k + r;
+    if (r != j) {
+      for (int c = 0; c < kb; c++) {
+        float t = p[j*kb+c];
+        p[j*kb+c] = p[r*kb+c];
+        p[r*kb+c] = t;
+      }
+    }
+
+    float d = p[j*kb+j];
+    if (d == 0.0f) {
+      if (*info == 0)
+        *info = k + j + 1;
+      continue;
+    }
+    for (int i = j + 1; i < m; i++) {
+      float l = p[i*kb+j] /= d;
+      for (int c = j + 1; c < kb; c++)
+        p[i*kb+c] -= l * p[j*kb+c];
+    }
+  }
+}
+
+// Factors the n x n row-major d_a in place into P A = L U. ipiv gets the
+// LAPACK-style row interchanges, info the first zero pivot (1-based) or 0.
+cl_int lu_factor(lu_ctx *lu, cl_command_queue commands, cl_mem d_a, int n, int *ipiv, int *info) {
+  cl_int err = CL_SUCCESS;
+  int nb = lu->nb;
+  size_t pitch = sizeof(float) * n;
+  *info = 0;
+
+  if (lu->scratch_n < n) {
+    err = alloc_scratch(lu, n);
+    if (err != CL_SUCCESS)
+      return err;
+  }
+  float *panel = malloc(sizeof(float) * n * nb);
+  if (!panel)
+    return CL_OUT_OF_HOST_MEMORY;
+
+  for (int k = 0; k < n; k += nb) {
+    int kb = (n - k < nb) ? n - k : nb;
+    int m = n - k;
+    int rest = n - k - kb;
+
+    // Panel A[k:n, k:k+kb] to the host, factor, and back
+    const size_t a_origin[3] = {sizeof(float) * k, k, 0};
+    const size_t h_origin[3] = {0, 0, 0};
+    const size_t region[3] = {sizeof(float) * kb, m, 1};
+    err = clEnqueueReadBufferRect(commands, d_a, CL_TRUE, a_origin, h_origin, region, pitch, 0,
+      sizeof(float) * kb, 0, panel, 0, NULL, TRACE_EV("transfer", "panel read"));
+    if (err != CL_SUCCESS)
+      break;
+    TRACE("lu", "factor_panel", factor_panel(panel, m, kb, k, ipiv + k, info));
+    err = clEnqueueWriteBufferRect(commands, d_a, CL_TRUE, a_origin, h_origin, region, pitch, 0,
+      sizeof(float) * kb, 0, panel, 0, NULL, TRACE_EV("transfer", "panel write"));
+    if (err != CL_SUCCESS)
+      break;
+
+    // Same interchanges on the columns left and right of the panel
+    err = clEnqueueWriteBuffer(commands, lu->ipiv, CL_FALSE, 0, sizeof(int) * kb, ipiv + k, 0, NULL, NULL);
+    err |= clSetKernelArg(lu->ko_laswp, 0, sizeof(cl_mem), &d_a);
+    err |= clSetKernelArg(lu->ko_laswp, 1, sizeof(cl_mem), &lu->ipiv);
+    err |= clSetKernelArg(lu->ko_laswp, 2, sizeof(int), &n);
+    err |= clSetKernelArg(lu->ko_laswp, 3, sizeof(int), &k);
+    err |= clSetKernelArg(lu->ko_laswp, 4, sizeof(int), &kb);
+    if (err != CL_SUCCESS)
+      break;
+    const size_t global_n = n;
+    err = clEnqueueNDRangeKernel(commands, lu->ko_laswp, 1, NULL, &global_n, NULL, 0, NULL, TRACE_EV("kernel", "laswp"));
+    if (err != CL_SUCCESS || rest == 0)
+      break;
+
+    // U12 = L11^-1 A12
+    err = clSetKernelArg(lu->ko_trsm, 0, sizeof(cl_mem), &d_a);
+    err |= clSetKernelArg(lu->ko_trsm, 1, sizeof(int), &n);
+    err |= clSetKernelArg(lu->ko_trsm, 2, sizeof(int), &k);
+    err |= clSetKernelArg(lu->ko_trsm, 3, sizeof(int), &kb);
+    if (err != CL_SUCCESS)
+      break;
+    const size_t global_rest = rest;
+    err = clEnqueueNDRangeKernel(commands, lu->ko_trsm, 1, NULL, &global_rest, NULL, 0, NULL, TRACE_EV("kernel", "trsm_lunit"));
+    if (err != CL_SUCCESS)
+      break;
+
+    // A22 = -(L21 * U12) + A22 in place, each work-item reading the A22
+    // element it then writes; L21 and U12 go in as contiguous copies
+    const size_t l21_origin[3] = {sizeof(float) * k, k + kb, 0};
+    const size_t l21_region[3] = {sizeof(float) * kb, rest, 1};
+    const size_t u12_origin[3] = {sizeof(float) * (k + kb), k, 0};
+    const size_t u12_region[3] = {sizeof(float) * rest, kb, 1};
+    err = clEnqueueCopyBufferRect(commands, d_a, lu->l21, l21_origin, h_origin, l21_region, pitch, 0,
+      sizeof(float) * kb, 0, 0, NULL, NULL);
+    err |= clEnqueueCopyBufferRect(commands, d_a, lu->u12, u12_origin, h_origin, u12_region, pitch, 0,
+      sizeof(float) * rest, 0, 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+      break;
+    int off = (k + kb) * n + k + kb;
+    err = clSetKernelArg(lu->ko_update, 0, sizeof(cl_mem), &lu->l21);
+    err |= clSetKernelArg(lu->ko_update, 1, sizeof(cl_mem), &lu->u12);
+    err |= clSetKernelArg(lu->ko_update, 2, sizeof(cl_mem), &d_a);
+    err |= clSetKernelArg(lu->ko_update, 3, sizeof(int), &rest);
+    err |= clSetKernelArg(lu->ko_update, 4, sizeof(int), &rest);
+    err |= clSetKernelArg(lu->ko_update, 5, sizeof(int), &kb);
+    err |= clSetKernelArg(lu->ko_update, 6, sizeof(int), &n);
+    err |= clSetKernelArg(lu->ko_update, 7, sizeof(int), &off);
+    err |= set_epilogue_args(lu->ko_update, 8, NULL, d_a, -1.0, sizeof(float));
+    if (err != CL_SUCCESS)
+      break;
+    size_t tile = lu->tile;
+    const size_t global_update[2] = {(rest + tile - 1) / tile * tile, (rest + tile - 1) / tile * tile};
+    const size_t local_update[2] = {tile, tile};
+    err = clEnqueueNDRangeKernel(commands, lu->ko_update, 2, NULL, global_update, local_update, 0, NULL,
+      TRACE_EV("kernel", "mmul_tiled_mnk update"));
+    if (err != CL_SUCCESS)
+      break;
+  }
+
+  free(panel);
+  if (err != CL_SUCCESS)
+    return err;
+  return clFinish(commands);
+}
+
+// Solves A x = b in place (x holds b on entry) with the fp32 factors of
+// P A = L U, accumulating in double
+void lu_solve_host(const float *lu, const int *ipiv, int n, double *x) {
+  for (int i = 0; i < n; i++) {
+    if (ipiv[i] != i) {
+      double t = x[i];
+      x[i] = x[ipiv[i]];
+      x[ipiv[i]] = t;
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    double tmp = x[i];
+    for (int j = 0; j < i; j++)
+      tmp -= lu[i*n+j] * x[j];
+    x[i] = tmp;
+  }
+  for (int i = n - 1; i >= 0; i--) {
+    double tmp = x[i];
+    for (int j = i + 1; j < n; j++)
+      tmp -= lu[i*n+j] * x[j];
+    x[i] = tmp / lu[i*n+i];
+  }
+}
+
+// Normwise backward error ||b - A x|| / (||A|| ||x|| + ||b||) in the inf
+// norm, leaving the residual in r
+static double backward_error(const double *A, const double *b, const double *x, double *r, int n, double norm_a) {
+  double norm_r = 0.0, norm_x = 0.0, norm_b = 0.0;
+  for (int i = 0; i < n; i++) {
+    double tmp = b[i];
+    for (int j = 0; j < n; j++)
+      tmp -= A[i*n+j] * x[j];
+    r[i] = tmp;
+    norm_r = fmax(norm_r, fabs(tmp));
+    norm_x = fmax(norm_x, fabs(x[i]));
+    norm_b = fmax(norm_b, fabs(b[i]));
+  }
+  return norm_r / (norm_a * norm_x + norm_b);
+}
+
+// Iterative refinement of A x = b in fp64 from the fp32 factors: x = b on
+// entry is replaced by the solution. Returns the number of correction steps,
+// or -1 if the backward error didn't reach n * DBL_EPSILON within
+// LU_MAX_REFINE steps or the residual couldn't be allocated. berr gets the
+// final backward error.
+int lu_refine(const double *A, const float *lu, const int *ipiv, const double *b, double *x, int n, double *berr) {
+  double *r = malloc(sizeof(double) * n);
+  if (!r) {
+    *berr = INFINITY;
+    return -1;
+  }
+  double norm_a = 0.0;
+  for (int i = 0; i < n; i++) {
+    double row = 0.0;
+    for (int j = 0; j < n; j++)
+      row += fabs(A[i*n+j]);
+    norm_a = fmax(norm_a, row);
+  }
+
+  memcpy(x, b, sizeof(double) * n);
+  lu_solve_host(lu, ipiv, n, x);
+
+  int it;
+  for (it = 0; it <= LU_MAX_REFINE; it++) {
+    *berr = backward_error(A, b, x, r, n, norm_a);
+    if (*berr <= n * DBL_EPSILON)
+      break;
+    if (it == LU_MAX_REFINE) {
+      it = -1;
+      break;
+    }
+    lu_solve_host(lu, ipiv, n, r);
+    for (int i = 0; i < n; i++)
+      x[i] += r[i];
+  }
+
+  free(r);
+  return it;
+}
+
+void lu_release(lu_ctx *lu) {
+  release_scratch(lu);
+  if (lu->ipiv)
+    clReleaseMemObject(lu->ipiv);
+  if (lu->ko_update)
+    clReleaseKernel(lu->ko_update);
+  if (lu->ko_laswp)
+    clReleaseKernel(lu->ko_laswp);
+  if (lu->ko_trsm)
+    clReleaseKernel(lu->ko_trsm);
+  memset(lu, 0, sizeof(*lu));
+}
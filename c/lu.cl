@@ -0,0 +1,36 @@
+#include "kernel_common.clh"
+
+// Device side of the blocked LU in lu.c. a is n x n row-major and the
+// current panel covers columns k .. k+kb-1.
+
+// Applies the panel's row interchanges (ipiv holds absolute rows, LAPACK
+// style) to every column outside the panel, one work-item per column
+__kernel void laswp(__global DTYPE *a, __global int *ipiv, const int n, const int k, const int kb) {
+  int c = get_global_id(0);
+  if (c >= n || (c >= k && c < k + kb))
+    return;
+
+  for (int j = 0; j < kb; j++) {
+    int p = ipiv[j];
+    if (p != k + j) {
+      DTYPE t = a[(k+j)*n+c];
+      a[(k+j)*n+c] = a[p*n+c];
+      a[p*n+c] = t;
+    }
+  }
+}
+
+// U12 = L11^-1 A12 with L11 unit lower triangular, one work-item per
+// column right of the panel
+__kernel void trsm_lunit(__global DTYPE *a, const int n, const int k, const int kb) {
+  int c = k + kb + get_global_id(0);
+  if (c >= n)
+    return;
+
+  for (int i = 1; i < kb; i++) {
+    DTYPE tmp = a[(k+i)*n+c];
+    for (int t = 0; t < i; t++)
+      tmp -= a[(k+i)*n+k+t] * a[(k+t)*n+c];
+    a[(k+i)*n+c] = tmp;
+  }
+}
@@ -0,0 +1,39 @@
+#ifndef LU
+#define LU
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "device_info.h"
+#include "epilogue.h"
+
+#define LU_BLOCK      (128)  // Panel width, the k of every trailing GEMM
+#define LU_MAX_REFINE (30)   // Refinement steps before giving up
+
+// Blocked right-looking LU with partial pivoting. Panels are factored on the
+// host, row swaps and the U12 solve run as kernels from lu.cl and the
+// trailing update A22 -= L21 * U12 is one tiled GEMM (mmul_tiled_mnk) with
+// the subtraction fused into its epilogue.
+typedef struct {
+  cl_context context;
+  int nb;
+  int tile;             // tile of the update kernel
+  cl_kernel ko_update;
+  cl_kernel ko_laswp;
+  cl_kernel ko_trsm;
+  cl_mem ipiv;          // pivots of the current panel
+  cl_mem l21;           // contiguous copies of L21 and U12 for the GEMM
+  cl_mem u12;
+  int scratch_n;        // order the scratch buffers are sized for
+} lu_ctx;
+
+cl_int lu_init(lu_ctx *lu, cl_context context, cl_device_id device, int nb);
+cl_int lu_factor(lu_ctx *lu, cl_command_queue commands, cl_mem d_a, int n, int *ipiv, int *info);
+void lu_solve_host(const float *lu, const int *ipiv, int n, double *x);
+int lu_refine(const double *A, const float *lu, const int *ipiv, const double *b, double *x, int n, double *berr);
+void lu_release(lu_ctx *lu);
+
+#endif
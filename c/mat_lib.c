@@ -1,20 +1,106 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
-// Sequential matrix multiplication
+#include "mat_lib.h"
+
+#define MAX_INCLUDE_DEPTH (16)
+
+// Sequential matrix multiplication. i-k-j order so the inner loop walks rows
+// of B and C; each C element still sums over k in ascending order.
 void sequential_mat_mul(float *A, float *B, float *C, int N) {
   int i,j,k;
   for (i = 0; i < N; i++) {
-    for (j = 0; j < N; j++) {
-      float tmp = 0.0f;
-      for (k = 0; k < N; k++) {
-        tmp += A[i * N + k] * B[k * N + j]; 
+    for (j = 0; j < N; j++)
+      C[i * N + j] = 0.0f;
+    for (k = 0; k < N; k++) {
+      float a = A[i * N + k];
+      for (j = 0; j < N; j++) {
+        C[i * N + j] += a * B[k * N + j];
+      }
+    }
+  }
+}
+
+// C = A * B with A M x K and B K x N, same loop order as above
+void sequential_gemm(float *A, float *B, float *C, int M, int N, int K) {
+  int i,j,k;
+  for (i = 0; i < M; i++) {
+    for (j = 0; j < N; j++)
+      C[i * N + j] = 0.0f;
+    for (k = 0; k < K; k++) {
+      float a = A[i * K + k];
+      for (j = 0; j < N; j++) {
+        C[i * N + j] += a * B[k * N + j];
       }
-      C[i * N + j] = tmp;
     }
   }
 }
 
+// sequential_gemm in double, the reference for the fp64 kernels
+void sequential_dgemm(double *A, double *B, double *C, int M, int N, int K) {
+  int i,j,k;
+  for (i = 0; i < M; i++) {
+    for (j = 0; j < N; j++)
+      C[i * N + j] = 0.0;
+    for (k = 0; k < K; k++) {
+      double a = A[i * K + k];
+      for (j = 0; j < N; j++) {
+        C[i * N + j] += a * B[k * N + j];
+      }
+    }
+  }
+}
+
+// Direct convolution, Y (n x k x oh x ow) from X (n x c x h x w) and
+// W (k x c x r x s), all NCHW; taps that land in the padding count as zero
+void sequential_conv2d(float *X, float *W, float *Y, const conv_shape *cs) {
+  int oh = CONV_OUT_H(cs), ow = CONV_OUT_W(cs);
+  for (int n = 0; n < cs->n; n++)
+    for (int k = 0; k < cs->k; k++)
+      for (int y = 0; y < oh; y++)
+        for (int x = 0; x < ow; x++) {
+          float acc = 0.0f;
+          for (int c = 0; c < cs->c; c++)
+            for (int r = 0; r < cs->r; r++) {
+              int ih = y * cs->stride_h - cs->pad_h + r * cs->dil_h;
+              if (ih < 0 || ih >= cs->h)
+                continue;
+              for (int s = 0; s < cs->s; s++) {
+                int iw = x * cs->stride_w - cs->pad_w + s * cs->dil_w;
+                if (iw < 0 || iw >= cs->w)
+                  continue;
+                acc += X[(((size_t)n * cs->c + c) * cs->h + ih) * cs->w + iw] *
+                       W[(((size_t)k * cs->c + c) * cs->r + r) * cs->s + s];
+              }
+            }
+          Y[(((size_t)n * cs->k + k) * oh + y) * ow + x] = acc;
+        }
+}
+
+// Relative Frobenius-norm error ||C - ref|| / ||ref||
+double rel_error(float *ref, float *C, int N) {
+  double diff = 0.0, norm = 0.0;
+  for (int i = 0; i < N*N; i++) {
+    double d = (double)C[i] - ref[i];
+    diff += d * d;
+    norm += (double)ref[i] * ref[i];
+  }
+  return norm > 0.0 ? sqrt(diff / norm) : sqrt(diff);
+}
+
+// Largest elementwise |C - ref|
+double max_abs_error(float *ref, float *C, int N) {
+  double max = 0.0;
+  for (int i = 0; i < N*N; i++) {
+    double d = fabs((double)C[i] - ref[i]);
+    if (d > max)
+      max = d;
+  }
+  return max;
+}
+
 // Prints matrix
 void print_mat(float *A, int N) {
   for (int i = 0; i < N*N; i++) {
@@ -71,5 +157,85 @@ char* load_kernel(char *filename) {
   return buffer;
 }
 
+// Appends len bytes of src to the growing buffer *dst, 0 on success
+static int append_source(char **dst, size_t *dst_len, size_t *dst_cap, const char *src, size_t len) {
+  if (*dst_len + len + 1 > *dst_cap) {
+    size_t cap = *dst_cap;
+    while (*dst_len + len + 1 > cap)
+      cap *= 2;
+    char *grown = realloc(*dst, cap);
+    if (!grown) {
+      fputs("memory alloc failed\n", stderr);
+      return -1;
+    }
+    *dst = grown;
+    *dst_cap = cap;
+  }
+  memcpy(*dst + *dst_len, src, len);
+  *dst_len += len;
+  (*dst)[*dst_len] = '\0';
+  return 0;
+}
+
+// NULL on a missing file, bad #include or allocation failure; the library
+// may run inside a foreign host process, so it reports rather than exits
+static char* expand_kernel(const char *filename, int depth) {
+  if (depth > MAX_INCLUDE_DEPTH) {
+    fprintf(stderr, "#include nested too deeply in %s\n", filename);
+    return NULL;
+  }
+
+  FILE *fp = fopen(filename, "rb");
+  if (!fp) {
+    perror(filename);
+    return NULL;
+  }
+
+  // Includes are resolved relative to the directory of the including file
+  const char *slash = strrchr(filename, '/');
+  int dir_len = slash ? (int)(slash - filename) + 1 : 0;
+
+  size_t len = 0, cap = 4096;
+  char *out = malloc(cap);
+  if (!out) {
+    fclose(fp);
+    fputs("memory alloc failed\n", stderr);
+    return NULL;
+  }
+  out[0] = '\0';
+
+  char line[4096];
+  while (fgets(line, sizeof(line), fp)) {
+    char *p = line;
+    while (*p == ' ' || *p == '\t')
+      p++;
 
+    char name[1024];
+    if (strncmp(p, "#include", 8) == 0 && sscanf(p + 8, " \"%1023[^\"]\"", name) == 1) {
+      char path[2048];
+      snprintf(path, sizeof(path), "%.*s%s", dir_len, filename, name);
+      char *included = expand_kernel(path, depth + 1);
+      int failed = !included || append_source(&out, &len, &cap, included, strlen(included)) ||
+                   append_source(&out, &len, &cap, "\n", 1);
+      free(included);
+      if (failed)
+        goto fail;
+    } else if (append_source(&out, &len, &cap, line, strlen(line))) {
+      goto fail;
+    }
+  }
 
+  fclose(fp);
+  return out;
+
+fail:
+  fclose(fp);
+  free(out);
+  return NULL;
+}
+
+// Loads a kernel file with its #include "..." lines expanded in place, NULL
+// on failure. The caller frees the source.
+char* load_kernel_source(const char *filename) {
+  return expand_kernel(filename, 0);
+}
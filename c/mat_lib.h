@@ -4,8 +4,30 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+// 2D convolution of NCHW input (n x c x h x w) with k x c x r x s filters
+typedef struct {
+  int n, c, h, w;
+  int k, r, s;
+  int stride_h, stride_w;
+  int pad_h, pad_w;
+  int dil_h, dil_w;
+} conv_shape;
+
+// Output extent, 0 when the dilated filter doesn't fit the padded input; C
+// division truncates toward zero, so a negative span is caught first
+#define CONV_OUT_DIM(in, pad, dil, k, stride) \
+  (((in) + 2 * (pad) - (dil) * ((k) - 1) - 1) < 0 ? 0 : ((in) + 2 * (pad) - (dil) * ((k) - 1) - 1) / (stride) + 1)
+#define CONV_OUT_H(cs) CONV_OUT_DIM((cs)->h, (cs)->pad_h, (cs)->dil_h, (cs)->r, (cs)->stride_h)
+#define CONV_OUT_W(cs) CONV_OUT_DIM((cs)->w, (cs)->pad_w, (cs)->dil_w, (cs)->s, (cs)->stride_w)
+
 void sequential_mat_mul(float *A, float *B, float *C, int N);
+void sequential_gemm(float *A, float *B, float *C, int M, int N, int K);
+void sequential_dgemm(double *A, double *B, double *C, int M, int N, int K);
+void sequential_conv2d(float *X, float *W, float *Y, const conv_shape *cs);
 void zero_mat(float *C, int N);
+double rel_error(float *ref, float *C, int N);
+double max_abs_error(float *ref, float *C, int N);
 char* load_kernel(char* filename);
+char* load_kernel_source(const char* filename);
 
 #endif 
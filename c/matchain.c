@@ -0,0 +1,198 @@
+/*
+ * Matrix chain products, A0 A1 ... An-1, in the cheapest order
+ *
+ * plan_chain runs the classic O(n^3) dynamic program over the split points
+ * and flattens the resulting tree into GEMM steps; intermediates stay on
+ * the device in slots handed out by liveness, so a chain of any length runs
+ * in a few buffers. plan_chain_naive gives the left-to-right order for
+ * comparison.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "matchain.h"
+
+static int check_dims(const int *dims, int count) {
+  if (count < 2 || count > CHAIN_MAX)
+    return -1;
+  for (int i = 0; i <= count; i++) {
+    if (dims[i] <= 0)
+      return -1;
+  }
+  return 0;
+}
+
+static int add_step(chain_plan *p, int left, int right, int i, int s, int j) {
+  chain_step *st = &p->step[p->steps];
+  st->left = left;
+  st->right = right;
+  st->m = p->dims[i];
+  st->k = p->dims[s + 1];
+  st->n = p->dims[j + 1];
+  st->slot = -1;
+  p->flops += 2.0 * st->m * st->n * (double)st->k;
+  return CHAIN_TEMP(p->steps++);
+}
+
+// Steps of the product of matrices i..j in post-order, returns its reference
+static int emit(chain_plan *p, int split[CHAIN_MAX][CHAIN_MAX], int i, int j) {
+  if (i == j)
+    return i;
+  int s = split[i][j];
+  int left = emit(p, split, i, s);
+  int right = emit(p, split, s + 1, j);
+  return add_step(p, left, right, i, s, j);
+}
+
+// Gives every step but the last a slot: the smallest free one that fits,
+// else the largest free one, grown, else a new one. Inputs are freed after
+// the step that reads them, so no step writes over its own operands.
+static void assign_slots(chain_plan *p) {
+  int busy[CHAIN_MAX] = {0};
+  p->slots = 0;
+  p->temp_floats = 0;
+  for (int t = 0; t < p->steps; t++) {
+    chain_step *st = &p->step[t];
+    if (t < p->steps - 1) {
+      size_t need = (size_t)st->m * st->n;
+      int best = -1;
+      for (int s = 0; s < p->slots; s++) {
+        if (busy[s])
+          continue;
+        int fits = p->slot_floats[s] >= need;
+        int best_fits = best >= 0 && p->slot_floats[best] >= need;
+        if (best < 0 || (fits && (!best_fits || p->slot_floats[s] < p->slot_floats[best])) ||
+            (!fits && !best_fits && p->slot_floats[s] > p->slot_floats[best]))
+          best = s;
+      }
+      if (best < 0) {
+        best = p->slots++;
+        p->slot_floats[best] = 0;
+      }
+      if (p->slot_floats[best] < need)
+        p->slot_floats[best] = need;
+      st->slot = best;
+      busy[best] = 1;
+      p->temp_floats += need;
+    }
+    if (CHAIN_IS_TEMP(st->left))
+      busy[p->step[CHAIN_STEP(st->left)].slot] = 0;
+    if (CHAIN_IS_TEMP(st->right))
+      busy[p->step[CHAIN_STEP(st->right)].slot] = 0;
+  }
+}
+
+// Cheapest parenthesisation of matrices 0 .. count-1, matrix i being
+// dims[i] x dims[i+1]. Returns -1 for a chain it can't take.
+int plan_chain(chain_plan *p, const int *dims, int count) {
+  double cost[CHAIN_MAX][CHAIN_MAX];
+  int split[CHAIN_MAX][CHAIN_MAX];
+  if (check_dims(dims, count) != 0)
+    return -1;
+  memset(p, 0, sizeof(*p));
+  p->count = count;
+  memcpy(p->dims, dims, sizeof(int) * (count + 1));
+
+  for (int i = 0; i < count; i++)
+    cost[i][i] = 0.0;
+  for (int len = 2; len <= count; len++) {
+    for (int i = 0; i + len - 1 < count; i++) {
+      int j = i + len - 1;
+      cost[i][j] = -1.0;
+      for (int s = i; s < j; s++) {
+        double c = cost[i][s] + cost[s+1][j] + (double)dims[i] * dims[s+1] * dims[j+1];
+        if (cost[i][j] < 0.0 || c < cost[i][j]) {
+          cost[i][j] = c;
+          split[i][j] = s;
+        }
+      }
+    }
+  }
+
+  emit(p, split, 0, count - 1);
+  assign_slots(p);
+  return 0;
+}
+
+// ((A0 A1) A2) ... as written
+int plan_chain_naive(chain_plan *p, const int *dims, int count) {
+  if (check_dims(dims, count) != 0)
+    return -1;
+  memset(p, 0, sizeof(*p));
+  p->count = count;
+  memcpy(p->dims, dims, sizeof(int) * (count + 1));
+
+  int acc = 0;
+  for (int j = 1; j < count; j++)
+    acc = add_step(p, acc, j, 0, j - 1, j);
+  assign_slots(p);
+  return 0;
+}
+
+static void print_ref(const chain_plan *p, int r) {
+  if (!CHAIN_IS_TEMP(r)) {
+    printf("A%d", r);
+    return;
+  }
+  const chain_step *st = &p->step[CHAIN_STEP(r)];
+  printf("(");
+  print_ref(p, st->left);
+  print_ref(p, st->right);
+  printf(")");
+}
+
+// The parenthesisation, then flops and intermediate memory
+void chain_print(const chain_plan *p) {
+  size_t reused = 0;
+  for (int s = 0; s < p->slots; s++)
+    reused += p->slot_floats[s];
+  print_ref(p, CHAIN_TEMP(p->steps - 1));
+  printf("\n  %.3g flops, %d slot%s %.2f MB for %.2f MB of intermediates\n", p->flops, p->slots,
+    p->slots == 1 ? "" : "s", sizeof(float) * reused / 1048576.0, sizeof(float) * p->temp_floats / 1048576.0);
+}
+
+cl_int chain_init(chain_ctx *c, cl_context context, cl_device_id device) {
+  memset(c, 0, sizeof(*c));
+  c->context = context;
+  return gemm_init(&c->gemm, context, device, 0);
+}
+
+// operands[i] holds matrix i row-major; d_out gets the dims[0] x
+// dims[count] product. Steps are enqueued in order on commands, which the
+// slot reuse relies on.
+cl_int chain_mmul(chain_ctx *c, cl_command_queue commands, const chain_plan *p, const cl_mem *operands, cl_mem d_out) {
+  cl_int err;
+  for (int s = 0; s < p->slots; s++) {
+    size_t bytes = sizeof(float) * p->slot_floats[s];
+    if (c->slot_bytes[s] >= bytes)
+      continue;
+    if (c->slot[s])
+      clReleaseMemObject(c->slot[s]);
+    c->slot[s] = clCreateBuffer(c->context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    c->slot_bytes[s] = (err == CL_SUCCESS) ? bytes : 0;
+    if (err != CL_SUCCESS) {
+      c->slot[s] = NULL;
+      return err;
+    }
+  }
+
+  for (int t = 0; t < p->steps; t++) {
+    const chain_step *st = &p->step[t];
+    cl_mem a = CHAIN_IS_TEMP(st->left) ? c->slot[p->step[CHAIN_STEP(st->left)].slot] : operands[st->left];
+    cl_mem b = CHAIN_IS_TEMP(st->right) ? c->slot[p->step[CHAIN_STEP(st->right)].slot] : operands[st->right];
+    cl_mem out = (st->slot < 0) ? d_out : c->slot[st->slot];
+    err = gemm_mnk(&c->gemm, commands, a, b, out, st->m, st->n, st->k);
+    if (err != CL_SUCCESS)
+      return err;
+  }
+  return CL_SUCCESS;
+}
+
+void chain_release(chain_ctx *c) {
+  gemm_release(&c->gemm);
+  for (int s = 0; s < CHAIN_MAX; s++) {
+    if (c->slot[s])
+      clReleaseMemObject(c->slot[s]);
+  }
+}
@@ -0,0 +1,61 @@
+#ifndef MATCHAIN
+#define MATCHAIN
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "gemm.h"
+
+#define CHAIN_MAX (32)  // Longest chain a plan takes
+
+// Operand reference of a step: >= 0 is input matrix i, CHAIN_TEMP(s) the
+// product of step s
+#define CHAIN_TEMP(s)    (-1 - (s))
+#define CHAIN_IS_TEMP(r) ((r) < 0)
+#define CHAIN_STEP(r)    (-1 - (r))
+
+// One product of the chain, m x k times k x n, into an intermediate slot
+// or, for the last step, the caller's output
+typedef struct {
+  int left;
+  int right;
+  int m;
+  int n;
+  int k;
+  int slot;             // -1 for the output
+} chain_step;
+
+// Order of evaluation for matrices 0 .. count-1, matrix i being
+// dims[i] x dims[i+1], and the intermediate buffers it runs in. A slot is
+// reused as soon as the product it holds has been consumed.
+typedef struct {
+  int count;
+  int dims[CHAIN_MAX + 1];
+  int steps;
+  chain_step step[CHAIN_MAX - 1];
+  int slots;
+  size_t slot_floats[CHAIN_MAX];
+  double flops;
+  size_t temp_floats;   // all intermediates without reuse
+} chain_plan;
+
+// Chain executor: the GEMM driver and the slot buffers, kept across calls
+// and grown when a plan needs more
+typedef struct {
+  cl_context context;
+  gemm_ctx gemm;
+  cl_mem slot[CHAIN_MAX];
+  size_t slot_bytes[CHAIN_MAX];
+} chain_ctx;
+
+int plan_chain(chain_plan *p, const int *dims, int count);
+int plan_chain_naive(chain_plan *p, const int *dims, int count);
+void chain_print(const chain_plan *p);
+cl_int chain_init(chain_ctx *c, cl_context context, cl_device_id device);
+cl_int chain_mmul(chain_ctx *c, cl_command_queue commands, const chain_plan *p, const cl_mem *operands, cl_mem d_out);
+void chain_release(chain_ctx *c);
+
+#endif
@@ -4,6 +4,7 @@
 
 #include<stdio.h>
 #include<stdlib.h>
+#include<math.h>
 #include<sys/types.h>
 #ifdef __APPLE__
 #include <OpenCL/opencl.h>
@@ -14,18 +15,35 @@
 
 #include "err_code.h"
 #include "mat_lib.h"
+#include "kernel_cache.h"
+#include "strassen.h"
+#include "epilogue.h"
+#include "gemm.h"
+#include "device_info.h"
+#include "staging.h"
+#include "trace.h"
+#include "rng.h"
+#include "clrt.h"
+#include "host_ops.h"
+#include "fp64.h"
 
 #ifndef DEVICE
 #define DEVICE CL_DEVICE_TYPE_DEFAULT
 #endif
 
 extern double wtime();
-extern int output_device_info(cl_device_id);
 void print_mat(float* A, int N);
 
 
 #define TOL   (0.0001)
-#define N     (32)
+#define N     (32)   // Default matrix order, override with argv[1]
+#define STRASSEN_CUTOFF (0) // Strassen-Winograd cutoff order, 0 disables, override with argv[2]
+#define REPS  (10)   // Timed launches per kernel variant
+#define SPLITK_MN (64) // Output order of the split-K run, K is SPLITK_MN * n
+#define SERVE_CALLS (8) // Requests in the constant-B service loop
+#define GEMV_BATCH (4)  // Matrices in the batched GEMV run
+#define DTOL  (1e-12)   // Relative error allowed of the double precision runs
+#define DSUM_TOL (1e-10) // Same for the double sum, whose error grows with the count
 
 /*
 const char *kernel_source = "\n" \
@@ -46,45 +64,136 @@ const char *kernel_source = "\n" \
 "\n";
 */
 
+// Counts the elements of C that match the reference within TOL
+int test_results(float *ref, float *C, int n) {
+  int correct = 0;
+  TRACE_BEGIN("verify", "test_results");
+  for (int i = 0; i < n*n; i++) {
+    float tmp = ref[i] - C[i];
+    if (tmp*tmp < TOL*TOL*ref[i]*ref[i])
+      correct++;
+  }
+  TRACE_END();
+  return correct;
+}
+
+// Runs one kernel variant REPS times and returns the mean seconds per launch
+double time_mmul(cl_command_queue commands, cl_kernel kernel, cl_mem d_a, cl_mem d_b, cl_mem d_c, int n, const size_t *local) {
+  int err;
+  err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_a);
+  err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_b);
+  err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_c);
+  err |= clSetKernelArg(kernel, 3, sizeof(int), &n);
+  checkError(err, "Setting kernel arguments");
+
+  const size_t global_work_size[2] = {n, n};
+
+  // Warm-up launch so the first timed run doesn't pay for lazy setup
+  err = clEnqueueNDRangeKernel(commands, kernel, 2, NULL, global_work_size, local, 0, NULL, TRACE_EV("kernel", "mmul warm-up"));
+  checkError(err, "Enqueueing kernel");
+  err = clFinish(commands);
+  checkError(err, "Waiting for kernel to finish");
+
+  double rtime = wtime();
+  for (int r = 0; r < REPS; r++) {
+    err = clEnqueueNDRangeKernel(commands, kernel, 2, NULL, global_work_size, local, 0, NULL, TRACE_EV("kernel", "mmul"));
+    checkError(err, "Enqueueing kernel");
+  }
+  err = clFinish(commands);
+  checkError(err, "Waiting for kernel to finish");
+
+  return (wtime() - rtime) / REPS;
+}
+
+// Matrix-vector shapes: a single product goes through gemm_mnk, which
+// should hand it to the GEMV kernels, a batch straight to gemv_batched
+cl_int run_gemv(gemm_ctx *g, cl_command_queue commands, int trans, cl_mem d_a, cl_mem d_x, cl_mem d_y, int m, int k, int batch) {
+  if (batch > 1)
+    return gemv_batched(&g->gemv, commands, trans, d_a, d_x, d_y, m, k, batch);
+  if (trans)
+    return gemm_mnk(g, commands, d_x, d_a, d_y, 1, k, m);
+  return gemm_mnk(g, commands, d_a, d_x, d_y, m, 1, k);
+}
+
+// Relative 2-norm error of the batch of y = a x (or a^T x) against the host
+double gemv_error(const float *a, const float *x, const float *y, int trans, int m, int k, int batch) {
+  double diff = 0.0, norm = 0.0;
+  int rows = trans ? k : m, len = trans ? m : k;
+  for (int b = 0; b < batch; b++) {
+    const float *ab = a + (size_t)b * m * k, *xb = x + (size_t)b * len;
+    for (int i = 0; i < rows; i++) {
+      double ref = 0.0;
+      for (int j = 0; j < len; j++)
+        ref += (double)(trans ? ab[(size_t)j * k + i] : ab[(size_t)i * k + j]) * xb[j];
+      double d = ref - y[(size_t)b * rows + i];
+      diff += d * d;
+      norm += ref * ref;
+    }
+  }
+  return sqrt(diff / norm);
+}
+
+// host_gemm against the reference, for when there is no OpenCL platform or
+// CLRT_BACKEND=host
+int run_host(const float *h_a, const float *h_b, float *h_c, const float *h_ref, int n) {
+  thread_pool pool;
+  int threads = pool_init(&pool, 0);
+  printf("Host backend, %d thread%s\n", threads, threads == 1 ? "" : "s");
+
+  // Warm-up call, then REPS timed ones
+  host_gemm(&pool, h_a, h_b, h_c, n, n, n);
+  double rtime = wtime();
+  for (int r = 0; r < REPS; r++)
+    host_gemm(&pool, h_a, h_b, h_c, n, n, n);
+  rtime = (wtime() - rtime) / REPS;
 
+  int correct = test_results((float *)h_ref, h_c, n);
+  printf("\nN = %d, %d calls\n", n, REPS);
+  printf("%-10s %12lf %10.2f  %d/%d correct  [%dx%d tiles, %dx%d micro-kernel]\n", "host_gemm", rtime,
+    2.0 * n * n * n / rtime * 1e-9, correct, n * n, HOST_TILE, HOST_TILE, HOST_MR, HOST_NR);
+
+  pool_release(&pool);
+  return (correct == n * n) ? 0 : EXIT_FAILURE;
+}
 
 int main(int argc, char** argv) { 
   int err;
-  int size = N*N;
-  const char *kernel_source = load_kernel("kernel.cl");
+  int n = (argc > 1) ? atoi(argv[1]) : N;
+  int cutoff = (argc > 2) ? atoi(argv[2]) : STRASSEN_CUTOFF;
+  int size = n*n;
 
   float* h_a = (float *) calloc(size, sizeof(float));
   float* h_b = (float *) calloc(size, sizeof(float));
   float* h_c = (float *) calloc(size, sizeof(float));
+  float* h_ref = (float *) calloc(size, sizeof(float));
 
-  //size_t global; 
   cl_device_id device_id;
   cl_context context;
   cl_command_queue commands;
-  cl_program program;
-  cl_kernel ko_mmul;
 
   cl_mem d_a;
   cl_mem d_b;
   cl_mem d_c;
 
-  srand(42);
-
-  // Fill in matrices
+  // Fill in matrices, A and B from consecutive ranges of one stream
   int i;
   int count = size;
-  for (i = 0; i < count; i++) {
-    h_a[i] = rand() / (float)RAND_MAX;
-    h_b[i] = rand() / (float)RAND_MAX;
+  rng_uniform_host(h_a, count, RNG_SEED, 0);
+  rng_uniform_host(h_b, count, RNG_SEED, count);
+
+  TRACE("verify", "sequential_mat_mul", sequential_mat_mul(h_a, h_b, h_ref, n));
+
+  if (clrt_select_backend() == CLRT_HOST) {
+    err = run_host(h_a, h_b, h_c, h_ref, n);
+    free(h_a);
+    free(h_b);
+    free(h_c);
+    free(h_ref);
+    return err;
   }
-  
-
-  sequential_mat_mul(h_a, h_b, h_c, N);
-  printf("Sequential C\n");
-  print_mat(h_c, N);
-  
 
   // Set up platform and GPU device
+  TRACE_BEGIN("setup", "platform and device");
   cl_uint numPlatforms;
   err = clGetPlatformIDs(0, NULL, &numPlatforms);
   checkError(err, "Finding platforms");
@@ -112,105 +221,622 @@ int main(int argc, char** argv) {
   err = output_device_info(device_id);
   checkError(err, "Finding device output");
 
+  // Tile size from the device rather than hand tuned per box
+  device_caps caps;
+  err = query_device_caps(device_id, &caps);
+  checkError(err, "Querying device capabilities");
+  int tile = caps_gemm_tile(&caps);
+
   context = clCreateContext(0, 1, &device_id, NULL, NULL, &err);
   checkError(err, "Creating context");
 
-  commands = clCreateCommandQueue(context, device_id, 0, &err);
+  commands = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
   checkError(err, "Creating command queue");
 
-
-  //load_kernel("kernel.cl", &kernel_source);
-
-  program = clCreateProgramWithSource(context, 1, (const char**) &kernel_source, NULL, &err);
-  checkError(err, "Creating program");
-
-  // Build the program
-  err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-  if (err != CL_SUCCESS) {
-    size_t len;
-    char buffer[2048];
-
-    printf("Error: Failed to build program executablen\n%s\n", err_code(err));
-    clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
-    printf("%s\n", buffer);
-    return EXIT_FAILURE;
-  }
-
-  ko_mmul = clCreateKernel(program, "mmul", &err);
-  checkError(err, "Creating kernel");
+  TRACE_END();
 
   // Create the input and output arrays in device memory
+  TRACE_BEGIN("alloc", "device buffers");
   d_a = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float) *count, NULL, &err);
   checkError(err, "Creating buffer d_a");
   d_b = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float) *count, NULL, &err);
   checkError(err, "Creating buffer d_b");
-  d_c = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(float) *count, NULL, &err);
+  d_c = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) *count, NULL, &err);
   checkError(err, "Creating buffer d_c");
-
-  // Write vectors into compute device memory
-  err = clEnqueueWriteBuffer(commands, d_a, CL_TRUE, 0, sizeof(float) *count, h_a, 0, NULL, NULL);
+  TRACE_END();
+
+  // Write matrices into compute device memory, once with blocking writes
+  // from the host arrays for comparison and once through the pinned ring.
+  // Every later read of C goes through the ring.
+  size_t bytes = sizeof(float) * count;
+  cl_event ev[2];
+  double t_page = wtime();
+  err = clEnqueueWriteBuffer(commands, d_a, CL_TRUE, 0, bytes, h_a, 0, NULL, &ev[0]);
   checkError(err, "Copying h_a to device at d_a");
-  err = clEnqueueWriteBuffer(commands, d_b, CL_TRUE, 0, sizeof(float) *count, h_b, 0, NULL, NULL);
+  err = clEnqueueWriteBuffer(commands, d_b, CL_TRUE, 0, bytes, h_b, 0, NULL, &ev[1]);
   checkError(err, "Copying h_b to device at d_b");
-  
+  t_page = wtime() - t_page;
+  double dev_page = event_seconds(ev[0]) + event_seconds(ev[1]);
+  TRACE_EVENT("transfer", "pageable write", ev[0]);
+  TRACE_EVENT("transfer", "pageable write", ev[1]);
+  clReleaseEvent(ev[0]);
+  clReleaseEvent(ev[1]);
+
+  staging_ring ring;
+  err = staging_init(&ring, context, commands, 0);
+  checkError(err, "Creating staging buffers");
+  double t_staged = wtime();
+  err = staging_write(&ring, d_a, 0, h_a, bytes);
+  checkError(err, "Staging h_a to device at d_a");
+  err = staging_write(&ring, d_b, 0, h_b, bytes);
+  checkError(err, "Staging h_b to device at d_b");
+  err = staging_finish(&ring);
+  checkError(err, "Waiting for staged writes");
+  t_staged = wtime() - t_staged;
+
+  // Kernel variants: generic (N at runtime), N compiled in, and the fully
+  // specialised tiled kernel, which falls back to generic for odd sizes
+  kernel_spec generic = {0};
+  kernel_spec fixed_n = {0};
+  fixed_n.n = n;
+  kernel_spec tiled = choose_mmul_spec(n, tile);
+
+  const size_t local_work_size[2] = {tile, tile};
+  struct {
+    const char *label;
+    kernel_spec *spec;
+    const char *name;
+    const size_t *local;
+  } variants[] = {
+    {"generic",   &generic, "mmul",       NULL},
+    {"N fixed",   &fixed_n, "mmul",       NULL},
+    {"N+TILE",    &tiled,   tiled.tile ? "mmul_tiled" : "mmul", tiled.tile ? local_work_size : NULL},
+  };
+  int num_variants = sizeof(variants) / sizeof(variants[0]);
+
+  printf("\nN = %d, tile %d, %d launches per variant\n", n, tile, REPS);
+  printf("%-10s %12s %10s %10s\n", "variant", "seconds", "GFLOPS", "speedup");
+
+  int failures = 0;
+  double base_time = 0.0;
+  double std_time = 0.0;
+  for (int v = 0; v < num_variants; v++) {
+    char options[256];
+    spec_options(variants[v].spec, options, sizeof(options));
+
+    cl_kernel ko_mmul = get_kernel(context, device_id, "kernel.cl", variants[v].name, variants[v].spec, &err);
+    checkError(err, "Creating kernel");
+
+    double rtime = time_mmul(commands, ko_mmul, d_a, d_b, d_c, n, variants[v].local);
+    if (v == 0)
+      base_time = rtime;
+    std_time = rtime;
+
+    // Read back the results from compute device
+    zero_mat(h_c, n);
+    err = staging_read(&ring, d_c, 0, h_c, bytes);
+    if (err != CL_SUCCESS) {
+      printf("Error: failed to read output array!\n%s\n", err_code(err));
+      exit(1);
+    }
 
-  int dim = N;
-  // Set the arguments to our compute kernel
-  err = clSetKernelArg(ko_mmul, 0, sizeof(cl_mem), &d_a);
-  err |= clSetKernelArg(ko_mmul, 1, sizeof(cl_mem), &d_b);
-  err |= clSetKernelArg(ko_mmul, 2, sizeof(cl_mem), &d_c);
-  err |= clSetKernelArg(ko_mmul, 3, sizeof(int), &dim);
-  checkError(err, "Setting kernel arguments");
+    int correct = test_results(h_ref, h_c, n);
+    failures += (correct != count);
+    printf("%-10s %12lf %10.2f %9.2fx  %d/%d correct  [%s]\n", variants[v].label, rtime,
+      2.0 * n * n * n / rtime * 1e-9, base_time / rtime, correct, count, variants[v].name);
+    if (options[0])
+      printf("%-10s %s\n", "", options);
 
-  double rtime = wtime();
-  
-  // Execute the kernel
-  const size_t global_work_size[2] = {N, N};
-  //const size_t local_work_size[2] = {16, 16};
-  //global = count;
-  err = clEnqueueNDRangeKernel(
-    commands, ko_mmul, 
-    2, NULL, 
-    global_work_size, NULL, 
-    0, NULL, NULL);
-  checkError(err, "Enqueueing kernel"); 
+    clReleaseKernel(ko_mmul);
+  }
 
-  err = clFinish(commands);
-  checkError(err, "Waiting for kernel to finish");
+  // Optional Strassen-Winograd run. Its error is reported against the last
+  // (standard tiled) variant and the host reference so the speedup can be
+  // weighed against the extra rounding error of the recursive additions.
+  if (cutoff > 0) {
+    float* h_std = (float *) calloc(size, sizeof(float));
+    for (i = 0; i < count; i++)
+      h_std[i] = h_c[i];
+
+    strassen_ws ws;
+    err = strassen_init(&ws, context, device_id, n, cutoff, tile);
+    checkError(err, "Creating Strassen workspace");
+
+    err = strassen_mmul(&ws, commands, d_a, d_b, d_c);
+    checkError(err, "Enqueueing Strassen");
+    err = clFinish(commands);
+    checkError(err, "Waiting for Strassen to finish");
+
+    double rtime = wtime();
+    for (int r = 0; r < REPS; r++) {
+      err = strassen_mmul(&ws, commands, d_a, d_b, d_c);
+      checkError(err, "Enqueueing Strassen");
+    }
+    err = clFinish(commands);
+    checkError(err, "Waiting for Strassen to finish");
+    rtime = (wtime() - rtime) / REPS;
+
+    err = staging_read(&ring, d_c, 0, h_c, bytes);
+    checkError(err, "Reading Strassen result");
 
-  rtime = wtime() - rtime;
-  printf("\nThe kernel ran in %lf seconds\n", rtime);
+    printf("%-10s %12lf %10.2f %9.2fx  %d levels, cutoff %d, %.2fx vs standard\n", "strassen", rtime,
+      2.0 * n * n * n / rtime * 1e-9, base_time / rtime, ws.levels, cutoff, std_time / rtime);
+    printf("%-10s standard: rel err %.3e max abs %.3e\n", "", rel_error(h_ref, h_std, n), max_abs_error(h_ref, h_std, n));
+    printf("%-10s strassen: rel err %.3e max abs %.3e (%.3e vs standard)\n", "", rel_error(h_ref, h_c, n),
+      max_abs_error(h_ref, h_c, n), rel_error(h_std, h_c, n));
 
-  // Read back the results from compute device
-  err = clEnqueueReadBuffer(commands, d_c, CL_TRUE, 0, sizeof(float) *count, h_c, 0, NULL, NULL);
-  if (err != CL_SUCCESS) {
-    printf("Error: failed to read output array!\n%s\n", err_code(err));
-    exit(1);
+    strassen_release(&ws);
+    free(h_std);
   }
-  
-  printf("A:\n");
-  print_mat(h_a, N);
-  printf("B:\n");
-  print_mat(h_b, N);
-  printf("C:\n");
-  print_mat(h_c, N);
-  
-  //printf("C = A*B: %d out of %d results were correct", test_results(h_a, h_b, h_c, count), count);
+
+  // Fused epilogue on the tiled (or fallback) kernel, c = gelu(alpha*a*b + bias) + residual
+  // is stored in one pass so the cost over the standard kernel should be small
+  {
+    epilogue_spec epi = {1, 1, ACT_GELU, 1};
+    float alpha = 0.5f;
+    float* h_bias = (float *) calloc(n, sizeof(float));
+    float* h_res = (float *) calloc(size, sizeof(float));
+    float* h_epi = (float *) calloc(size, sizeof(float));
+    // Bias in [-0.5, 0.5), residual in [0, 1), from streams of their own
+    rng_uniform_host(h_bias, n, RNG_SEED + 3, 0);
+    for (i = 0; i < n; i++)
+      h_bias[i] -= 0.5f;
+    rng_uniform_host(h_res, count, RNG_SEED + 4, 0);
+    for (i = 0; i < count; i++)
+      h_epi[i] = h_ref[i];
+    sequential_epilogue(h_epi, h_bias, h_res, alpha, &epi, n);
+
+    cl_mem d_bias = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * n, h_bias, &err);
+    checkError(err, "Creating buffer d_bias");
+    cl_mem d_res = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * count, h_res, &err);
+    checkError(err, "Creating buffer d_res");
+
+    char defines[256];
+    epilogue_defines(&epi, defines, sizeof(defines));
+    kernel_spec fused = tiled;
+    fused.defines = defines;
+
+    cl_kernel ko_fused = get_kernel(context, device_id, "kernel.cl", tiled.tile ? "mmul_tiled" : "mmul", &fused, &err);
+    checkError(err, "Creating fused kernel");
+    err = set_epilogue_args(ko_fused, 4, d_bias, d_res, alpha, sizeof(float));
+    checkError(err, "Setting epilogue arguments");
+
+    double rtime = time_mmul(commands, ko_fused, d_a, d_b, d_c, n, tiled.tile ? local_work_size : NULL);
+
+    err = staging_read(&ring, d_c, 0, h_c, bytes);
+    checkError(err, "Reading fused result");
+
+    double rel = rel_error(h_epi, h_c, n);
+    failures += !(rel < TOL);
+    printf("%-10s %12lf %10.2f %9.2fx  %s+bias+residual, %.2fx vs standard, rel err %.3e%s\n", "fused", rtime,
+      2.0 * n * n * n / rtime * 1e-9, base_time / rtime, act_name(epi.act), std_time / rtime, rel,
+      rel < TOL ? "" : "  MISMATCH");
+
+    clReleaseKernel(ko_fused);
+    clReleaseMemObject(d_bias);
+    clReleaseMemObject(d_res);
+    free(h_bias);
+    free(h_res);
+    free(h_epi);
+  }
+
+  // GEMM driver with B handed over row-major, transposed and packed into
+  // panels. The relayout runs on every call and is included in the time.
+  {
+    gemm_ctx g;
+    err = gemm_init(&g, context, device_id, tile);
+    checkError(err, "Creating GEMM driver");
+    int auto_layout = plan_gemm(n, tile, &g.caps, B_AUTO).b_layout;
+    int layouts[] = {B_ROW_MAJOR, B_TRANSPOSED, B_PANELS};
+
+    for (int l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+      g.b_layout = layouts[l];
+      err = gemm(&g, commands, d_a, d_b, d_c, n);
+      checkError(err, "Enqueueing GEMM");
+      err = clFinish(commands);
+      checkError(err, "Waiting for GEMM to finish");
+
+      double rtime = wtime();
+      for (int r = 0; r < REPS; r++) {
+        err = gemm(&g, commands, d_a, d_b, d_c, n);
+        checkError(err, "Enqueueing GEMM");
+      }
+      err = clFinish(commands);
+      checkError(err, "Waiting for GEMM to finish");
+      rtime = (wtime() - rtime) / REPS;
+
+      err = staging_read(&ring, d_c, 0, h_c, bytes);
+      checkError(err, "Reading GEMM result");
+
+      int correct = test_results(h_ref, h_c, n);
+      failures += (correct != count);
+      printf("%-10s %12lf %10.2f %9.2fx  %d/%d correct  [%s, B %s]%s\n", "gemm", rtime,
+        2.0 * n * n * n / rtime * 1e-9, base_time / rtime, correct, count,
+        g.plan.kernel, b_layout_name(g.plan.b_layout), layouts[l] == auto_layout ? " auto" : "");
+    }
+
+    // Transpose bandwidth, counting one read and one write per element
+    double t_out = wtime();
+    for (int r = 0; r < REPS; r++) {
+      err = layout_transpose(commands, &g.layout, d_a, d_c, n, n);
+      checkError(err, "Enqueueing transpose");
+    }
+    err = clFinish(commands);
+    checkError(err, "Waiting for transpose to finish");
+    t_out = (wtime() - t_out) / REPS;
+
+    err = staging_read(&ring, d_c, 0, h_c, bytes);
+    checkError(err, "Reading transpose result");
+    int correct = 0;
+    for (i = 0; i < count; i++) {
+      if (h_c[(i % n) * n + i / n] == h_a[i])
+        correct++;
+    }
+
+    // An even number of in-place transposes leaves d_c as it was
+    double t_in = wtime();
+    for (int r = 0; r < 2 * (REPS / 2); r++) {
+      err = layout_transpose_inplace(commands, &g.layout, d_c, n);
+      checkError(err, "Enqueueing in-place transpose");
+    }
+    err = clFinish(commands);
+    checkError(err, "Waiting for transpose to finish");
+    t_in = (wtime() - t_in) / (2 * (REPS / 2));
+
+    failures += (correct != count);
+    printf("%-10s %12lf %9.2f GB/s  %d/%d correct\n", "transpose", t_out, 2.0 * sizeof(float) * count / t_out * 1e-9, correct, count);
+
+    // One more in-place transpose takes d_c back to a
+    err = layout_transpose_inplace(commands, &g.layout, d_c, n);
+    checkError(err, "Enqueueing in-place transpose");
+    err = staging_read(&ring, d_c, 0, h_c, bytes);
+    checkError(err, "Reading in-place transpose result");
+    correct = 0;
+    for (i = 0; i < count; i++)
+      correct += (h_c[i] == h_a[i]);
+    failures += (correct != count);
+    printf("%-10s %12lf %9.2f GB/s  in place, %d/%d round trip\n", "", t_in, 2.0 * sizeof(float) * count / t_in * 1e-9,
+      correct, count);
+
+    // Round trips through the other converters: the first rows x cols of a
+    // to column-major and back, which a swapped dimension would scramble,
+    // and into panels and back
+    cl_mem d_t = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    checkError(err, "Creating buffer d_t");
+    int rows = n, cols = n - n / 4;
+    err = layout_row_to_col(commands, &g.layout, d_a, d_c, rows, cols);
+    err |= layout_col_to_row(commands, &g.layout, d_c, d_t, rows, cols);
+    checkError(err, "Enqueueing column-major round trip");
+    err = staging_read(&ring, d_t, 0, h_c, sizeof(float) * rows * cols);
+    checkError(err, "Reading column-major round trip");
+    correct = 0;
+    for (i = 0; i < rows * cols; i++)
+      correct += (h_c[i] == h_a[i]);
+    failures += (correct != rows * cols);
+    printf("%-10s %12s %14s  %d/%d round trip, %dx%d\n", "col-major", "", "", correct, rows * cols, rows, cols);
+
+    if (n % g.layout.panel == 0) {
+      err = layout_pack_panels(commands, &g.layout, d_a, d_c, n, n);
+      err |= layout_unpack_panels(commands, &g.layout, d_c, d_t, n, n);
+      checkError(err, "Enqueueing panel round trip");
+      err = staging_read(&ring, d_t, 0, h_c, bytes);
+      checkError(err, "Reading panel round trip");
+      correct = 0;
+      for (i = 0; i < count; i++)
+        correct += (h_c[i] == h_a[i]);
+      failures += (correct != count);
+      printf("%-10s %12s %14s  %d/%d round trip, width %d\n", "panels", "", "", correct, count, g.layout.panel);
+    }
+    clReleaseMemObject(d_t);
+
+    // Small output, long K: one work-item per element leaves most compute
+    // units idle unless K is split across work-groups
+    int sm = SPLITK_MN, sk = SPLITK_MN * n;
+    // The operands are generated in place on the device, the host only
+    // regenerates them for the reference
+    float* h_sa = (float *) calloc((size_t)sm * sk, sizeof(float));
+    float* h_sb = (float *) calloc((size_t)sk * sm, sizeof(float));
+    float* h_sc = (float *) calloc(sm * sm, sizeof(float));
+    float* h_sref = (float *) calloc(sm * sm, sizeof(float));
+    rng_uniform_host(h_sa, (size_t)sm * sk, RNG_SEED + 1, 0);
+    rng_uniform_host(h_sb, (size_t)sk * sm, RNG_SEED + 2, 0);
+    TRACE("verify", "sequential_gemm", sequential_gemm(h_sa, h_sb, h_sref, sm, sm, sk));
+
+    cl_mem d_sa = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * sm * sk, NULL, &err);
+    checkError(err, "Creating buffer d_sa");
+    cl_mem d_sb = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * sk * sm, NULL, &err);
+    checkError(err, "Creating buffer d_sb");
+    cl_mem d_sc = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * sm * sm, NULL, &err);
+    checkError(err, "Creating buffer d_sc");
+    rng_ctx rng;
+    err = rng_init(&rng, context, device_id);
+    checkError(err, "Creating RNG kernels");
+    err = rng_uniform(&rng, commands, d_sa, sm * sk, RNG_SEED + 1, 0);
+    checkError(err, "Generating d_sa");
+    err = rng_uniform(&rng, commands, d_sb, sk * sm, RNG_SEED + 2, 0);
+    checkError(err, "Generating d_sb");
+
+    // Normal fill: the device must match rng_normal_host element for
+    // element, from an offset inside a Philox block, and the sample must
+    // have mean 0 and variance 1 to within five standard errors
+    {
+      float* h_norm = (float *) calloc(sm * sk, sizeof(float));
+      float* h_nref = (float *) calloc(sm * sk, sizeof(float));
+      rng_normal_host(h_nref, (size_t)sm * sk, RNG_SEED + 5, 3, 0.0f, 1.0f);
+      err = rng_normal(&rng, commands, d_sa, sm * sk, RNG_SEED + 5, 3, 0.0f, 1.0f);
+      checkError(err, "Generating normal fill");
+      err = staging_read(&ring, d_sa, 0, h_norm, sizeof(float) * sm * sk);
+      checkError(err, "Reading normal fill");
+
+      double diff = 0.0, mean = 0.0, var = 0.0;
+      size_t ncount = (size_t)sm * sk;
+      for (size_t e = 0; e < ncount; e++) {
+        diff = fmax(diff, fabs(h_norm[e] - h_nref[e]) / (1.0 + fabs(h_nref[e])));
+        mean += h_norm[e];
+      }
+      mean /= ncount;
+      for (size_t e = 0; e < ncount; e++)
+        var += (h_norm[e] - mean) * (h_norm[e] - mean);
+      var /= ncount - 1;
+      int ok = diff <= TOL && fabs(mean) <= 5.0 / sqrt(ncount) && fabs(var - 1.0) <= 5.0 * sqrt(2.0 / ncount);
+      failures += !ok;
+      printf("%-10s %12s %14s  %zu samples, mean %.4f var %.4f, host diff %.1e\n", "rng_normal", "", "",
+        ncount, mean, var, diff);
+      free(h_norm);
+      free(h_nref);
+
+      // The split-K run below wants its uniform a back
+      err = rng_uniform(&rng, commands, d_sa, sm * sk, RNG_SEED + 1, 0);
+      checkError(err, "Generating d_sa");
+    }
+    rng_release(&rng);
+
+    double unsplit_time = 0.0;
+    int forced[] = {1, 0};
+    for (int f = 0; f < 2; f++) {
+      g.split_k = forced[f];
+      err = gemm_mnk(&g, commands, d_sa, d_sb, d_sc, sm, sm, sk);
+      checkError(err, "Enqueueing split-K GEMM");
+      err = clFinish(commands);
+      checkError(err, "Waiting for split-K GEMM to finish");
+
+      double rtime = wtime();
+      for (int r = 0; r < REPS; r++) {
+        err = gemm_mnk(&g, commands, d_sa, d_sb, d_sc, sm, sm, sk);
+        checkError(err, "Enqueueing split-K GEMM");
+      }
+      err = clFinish(commands);
+      checkError(err, "Waiting for split-K GEMM to finish");
+      rtime = (wtime() - rtime) / REPS;
+      if (f == 0)
+        unsplit_time = rtime;
+
+      err = staging_read(&ring, d_sc, 0, h_sc, sizeof(float) * sm * sm);
+      checkError(err, "Reading split-K result");
+
+      double rel = rel_error(h_sref, h_sc, sm);
+      failures += (rel > TOL);
+      printf("%-10s %12lf %10.2f %9.2fx  %dx%dx%d, %d K slices%s, rel err %.3e\n", "split-K", rtime,
+        2.0 * sm * sm * sk / rtime * 1e-9, unsplit_time / rtime, sm, sm, sk, g.splits,
+        forced[f] ? "" : " auto", rel);
+    }
+
+    clReleaseMemObject(d_sa);
+    clReleaseMemObject(d_sb);
+    clReleaseMemObject(d_sc);
+    free(h_sa);
+    free(h_sb);
+    free(h_sc);
+    free(h_sref);
+
+    // GEMV on A, with rows of B as the vectors, bandwidth counting a, x and y
+    int bm = n / GEMV_BATCH;
+    struct {
+      const char *label;
+      int trans, m, batch;
+    } shapes[] = {{"gemv", 0, n, 1}, {"gemv^T", 1, n, 1}, {"batched", 0, bm, GEMV_BATCH}, {"batched^T", 1, bm, GEMV_BATCH}};
+    float* h_y = (float *) calloc((size_t)GEMV_BATCH * n, sizeof(float));
+    cl_mem d_x = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * n, h_b, &err);
+    checkError(err, "Creating buffer d_x");
+    cl_mem d_y = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * GEMV_BATCH * n, NULL, &err);
+    checkError(err, "Creating buffer d_y");
+    for (int s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+      int m = shapes[s].m, batch = shapes[s].batch, trans = shapes[s].trans;
+      if (m == 0)
+        continue;
+      // x for a batch is rows of B, up to GEMV_BATCH * n floats
+      cl_mem x = (batch > 1) ? d_b : d_x;
+      err = run_gemv(&g, commands, trans, d_a, x, d_y, m, n, batch);
+      checkError(err, "Enqueueing GEMV");
+      err = clFinish(commands);
+      checkError(err, "Waiting for GEMV to finish");
+
+      double rtime = wtime();
+      for (int r = 0; r < REPS; r++) {
+        err = run_gemv(&g, commands, trans, d_a, x, d_y, m, n, batch);
+        checkError(err, "Enqueueing GEMV");
+      }
+      err = clFinish(commands);
+      checkError(err, "Waiting for GEMV to finish");
+      rtime = (wtime() - rtime) / REPS;
+
+      size_t out = (size_t)batch * (trans ? n : m), in = (size_t)batch * (trans ? m : n);
+      err = staging_read(&ring, d_y, 0, h_y, sizeof(float) * out);
+      checkError(err, "Reading GEMV result");
+      double rel = gemv_error(h_a, h_b, h_y, trans, m, n, batch);
+      failures += !(rel < TOL);
+      double gemv_bytes = sizeof(float) * ((double)batch * m * n + in + out);
+      printf("%-10s %12lf %9.2f GB/s  %dx%d x%d, rel err %.3e\n", shapes[s].label, rtime, gemv_bytes / rtime * 1e-9,
+        m, n, batch, rel);
+    }
+    clReleaseMemObject(d_x);
+    clReleaseMemObject(d_y);
+    free(h_y);
+
+    // Service loop: every request brings a new A against the same B. Uncached,
+    // B is uploaded and relaid out per call; cached, only the first call does
+    // either, by content hash and then by a caller handle.
+    g.b_layout = B_AUTO;
+    operand_cache oc;
+    opcache_init(&oc, context, 0);
+    const char *modes[] = {"uncached", "cached", "by handle"};
+    for (int mode = 0; mode < 3; mode++) {
+      double rtime = wtime();
+      for (int r = 0; r < SERVE_CALLS; r++) {
+        err = staging_write(&ring, d_a, 0, h_a, bytes);
+        checkError(err, "Staging h_a to device at d_a");
+        if (mode == 0) {
+          err = staging_write(&ring, d_b, 0, h_b, bytes);
+          checkError(err, "Staging h_b to device at d_b");
+          err = gemm(&g, commands, d_a, d_b, d_c, n);
+        } else {
+          err = gemm_cached(&g, commands, &oc, d_a, h_b, mode == 2 ? 1 : 0, 1, d_c, n);
+        }
+        checkError(err, "Enqueueing GEMM");
+        err = staging_read(&ring, d_c, 0, h_c, bytes);
+        checkError(err, "Reading GEMM result");
+      }
+      rtime = (wtime() - rtime) / SERVE_CALLS;
+
+      int correct = test_results(h_ref, h_c, n);
+      failures += (correct != count);
+      printf("%-10s %12lf %10.2f %9.2fx  %d/%d correct  [%s, B %s]", "serve", rtime,
+        2.0 * n * n * n / rtime * 1e-9, base_time / rtime, correct, count, modes[mode], b_layout_name(g.plan.b_layout));
+      if (mode > 0)
+        printf(" %lu hits %lu misses %lu evictions", oc.hits, oc.misses, oc.evictions);
+      printf("\n");
+    }
+    opcache_release(&oc);
+
+    gemm_release(&g);
+  }
+
+  // Double precision GEMM, vadd and sum against host double references, at
+  // tolerances fp32 can't meet: native fp64 when the device has it,
+  // float-float always
+  {
+    size_t count = (size_t)n * n;
+    double *h_da = (double *) malloc(sizeof(double) * count);
+    double *h_db = (double *) malloc(sizeof(double) * count);
+    double *h_dc = (double *) malloc(sizeof(double) * count);
+    double *h_dref = (double *) malloc(sizeof(double) * count);
+    rng_uniform_host_double(h_da, count, RNG_SEED, 0);
+    rng_uniform_host_double(h_db, count, RNG_SEED, count);
+    sequential_dgemm(h_da, h_db, h_dref, n, n, n);
+    long double dsum_ref = 0.0L;
+    for (size_t e = 0; e < count; e++)
+      dsum_ref += h_da[e];
+    cl_mem d_da = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(double) * count, NULL, &err);
+    checkError(err, "Creating buffer d_da");
+    cl_mem d_db = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(double) * count, NULL, &err);
+    checkError(err, "Creating buffer d_db");
+    cl_mem d_dc = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(double) * count, NULL, &err);
+    checkError(err, "Creating buffer d_dc");
+
+    int modes[] = {FP64_NATIVE, FP64_EMULATED};
+    for (int m = 0; m < 2; m++) {
+      fp64_ctx d;
+      err = fp64_init(&d, context, device_id, &caps, modes[m]);
+      if (err == CL_INVALID_DEVICE && modes[m] == FP64_NATIVE) {
+        printf("%-10s no cl_khr_fp64\n", fp64_mode_name(modes[m]));
+        continue;
+      }
+      checkError(err, "Creating fp64 kernels");
+      err = fp64_write(&d, commands, d_da, h_da, count);
+      err |= fp64_write(&d, commands, d_db, h_db, count);
+      checkError(err, "Writing double operands");
+      err = fp64_gemm(&d, commands, d_da, d_db, d_dc, n);
+      checkError(err, "Enqueueing double GEMM");
+      err = clFinish(commands);
+      checkError(err, "Waiting for double GEMM to finish");
+
+      double rtime = wtime();
+      for (int r = 0; r < REPS; r++) {
+        err = fp64_gemm(&d, commands, d_da, d_db, d_dc, n);
+        checkError(err, "Enqueueing double GEMM");
+      }
+      err = clFinish(commands);
+      checkError(err, "Waiting for double GEMM to finish");
+      rtime = (wtime() - rtime) / REPS;
+
+      err = fp64_read(&d, commands, d_dc, h_dc, count);
+      checkError(err, "Reading double GEMM result");
+      double diff = 0.0, norm = 0.0;
+      for (size_t e = 0; e < count; e++) {
+        diff += (h_dref[e] - h_dc[e]) * (h_dref[e] - h_dc[e]);
+        norm += h_dref[e] * h_dref[e];
+      }
+      double rel = sqrt(diff / norm);
+      failures += !(rel < DTOL);
+      printf("%-10s %12lf %10.2f %9.2fx  rel err %.3e\n", fp64_mode_name(modes[m]), rtime,
+        2.0 * n * n * n / rtime * 1e-9, base_time / rtime, rel);
+
+      err = fp64_add(&d, commands, d_da, d_db, d_dc, count);
+      checkError(err, "Enqueueing double vadd");
+      err = fp64_read(&d, commands, d_dc, h_dc, count);
+      checkError(err, "Reading double vadd result");
+      diff = norm = 0.0;
+      for (size_t e = 0; e < count; e++) {
+        double want = h_da[e] + h_db[e];
+        diff += (want - h_dc[e]) * (want - h_dc[e]);
+        norm += want * want;
+      }
+      double rel_add = sqrt(diff / norm);
+      double dsum;
+      err = fp64_sum(&d, commands, d_da, count, &dsum);
+      checkError(err, "Double sum");
+      double rel_sum = fabs(dsum - (double)dsum_ref) / fabs((double)dsum_ref);
+      failures += !(rel_add < DTOL) + !(rel_sum < DSUM_TOL);
+      printf("%-10s %12s %14s  vadd rel err %.3e, sum rel err %.3e\n", "", "", "", rel_add, rel_sum);
+      fp64_release(&d);
+    }
+
+    clReleaseMemObject(d_da);
+    clReleaseMemObject(d_db);
+    clReleaseMemObject(d_dc);
+    free(h_da);
+    free(h_db);
+    free(h_dc);
+    free(h_dref);
+  }
+
+  // Transfer breakdown: a blocking read of C into pageable memory against
+  // one through the ring
+  {
+    double t_read = wtime();
+    err = clEnqueueReadBuffer(commands, d_c, CL_TRUE, 0, bytes, h_c, 0, NULL, &ev[0]);
+    checkError(err, "Reading C from pageable memory");
+    t_read = wtime() - t_read;
+
+    printf("\n");
+    print_transfer("write a,b pageable", 2 * bytes, t_page, dev_page);
+    print_transfer("write a,b staged", 2 * bytes, t_staged, ring.write_secs);
+    print_transfer("read c pageable", bytes, t_read, event_seconds(ev[0]));
+    TRACE_EVENT("transfer", "pageable read", ev[0]);
+    clReleaseEvent(ev[0]);
+
+    ring.read_secs = 0.0;
+    t_read = wtime();
+    err = staging_read(&ring, d_c, 0, h_c, bytes);
+    checkError(err, "Reading C through staging buffers");
+    t_read = wtime() - t_read;
+    print_transfer("read c staged", bytes, t_read, ring.read_secs);
+  }
+  staging_release(&ring);
+
+  TRACE_DUMP(getenv("TRACE_FILE") ? getenv("TRACE_FILE") : "matmul.trace.json");
 
   clReleaseMemObject(d_a);
   clReleaseMemObject(d_b);
   clReleaseMemObject(d_c);
-  clReleaseProgram(program);
-  clReleaseKernel(ko_mmul);
+  release_programs();
   clReleaseCommandQueue(commands);
   clReleaseContext(context);
 
   free(h_a);
   free(h_b);
   free(h_c);
+  free(h_ref);
   
-  return 0;
+  return failures ? EXIT_FAILURE : 0;
 }
-
-
-
@@ -0,0 +1,169 @@
+/*
+ * Out-of-core matrix multiplication (c = a * b) from memory-mapped files
+ *
+ *   ooc [n] [budget_mb] [dir]    matrix order (default 2048), device memory
+ *                                budget in MB (default half of global memory)
+ *                                and where the matrix files go (default .)
+ *
+ * A and B are written to files in dir and mapped, C is mapped the same way,
+ * so neither the device nor host RAM has to hold a whole operand. C is
+ * checked at a sample of entries against fp64 dot products.
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/types.h>
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "err_code.h"
+#include "device_info.h"
+#include "kernel_cache.h"
+#include "ooc_gemm.h"
+#include "trace.h"
+
+#ifndef DEVICE
+#define DEVICE CL_DEVICE_TYPE_DEFAULT
+#endif
+
+extern double wtime();
+
+#define N       (2048)  // Default matrix order, override with argv[1]
+#define TOL     (0.0001)
+#define SAMPLES (64)    // Entries of C checked
+
+// Creates path at n x n floats and maps it shared, so stores reach the file
+float* map_matrix(const char *dir, const char *name, int n, char *path, size_t path_size) {
+  size_t bytes = sizeof(float) * n * n;
+  snprintf(path, path_size, "%s/%s", dir, name);
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || ftruncate(fd, bytes) != 0) {
+    perror(path);
+    exit(1);
+  }
+  void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    perror(path);
+    exit(1);
+  }
+  return p;
+}
+
+// Cheap deterministic fill; sequential stores, so dirty pages can be written
+// back as it goes
+void fill_matrix(float *m, int n, unsigned int seed) {
+  for (size_t i = 0; i < (size_t)n * n; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    m[i] = (seed >> 8) * (1.0f / 16777216.0f);
+  }
+}
+
+int main(int argc, char** argv) {
+  int err;
+  int n = (argc > 1) ? atoi(argv[1]) : N;
+  size_t budget = (argc > 2) ? (size_t)(atof(argv[2]) * (1 << 20)) : 0;
+  const char *dir = (argc > 3) ? argv[3] : ".";
+  size_t bytes = sizeof(float) * n * n;
+
+  cl_device_id device_id;
+  cl_context context;
+  cl_command_queue commands;
+
+  char path_a[1024], path_b[1024], path_c[1024];
+  float* h_a = map_matrix(dir, "ooc_a.bin", n, path_a, sizeof(path_a));
+  float* h_b = map_matrix(dir, "ooc_b.bin", n, path_b, sizeof(path_b));
+  float* h_c = map_matrix(dir, "ooc_c.bin", n, path_c, sizeof(path_c));
+  TRACE("setup", "fill", fill_matrix(h_a, n, 1));
+  TRACE("setup", "fill", fill_matrix(h_b, n, 2));
+
+  // Set up platform and GPU device
+  TRACE_BEGIN("setup", "platform and device");
+  cl_uint numPlatforms;
+  err = clGetPlatformIDs(0, NULL, &numPlatforms);
+  checkError(err, "Finding platforms");
+  if (numPlatforms == 0) {
+    printf("Found 0 platforms\n");
+    return EXIT_FAILURE;
+  }
+
+  // Get all platforms
+  cl_platform_id Platform[numPlatforms];
+  err = clGetPlatformIDs(numPlatforms, Platform, NULL);
+  checkError(err, "Getting platforms");
+
+  // Secure a GPU
+  int i;
+  for (i = 0; i < numPlatforms; i++) {
+    err = clGetDeviceIDs(Platform[i], DEVICE, 1, &device_id, NULL);
+    if (err == CL_SUCCESS) {
+      break;
+    }
+  }
+
+  if (device_id == NULL)
+    checkError(err, "Finding a device");
+
+  err = output_device_info(device_id);
+  checkError(err, "Finding device output");
+
+  context = clCreateContext(0, 1, &device_id, NULL, NULL, &err);
+  checkError(err, "Creating context");
+
+  commands = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
+  checkError(err, "Creating command queue");
+  TRACE_END();
+
+  ooc_ctx o;
+  err = ooc_init(&o, context, device_id, budget);
+  checkError(err, "Creating out-of-core GEMM");
+
+  double rtime = wtime();
+  err = ooc_gemm(&o, commands, h_a, h_b, h_c, n);
+  checkError(err, "Running out-of-core GEMM");
+  rtime = wtime() - rtime;
+
+  // Spot check against fp64 dot products
+  srand(42);
+  int failures = 0;
+  double max_rel = 0.0;
+  for (int s = 0; s < SAMPLES; s++) {
+    int r = rand() % n, col = rand() % n;
+    double ref = 0.0;
+    for (int k = 0; k < n; k++)
+      ref += (double)h_a[(size_t)r * n + k] * h_b[(size_t)k * n + col];
+    double rel = fabs(h_c[(size_t)r * n + col] - ref) / fabs(ref);
+    max_rel = fmax(max_rel, rel);
+    failures += (rel > TOL);
+  }
+
+  printf("\nN = %d, %.1f MB per operand, budget %.1f MB\n", n, bytes / 1048576.0, o.budget / 1048576.0);
+  printf("tile %d, K chunk %d, %.1f MB on the device\n", o.plan.tile, o.plan.kb, o.plan.device_bytes / 1048576.0);
+  printf("%-10s %12lf %10.2f GFLOPS\n", "ooc gemm", rtime, 2.0 * n * (double)n * n / rtime * 1e-9);
+  printf("%-10s %.2fx the bytes of A and B uploaded, %.2f GB/s of panels\n", "traffic",
+    o.bytes_in / (2.0 * bytes), o.bytes_in / rtime * 1e-9);
+  printf("%-10s %d/%d sampled entries correct, max rel err %.3e\n", "check", SAMPLES - failures, SAMPLES, max_rel);
+
+  TRACE_DUMP(getenv("TRACE_FILE") ? getenv("TRACE_FILE") : "ooc.trace.json");
+
+  ooc_release(&o);
+  release_programs();
+  clReleaseCommandQueue(commands);
+  clReleaseContext(context);
+
+  munmap(h_a, bytes);
+  munmap(h_b, bytes);
+  munmap(h_c, bytes);
+  unlink(path_a);
+  unlink(path_b);
+  unlink(path_c);
+
+  return failures ? EXIT_FAILURE : 0;
+}
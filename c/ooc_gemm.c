@@ -0,0 +1,287 @@
+/*
+ * Out-of-core tiled GEMM (c = a * b) for matrices bigger than the device
+ *
+ * C is computed one tile at a time from a row panel of A and a column panel
+ * of B. While the device multiplies, the host already gathers the next
+ * panel out of the (file-backed) matrix into the pinned staging ring, with
+ * the pages after it read ahead by the kernel, and the upload queue copies
+ * it into the spare B buffer. C tiles go straight back into the host matrix.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "ooc_gemm.h"
+#include "trace.h"
+
+// Device bytes of a tile x kb plan: A panel, two B panels, the C tile, the
+// GEMM driver's relayout scratch and, when K is split, the partial product
+static size_t footprint(int n, int tile, int kb) {
+  size_t floats = (size_t)tile * kb * 3 + (size_t)tile * tile * 2;
+  if (kb < n)
+    floats += (size_t)tile * tile;
+  return floats * sizeof(float);
+}
+
+// Panel traffic is about n^3 / tile when whole-K panels let an A panel serve
+// a full row of tiles and 2 n^3 / tile otherwise, so the plan with the
+// largest tile per unit of traffic wins. Chunks shorter than OOC_MIN_KB
+// would spend more time adding partial products than multiplying.
+ooc_plan plan_ooc(int n, size_t budget, cl_ulong max_alloc) {
+  ooc_plan best = {n, 0, 0, 0};
+  int best_score = 0;
+  int min_kb = (n < OOC_MIN_KB) ? n : OOC_MIN_KB;
+  for (int kb = n; kb >= min_kb && kb > 0; kb = (kb / 2) / OOC_ALIGN * OOC_ALIGN) {
+    for (int t = n; t > 0; t = (t > OOC_ALIGN) ? (t - 1) / OOC_ALIGN * OOC_ALIGN : 0) {
+      size_t bytes = footprint(n, t, kb);
+      if (bytes > budget || sizeof(float) * (size_t)t * (t > kb ? t : kb) > max_alloc)
+        continue;
+      int score = (kb == n) ? 2 * t : t;
+      if (score > best_score) {
+        best_score = score;
+        best.tile = t;
+        best.kb = kb;
+        best.device_bytes = bytes;
+      }
+      break;
+    }
+  }
+  return best;
+}
+
+// budget 0 uses 1/OOC_SHARE of the device's global memory
+cl_int ooc_init(ooc_ctx *o, cl_context context, cl_device_id device, size_t budget) {
+  cl_int err;
+  memset(o, 0, sizeof(*o));
+  o->context = context;
+
+  err = gemm_init(&o->gemm, context, device, 0);
+  if (err != CL_SUCCESS)
+    return err;
+  o->gemm.split_k = 1;  // the split-K workspace isn't in the budget
+  o->budget = budget ? budget : o->gemm.caps.global_mem_size / OOC_SHARE;
+
+  err = vec_init(&o->vec, context, device, &o->gemm.caps, 4);
+  if (err != CL_SUCCESS)
+    return err;
+  o->upload = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err);
+  if (err != CL_SUCCESS)
+    return err;
+  return staging_init(&o->ring, context, o->upload, 0);
+}
+
+static void release_buffers(ooc_ctx *o) {
+  cl_mem *bufs[] = {&o->a_panel, &o->b_panel[0], &o->b_panel[1], &o->c_tile, &o->partial};
+  for (int i = 0; i < sizeof(bufs) / sizeof(bufs[0]); i++) {
+    if (*bufs[i])
+      clReleaseMemObject(*bufs[i]);
+    *bufs[i] = NULL;
+  }
+}
+
+static cl_int replan(ooc_ctx *o, int n) {
+  cl_int err;
+  ooc_plan p = plan_ooc(n, o->budget, o->gemm.caps.max_alloc);
+  if (p.tile == 0)
+    return CL_INVALID_BUFFER_SIZE;
+
+  release_buffers(o);
+  o->plan = p;
+  size_t tile_bytes = sizeof(float) * p.tile * p.tile;
+  size_t panel_bytes = sizeof(float) * p.tile * p.kb;
+  o->a_panel = clCreateBuffer(o->context, CL_MEM_READ_ONLY, panel_bytes, NULL, &err);
+  if (err != CL_SUCCESS)
+    return err;
+  for (int i = 0; i < 2; i++) {
+    o->b_panel[i] = clCreateBuffer(o->context, CL_MEM_READ_ONLY, panel_bytes, NULL, &err);
+    if (err != CL_SUCCESS)
+      return err;
+  }
+  o->c_tile = clCreateBuffer(o->context, CL_MEM_READ_WRITE, tile_bytes, NULL, &err);
+  if (err != CL_SUCCESS)
+    return err;
+  if (p.kb < n) {
+    o->partial = clCreateBuffer(o->context, CL_MEM_READ_WRITE, tile_bytes, NULL, &err);
+    if (err != CL_SUCCESS)
+      return err;
+  }
+
+  // A staging slot has to hold at least one panel row
+  size_t row_bytes = sizeof(float) * (p.tile > p.kb ? p.tile : p.kb);
+  if (o->ring.slot_size < row_bytes) {
+    staging_release(&o->ring);
+    err = staging_init(&o->ring, o->context, o->upload, row_bytes);
+  }
+  return err;
+}
+
+// Starts the kernel reading rows x cols of a file-backed matrix in, so the
+// gather after it doesn't stall on the disk
+static void prefetch(const float *src, int rows, int cols, int ld) {
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  if (cols == ld) {
+    cols *= rows;
+    rows = 1;
+  }
+  for (int r = 0; r < rows; r++) {
+    uintptr_t begin = (uintptr_t)(src + (size_t)r * ld) & ~(page - 1);
+    uintptr_t end = (uintptr_t)(src + (size_t)r * ld + cols);
+    posix_madvise((void *)begin, end - begin, POSIX_MADV_WILLNEED);
+  }
+}
+
+// Gathers rows x cols of src (leading dimension ld) into dst on the upload
+// queue once the compute queue is past used, the last command reading dst.
+// ready is set to an event that completes when the panel is on the device.
+static cl_int upload_panel(ooc_ctx *o, cl_mem dst, cl_event used, const float *src, int rows, int cols, int ld, cl_event *ready) {
+  cl_int err;
+  if (used) {
+    err = clEnqueueBarrierWithWaitList(o->upload, 1, &used, NULL);
+    if (err != CL_SUCCESS)
+      return err;
+  }
+
+  size_t row_bytes = sizeof(float) * cols;
+  int chunk = o->ring.slot_size / row_bytes;
+  prefetch(src, chunk < rows ? chunk : rows, cols, ld);
+  for (int r = 0; r < rows; r += chunk) {
+    int nr = (rows - r < chunk) ? rows - r : chunk;
+    if (r + nr < rows)
+      prefetch(src + (size_t)(r + nr) * ld, (rows - r - nr < chunk) ? rows - r - nr : chunk, cols, ld);
+    char *host = staging_acquire(&o->ring, &err);
+    if (host == NULL)
+      return err;
+    TRACE("ooc", "gather", for (int i = 0; i < nr; i++)
+      memcpy(host + i * row_bytes, src + (size_t)(r + i) * ld, row_bytes));
+    err = staging_submit(&o->ring, dst, r * row_bytes, nr * row_bytes);
+    if (err != CL_SUCCESS)
+      return err;
+  }
+  o->bytes_in += rows * row_bytes;
+
+  err = clEnqueueMarkerWithWaitList(o->upload, 0, NULL, ready);
+  if (err != CL_SUCCESS)
+    return err;
+  return clFlush(o->upload);
+}
+
+// Keeps a reference to event in *slot in place of the one it held
+static void hold(cl_event *slot, cl_event event) {
+  if (*slot)
+    clReleaseEvent(*slot);
+  clRetainEvent(event);
+  *slot = event;
+}
+
+// c = a * b, all n x n row-major in host memory. Rows of C tiles are walked
+// in alternating directions, so each row starts on the B panel the last one
+// ended with. With whole-K panels the A panel is uploaded once per row.
+cl_int ooc_gemm(ooc_ctx *o, cl_command_queue commands, const float *a, const float *b, float *c, int n) {
+  cl_int err = CL_SUCCESS;
+  if (n != o->plan.n) {
+    err = replan(o, n);
+    if (err != CL_SUCCESS)
+      return err;
+  }
+  o->bytes_in = 0;
+  o->bytes_out = 0;
+
+  int t = o->plan.tile, kb = o->plan.kb;
+  int nt = (n + t - 1) / t, nk = (n + kb - 1) / kb;
+  long a_tag = -1, b_tag[2] = {-1, -1};   // panel held by each buffer
+  cl_event a_used = NULL, b_used[2] = {NULL, NULL};
+  int spare = 0;
+
+  for (int bi = 0; bi < nt && err == CL_SUCCESS; bi++) {
+    int i0 = bi * t, m = (n - i0 < t) ? n - i0 : t;
+    for (int s = 0; s < nt && err == CL_SUCCESS; s++) {
+      int bj = (bi % 2) ? nt - 1 - s : s;
+      int j0 = bj * t, w = (n - j0 < t) ? n - j0 : t;
+      TRACE_BEGIN("ooc", "tile");
+
+      for (int bk = 0; bk < nk; bk++) {
+        int k0 = bk * kb, d = (n - k0 < kb) ? n - k0 : kb;
+        cl_event ready[2];
+        int nready = 0;
+
+        long tag = (long)bi * nk + bk;
+        if (a_tag != tag) {
+          err = upload_panel(o, o->a_panel, a_used, a + (size_t)i0 * n + k0, m, d, n, &ready[nready++]);
+          if (err != CL_SUCCESS)
+            break;
+          a_tag = tag;
+        }
+        tag = (long)bk * nt + bj;
+        int x = (b_tag[0] == tag) ? 0 : (b_tag[1] == tag) ? 1 : -1;
+        if (x < 0) {
+          x = spare;
+          spare ^= 1;
+          err = upload_panel(o, o->b_panel[x], b_used[x], b + (size_t)k0 * n + j0, d, w, n, &ready[nready++]);
+          if (err != CL_SUCCESS)
+            break;
+          b_tag[x] = tag;
+        }
+
+        if (nready) {
+          err = clEnqueueBarrierWithWaitList(commands, nready, ready, NULL);
+          for (int r = 0; r < nready; r++)
+            clReleaseEvent(ready[r]);
+          if (err != CL_SUCCESS)
+            break;
+        }
+        err = gemm_mnk(&o->gemm, commands, o->a_panel, o->b_panel[x], bk ? o->partial : o->c_tile, m, w, d);
+        if (err == CL_SUCCESS && bk)
+          err = vec_add(&o->vec, commands, o->c_tile, o->partial, o->c_tile, m * w);
+        if (err != CL_SUCCESS)
+          break;
+
+        // Both panels are free for the next upload once this is done
+        cl_event used;
+        err = clEnqueueMarkerWithWaitList(commands, 0, NULL, &used);
+        if (err != CL_SUCCESS)
+          break;
+        hold(&a_used, used);
+        hold(&b_used[x], used);
+        clReleaseEvent(used);
+        err = clFlush(commands);
+      }
+
+      if (err == CL_SUCCESS) {
+        const size_t buffer_origin[3] = {0, 0, 0};
+        const size_t host_origin[3] = {sizeof(float) * j0, i0, 0};
+        const size_t region[3] = {sizeof(float) * w, m, 1};
+        err = clEnqueueReadBufferRect(commands, o->c_tile, CL_FALSE, buffer_origin, host_origin, region,
+          sizeof(float) * w, 0, sizeof(float) * n, 0, c, 0, NULL, TRACE_EV("transfer", "ooc read c"));
+        o->bytes_out += sizeof(float) * m * w;
+      }
+      TRACE_END();
+    }
+  }
+
+  cl_int fin = clFinish(commands);
+  if (err == CL_SUCCESS)
+    err = fin;
+  fin = staging_finish(&o->ring);
+  if (err == CL_SUCCESS)
+    err = fin;
+  if (a_used)
+    clReleaseEvent(a_used);
+  for (int i = 0; i < 2; i++) {
+    if (b_used[i])
+      clReleaseEvent(b_used[i]);
+  }
+  return err;
+}
+
+void ooc_release(ooc_ctx *o) {
+  release_buffers(o);
+  if (o->upload) {
+    staging_release(&o->ring);
+    clReleaseCommandQueue(o->upload);
+  }
+  vec_release(&o->vec);
+  gemm_release(&o->gemm);
+}
@@ -0,0 +1,51 @@
+#ifndef OOC_GEMM
+#define OOC_GEMM
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "gemm.h"
+#include "vector_ops.h"
+#include "staging.h"
+
+#define OOC_SHARE  (2)   // Default budget is 1/OOC_SHARE of global memory
+#define OOC_ALIGN  (64)  // Tile and K chunk granularity
+#define OOC_MIN_KB (512) // Shortest K chunk, each one costs a pass over the C tile
+
+// Tiling for one matrix order: C in tile x tile blocks, K in kb chunks
+typedef struct {
+  int n;
+  int tile;
+  int kb;
+  size_t device_bytes;  // buffers the plan allocates
+} ooc_plan;
+
+// Out-of-core GEMM: A, B and C stay in host memory (normally mapped files)
+// and only one A panel, two B panels and the C tile live on the device.
+// Panels stream in on a queue of their own through the staging ring while
+// the caller's queue multiplies.
+typedef struct {
+  cl_context context;
+  cl_command_queue upload;
+  size_t budget;
+  ooc_plan plan;
+  gemm_ctx gemm;
+  vec_ctx vec;
+  staging_ring ring;
+  cl_mem a_panel;       // tile x kb
+  cl_mem b_panel[2];    // kb x tile, one filling while the other is used
+  cl_mem c_tile;
+  cl_mem partial;       // product of one K chunk, only when kb < n
+  size_t bytes_in;      // panel bytes uploaded by the last ooc_gemm
+  size_t bytes_out;
+} ooc_ctx;
+
+ooc_plan plan_ooc(int n, size_t budget, cl_ulong max_alloc);
+cl_int ooc_init(ooc_ctx *o, cl_context context, cl_device_id device, size_t budget);
+cl_int ooc_gemm(ooc_ctx *o, cl_command_queue commands, const float *a, const float *b, float *c, int n);
+void ooc_release(ooc_ctx *o);
+
+#endif
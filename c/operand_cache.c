@@ -0,0 +1,126 @@
+/*
+ * Device-resident operand cache
+ *
+ * Keeps uploaded (and relaid-out) copies of operands that repeat across
+ * calls, so multiplying a stream of A matrices by one B pays for B's
+ * transfer and packing once. Keys are caller handles with a version that
+ * is bumped when the host data changes, or a hash of the host data.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "operand_cache.h"
+
+// 64-bit content hash, eight bytes per step. Entries also have to agree on
+// shape and layout, a collision across equal-sized operands goes unnoticed.
+uint64_t opcache_hash(const void *data, size_t bytes) {
+  const unsigned char *p = data;
+  uint64_t h = 0x9e3779b97f4a7c15ull ^ bytes;
+  size_t i = 0;
+  for (; i + 8 <= bytes; i += 8) {
+    uint64_t w;
+    memcpy(&w, p + i, 8);
+    w *= 0xff51afd7ed558ccdull;
+    w ^= w >> 32;
+    h = (h ^ w) * 0xc4ceb9fe1a85ec53ull;
+  }
+  for (; i < bytes; i++)
+    h = (h ^ p[i]) * 0x100000001b3ull;
+  h ^= h >> 29;
+  // 0 is reserved for "no key"
+  return h ? h : 1;
+}
+
+// budget 0 is a share of the device's global memory, filled in on first insert
+void opcache_init(operand_cache *oc, cl_context context, size_t budget) {
+  memset(oc, 0, sizeof(*oc));
+  oc->context = context;
+  oc->budget = budget;
+}
+
+cl_mem opcache_lookup(operand_cache *oc, uint64_t key, uint64_t version, int rows, int cols, int layout) {
+  for (int i = 0; i < oc->count; i++) {
+    opcache_entry *e = &oc->entries[i];
+    if (e->key == key && e->version == version && e->rows == rows && e->cols == cols && e->layout == layout) {
+      e->last_use = ++oc->clock;
+      oc->hits++;
+      return e->buf;
+    }
+  }
+  oc->misses++;
+  return NULL;
+}
+
+static void evict(operand_cache *oc, int i) {
+  clReleaseMemObject(oc->entries[i].buf);
+  oc->used -= oc->entries[i].bytes;
+  oc->entries[i] = oc->entries[--oc->count];
+  oc->evictions++;
+}
+
+static int lru(operand_cache *oc) {
+  int victim = 0;
+  for (int i = 1; i < oc->count; i++) {
+    if (oc->entries[i].last_use < oc->entries[victim].last_use)
+      victim = i;
+  }
+  return victim;
+}
+
+static size_t default_budget(operand_cache *oc) {
+  cl_device_id device;
+  cl_ulong global_mem = 0;
+  if (clGetContextInfo(oc->context, CL_CONTEXT_DEVICES, sizeof(cl_device_id), &device, NULL) == CL_SUCCESS)
+    clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &global_mem, NULL);
+  return global_mem ? global_mem / OPCACHE_SHARE : (size_t)256 << 20;
+}
+
+// Makes room (least recently used first) and returns a new bytes-sized buffer
+// for the caller to fill. Older versions of the same key are dropped. An
+// operand bigger than the whole budget is still cached, on its own.
+cl_mem opcache_insert(operand_cache *oc, uint64_t key, uint64_t version, int rows, int cols, int layout, size_t bytes, cl_int *err) {
+  if (oc->budget == 0)
+    oc->budget = default_budget(oc);
+
+  for (int i = oc->count - 1; i >= 0; i--) {
+    if (oc->entries[i].key == key && oc->entries[i].version != version)
+      evict(oc, i);
+  }
+  while (oc->count > 0 && (oc->count == OPCACHE_ENTRIES || oc->used + bytes > oc->budget))
+    evict(oc, lru(oc));
+
+  cl_mem buf = clCreateBuffer(oc->context, CL_MEM_READ_WRITE, bytes, NULL, err);
+  if (*err != CL_SUCCESS)
+    return NULL;
+
+  opcache_entry *e = &oc->entries[oc->count++];
+  e->key = key;
+  e->version = version;
+  e->rows = rows;
+  e->cols = cols;
+  e->layout = layout;
+  e->bytes = bytes;
+  e->buf = buf;
+  e->last_use = ++oc->clock;
+  oc->used += bytes;
+  return buf;
+}
+
+// Forgets an entry whose fill failed, so it can't be hit half-written
+void opcache_drop(operand_cache *oc, cl_mem buf) {
+  for (int i = 0; i < oc->count; i++) {
+    if (oc->entries[i].buf == buf) {
+      evict(oc, i);
+      oc->evictions--;
+      return;
+    }
+  }
+}
+
+void opcache_release(operand_cache *oc) {
+  for (int i = 0; i < oc->count; i++)
+    clReleaseMemObject(oc->entries[i].buf);
+  oc->count = 0;
+  oc->used = 0;
+}
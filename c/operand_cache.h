@@ -0,0 +1,52 @@
+#ifndef OPERAND_CACHE
+#define OPERAND_CACHE
+
+#include <stdint.h>
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#define OPCACHE_ENTRIES (64)  // Operands kept at most, whatever the budget
+#define OPCACHE_SHARE   (4)   // Default budget is 1/OPCACHE_SHARE of global memory
+
+// Layout of an entry whose contents also depend on the tile it was packed for
+#define OPCACHE_LAYOUT(layout, tile) ((layout) | ((tile) << 8))
+
+// One device-resident operand in one layout
+typedef struct {
+  uint64_t key;           // caller handle, or content hash when the caller has none
+  uint64_t version;
+  int rows;
+  int cols;
+  int layout;             // B_ROW_MAJOR, B_TRANSPOSED or B_PANELS, see OPCACHE_LAYOUT
+  size_t bytes;
+  cl_mem buf;
+  unsigned long last_use;
+} opcache_entry;
+
+// Device copies of constant operands (weights) under a memory budget, least
+// recently used first out. Entries are matched on key, version, shape and
+// layout, so a transposed and a packed copy of one B live side by side.
+typedef struct {
+  cl_context context;
+  size_t budget;
+  size_t used;
+  unsigned long clock;
+  int count;
+  opcache_entry entries[OPCACHE_ENTRIES];
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+} operand_cache;
+
+uint64_t opcache_hash(const void *data, size_t bytes);
+void opcache_init(operand_cache *oc, cl_context context, size_t budget);
+cl_mem opcache_lookup(operand_cache *oc, uint64_t key, uint64_t version, int rows, int cols, int layout);
+cl_mem opcache_insert(operand_cache *oc, uint64_t key, uint64_t version, int rows, int cols, int layout, size_t bytes, cl_int *err);
+void opcache_drop(operand_cache *oc, cl_mem buf);
+void opcache_release(operand_cache *oc);
+
+#endif
@@ -0,0 +1,320 @@
+/*
+ * Benchmark results store and regression gate
+ *
+ * Every trial is kept, not just the best, so a run can be tested against a
+ * stored baseline: a variant fails when it is slower by more than the
+ * threshold at the median and a one-sided Mann-Whitney U test says the
+ * slowdown isn't noise.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "perfdb.h"
+
+// Copies src into dst with the characters JSON would need escaped replaced
+static void copy_clean(char *dst, const char *src, size_t size) {
+  size_t i;
+  for (i = 0; i + 1 < size && src[i]; i++)
+    dst[i] = (src[i] == '"' || src[i] == '\\' || (unsigned char)src[i] < 0x20) ? '_' : src[i];
+  dst[i] = '\0';
+}
+
+// BENCH_COMMIT, or the checkout's short hash, or "unknown"
+static void current_commit(char *commit, size_t size) {
+  const char *env = getenv("BENCH_COMMIT");
+  if (env && env[0]) {
+    copy_clean(commit, env, size);
+    return;
+  }
+  copy_clean(commit, "unknown", size);
+  FILE *p = popen("git rev-parse --short HEAD 2>/dev/null", "r");
+  if (!p)
+    return;
+  char line[64];
+  if (fgets(line, sizeof(line), p)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0])
+      copy_clean(commit, line, size);
+  }
+  pclose(p);
+}
+
+void perf_begin(perf_run *run, const char *device) {
+  memset(run, 0, sizeof(*run));
+  copy_clean(run->device, device, sizeof(run->device));
+  current_commit(run->commit, sizeof(run->commit));
+  run->time = (long)time(NULL);
+}
+
+static perf_record *append(perf_run *run) {
+  if (run->count == run->cap) {
+    int cap = run->cap ? 2 * run->cap : 32;
+    perf_record *r = realloc(run->records, cap * sizeof(perf_record));
+    if (!r) {
+      fputs("perf record alloc failed", stderr);
+      exit(1);
+    }
+    run->records = r;
+    run->cap = cap;
+  }
+  perf_record *rec = &run->records[run->count++];
+  memset(rec, 0, sizeof(*rec));
+  return rec;
+}
+
+void perf_add(perf_run *run, const char *kernel, const char *shape, const double *seconds, int trials) {
+  perf_record *rec = append(run);
+  copy_clean(rec->kernel, kernel, sizeof(rec->kernel));
+  copy_clean(rec->shape, shape, sizeof(rec->shape));
+  rec->trials = (trials < PERF_MAX_TRIALS) ? trials : PERF_MAX_TRIALS;
+  memcpy(rec->seconds, seconds, rec->trials * sizeof(double));
+}
+
+// Appends the run to path, one JSON object per record
+int perf_save(const perf_run *run, const char *path) {
+  FILE *fp = fopen(path, "a");
+  if (!fp) {
+    perror(path);
+    return -1;
+  }
+  for (int i = 0; i < run->count; i++) {
+    const perf_record *rec = &run->records[i];
+    fprintf(fp, "{\"device\":\"%s\",\"commit\":\"%s\",\"time\":%ld,\"kernel\":\"%s\",\"shape\":\"%s\",\"seconds\":[",
+      run->device, run->commit, run->time, rec->kernel, rec->shape);
+    for (int t = 0; t < rec->trials; t++)
+      fprintf(fp, "%s%.9g", t ? "," : "", rec->seconds[t]);
+    fprintf(fp, "]}\n");
+  }
+  fclose(fp);
+  printf("Results appended to %s (commit %s)\n", path, run->commit);
+  return 0;
+}
+
+// String value of key in a line perf_save wrote, 0 if it's missing
+static int get_string(const char *line, const char *key, char *out, size_t size) {
+  char pattern[32];
+  snprintf(pattern, sizeof(pattern), "\"%s\":\"", key);
+  const char *p = strstr(line, pattern);
+  if (!p)
+    return 0;
+  p += strlen(pattern);
+  size_t len = strcspn(p, "\"");
+  if (len >= size)
+    len = size - 1;
+  memcpy(out, p, len);
+  out[len] = '\0';
+  return 1;
+}
+
+static int parse_line(const char *line, char *device, char *commit, long *stamp, perf_record *rec) {
+  const char *p;
+  if (!get_string(line, "device", device, 256) || !get_string(line, "commit", commit, 64) ||
+      !get_string(line, "kernel", rec->kernel, sizeof(rec->kernel)) ||
+      !get_string(line, "shape", rec->shape, sizeof(rec->shape)) ||
+      !(p = strstr(line, "\"time\":")) || sscanf(p + 7, "%ld", stamp) != 1 ||
+      !(p = strstr(line, "\"seconds\":[")))
+    return 0;
+
+  p += 11;
+  rec->trials = 0;
+  while (*p && *p != ']' && rec->trials < PERF_MAX_TRIALS) {
+    char *end;
+    rec->seconds[rec->trials] = strtod(p, &end);
+    if (end == p)
+      break;
+    rec->trials++;
+    p = (*end == ',') ? end + 1 : end;
+  }
+  return rec->trials > 0;
+}
+
+// Loads the latest stored run on device: of commit if given, otherwise of
+// any commit but exclude_commit. Returns the number of records, 0 if there
+// is no such run.
+int perf_load_baseline(perf_run *base, const char *path, const char *device, const char *exclude_commit, const char *commit) {
+  memset(base, 0, sizeof(*base));
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    return 0;
+
+  char line[4096], dev[256], com[64];
+  long t;
+  perf_record rec;
+  // First pass finds the run, the second collects its records
+  for (int pass = 0; pass < 2; pass++) {
+    rewind(fp);
+    while (fgets(line, sizeof(line), fp)) {
+      if (!parse_line(line, dev, com, &t, &rec) || strcmp(dev, device) != 0)
+        continue;
+      if (pass == 0) {
+        int wanted = commit ? strcmp(com, commit) == 0 : (!exclude_commit || strcmp(com, exclude_commit) != 0);
+        if (wanted && t >= base->time) {
+          copy_clean(base->commit, com, sizeof(base->commit));
+          base->time = t;
+        }
+      } else if (t == base->time && strcmp(com, base->commit) == 0) {
+        *append(base) = rec;
+      }
+    }
+    if (base->commit[0] == '\0')
+      break;
+  }
+  fclose(fp);
+  copy_clean(base->device, device, sizeof(base->device));
+  return base->count;
+}
+
+typedef struct {
+  double v;
+  int second;
+} ranked;
+
+static int by_value(const void *x, const void *y) {
+  double a = ((const ranked *)x)->v, b = ((const ranked *)y)->v;
+  return (a > b) - (a < b);
+}
+
+// One-sided Mann-Whitney U test: the p-value for b tending to be larger
+// than a. Normal approximation with continuity and tie corrections.
+double mann_whitney(const double *a, int na, const double *b, int nb) {
+  int n = na + nb;
+  ranked pooled[2 * PERF_MAX_TRIALS];
+  for (int i = 0; i < na; i++)
+    pooled[i] = (ranked){a[i], 0};
+  for (int i = 0; i < nb; i++)
+    pooled[na + i] = (ranked){b[i], 1};
+  qsort(pooled, n, sizeof(ranked), by_value);
+
+  double rank_b = 0.0, ties = 0.0;
+  for (int i = 0; i < n;) {
+    int j = i;
+    while (j < n && pooled[j].v == pooled[i].v)
+      j++;
+    double rank = 0.5 * (i + 1 + j);   // average of ranks i+1 .. j
+    for (int k = i; k < j; k++)
+      rank_b += pooled[k].second ? rank : 0.0;
+    double t = j - i;
+    ties += t * t * t - t;
+    i = j;
+  }
+
+  double u = rank_b - nb * (nb + 1) / 2.0;
+  double sigma = sqrt(na * (double)nb / 12.0 * ((n + 1) - ties / (n * (n - 1.0))));
+  if (sigma == 0.0)
+    return 1.0;
+  double z = (u - na * (double)nb / 2.0 - 0.5) / sigma;
+  return 0.5 * erfc(z / sqrt(2.0));
+}
+
+static int by_double(const void *x, const void *y) {
+  double a = *(const double *)x, b = *(const double *)y;
+  return (a > b) - (a < b);
+}
+
+static double median(const double *x, int n) {
+  double s[PERF_MAX_TRIALS];
+  memcpy(s, x, n * sizeof(double));
+  qsort(s, n, sizeof(double), by_double);
+  return (n % 2) ? s[n / 2] : 0.5 * (s[n / 2 - 1] + s[n / 2]);
+}
+
+// Prints run against base for every variant in both, returns how many are
+// significantly slower than threshold allows
+int perf_compare(const perf_run *base, const perf_run *run, double threshold, double alpha) {
+  int regressions = 0;
+  printf("\nAgainst %s on %s, fail at +%.1f%% with p < %g\n", base->commit, base->device, 100.0 * threshold, alpha);
+  printf("%-24s %-16s %12s %12s %9s %10s\n", "kernel", "shape", "base", "now", "change", "p slower");
+  for (int i = 0; i < run->count; i++) {
+    const perf_record *now = &run->records[i];
+    const perf_record *was = NULL;
+    for (int j = 0; j < base->count && !was; j++) {
+      if (strcmp(base->records[j].kernel, now->kernel) == 0 && strcmp(base->records[j].shape, now->shape) == 0)
+        was = &base->records[j];
+    }
+    if (!was)
+      continue;
+
+    double m0 = median(was->seconds, was->trials), m1 = median(now->seconds, now->trials);
+    double change = m1 / m0 - 1.0;
+    double p = mann_whitney(was->seconds, was->trials, now->seconds, now->trials);
+    int slower = (change > threshold && p < alpha);
+    regressions += slower;
+    printf("%-24s %-16s %12.6f %12.6f %+8.1f%% %10.2g%s\n", now->kernel, now->shape, m0, m1, 100.0 * change, p,
+      slower ? "  REGRESSION" : "");
+  }
+  printf("%d regression%s\n", regressions, regressions == 1 ? "" : "s");
+  return regressions;
+}
+
+void perf_free(perf_run *run) {
+  free(run->records);
+  run->records = NULL;
+  run->count = run->cap = 0;
+}
+
+static int check(int ok, const char *what) {
+  printf("%-44s %s\n", what, ok ? "ok" : "FAILED");
+  return !ok;
+}
+
+// Known answers for the U test and a store round trip, no device needed.
+// Returns the number of failed checks.
+int perf_selftest(void) {
+  int failures = 0;
+
+  // Normal approximation values for na = nb = 5: b entirely above a gives
+  // U = 25, interleaved U = 15, entirely below U = 0; all equal has no spread
+  const double lo[5] = {1, 2, 3, 4, 5}, hi[5] = {6, 7, 8, 9, 10};
+  const double odd[5] = {1, 3, 5, 7, 9}, even[5] = {2, 4, 6, 8, 10};
+  const double same[5] = {1, 1, 1, 1, 1};
+  failures += check(fabs(mann_whitney(lo, 5, hi, 5) - 0.0060929) < 1e-6, "mann_whitney b above a, p = 0.0061");
+  failures += check(fabs(mann_whitney(odd, 5, even, 5) - 0.3380517) < 1e-6, "mann_whitney interleaved, p = 0.338");
+  failures += check(fabs(mann_whitney(hi, 5, lo, 5) - 0.9966923) < 1e-6, "mann_whitney b below a, p = 0.997");
+  failures += check(mann_whitney(same, 5, same, 5) == 1.0, "mann_whitney all tied, p = 1");
+
+  perf_record rec;
+  char device[256], commit[64];
+  long stamp;
+  const char *line = "{\"device\":\"dev 0\",\"commit\":\"abc1234\",\"time\":1700000000,"
+                     "\"kernel\":\"mmul/panels\",\"shape\":\"512\",\"seconds\":[0.25,1.5e-3,2]}";
+  int parsed = parse_line(line, device, commit, &stamp, &rec);
+  failures += check(parsed && strcmp(device, "dev 0") == 0 && strcmp(commit, "abc1234") == 0 &&
+                    stamp == 1700000000L && strcmp(rec.kernel, "mmul/panels") == 0 && strcmp(rec.shape, "512") == 0 &&
+                    rec.trials == 3 && rec.seconds[0] == 0.25 && rec.seconds[1] == 1.5e-3 && rec.seconds[2] == 2.0,
+                    "parse_line fields");
+  failures += check(!parse_line("{\"device\":\"dev 0\",\"seconds\":[1]}", device, commit, &stamp, &rec),
+                    "parse_line rejects a partial line");
+
+  // perf_save then perf_load_baseline gives back the same records
+  char path[] = "/tmp/perfdb_selftest_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    return failures + check(0, "perf store round trip");
+  close(fd);
+  perf_run run = {0}, base;
+  copy_clean(run.device, "dev \"0\"", sizeof(run.device));
+  copy_clean(run.commit, "abc1234", sizeof(run.commit));
+  run.time = 1700000000L;
+  const double secs[3] = {0.125, 0.25, 3.0e-6};
+  perf_add(&run, "vadd4", "1024", secs, 3);
+  perf_add(&run, "mmul/row-major", "256", secs, 2);
+  int saved = perf_save(&run, path) == 0;
+  int loaded = perf_load_baseline(&base, path, run.device, NULL, run.commit);
+  int same_records = saved && loaded == run.count;
+  for (int i = 0; same_records && i < run.count; i++) {
+    const perf_record *a = &run.records[i], *b = &base.records[i];
+    same_records = strcmp(a->kernel, b->kernel) == 0 && strcmp(a->shape, b->shape) == 0 && a->trials == b->trials &&
+                   memcmp(a->seconds, b->seconds, sizeof(double) * a->trials) == 0;
+  }
+  failures += check(same_records && base.time == run.time, "perf store round trip");
+  perf_free(&base);
+  perf_free(&run);
+  remove(path);
+
+  printf("%d self-test failure%s\n", failures, failures == 1 ? "" : "s");
+  return failures;
+}
@@ -0,0 +1,39 @@
+#ifndef PERFDB
+#define PERFDB
+
+#include <time.h>
+
+#define PERF_MAX_TRIALS (64)
+#define PERF_THRESHOLD  (0.05)  // Median slowdown that fails the gate
+#define PERF_ALPHA      (0.01)  // Significance level of the slowdown test
+
+// Timed trials of one kernel variant at one shape
+typedef struct {
+  char kernel[64];
+  char shape[64];
+  int trials;
+  double seconds[PERF_MAX_TRIALS];
+} perf_record;
+
+// One benchmark run: where and at which commit it ran, and its records.
+// Runs are stored as JSON lines, one record per line, keyed by device,
+// kernel, shape and commit.
+typedef struct {
+  char device[256];
+  char commit[64];
+  long time;
+  int count;
+  int cap;
+  perf_record *records;
+} perf_run;
+
+void perf_begin(perf_run *run, const char *device);
+void perf_add(perf_run *run, const char *kernel, const char *shape, const double *seconds, int trials);
+int perf_save(const perf_run *run, const char *path);
+int perf_load_baseline(perf_run *base, const char *path, const char *device, const char *exclude_commit, const char *commit);
+double mann_whitney(const double *a, int na, const double *b, int nb);
+int perf_compare(const perf_run *base, const perf_run *run, double threshold, double alpha);
+void perf_free(perf_run *run);
+int perf_selftest(void);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Counter-based random fills, on the device and bit-identical on the host
+ *
+ * Filling operands in place on the device skips both the serial host loop
+ * and the upload; the host functions regenerate any range for reference
+ * checks.
+*/
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "rng.h"
+#include "kernel_cache.h"
+#include "trace.h"
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+// Same rounds as philox() in rng.cl
+void philox4x32(uint64_t block, uint64_t seed, uint32_t out[4]) {
+  uint32_t c0 = (uint32_t)block, c1 = (uint32_t)(block >> 32), c2 = 0, c3 = 0;
+  uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+  for (int r = 0; r < 10; r++) {
+    uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+    uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+    uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+    uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+    c1 = (uint32_t)p1;
+    c3 = (uint32_t)p0;
+    c0 = n0;
+    c2 = n2;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+  out[0] = c0;
+  out[1] = c1;
+  out[2] = c2;
+  out[3] = c3;
+}
+
+static float unit(uint32_t x) {
+  return (float)(x >> 8) * (1.0f / 16777216.0f);
+}
+
+void rng_uniform_host(float *out, size_t count, uint64_t seed, uint64_t offset) {
+  uint32_t x[4];
+  for (size_t i = 0; i < count; i++) {
+    uint64_t e = offset + i;
+    if (i == 0 || e % 4 == 0)
+      philox4x32(e / 4, seed, x);
+    out[i] = unit(x[e % 4]);
+  }
+}
+
+// 53-bit doubles in [0, 1), element i from stream words 2(offset+i) and
+// 2(offset+i)+1; host only, for the fp64 references
+void rng_uniform_host_double(double *out, size_t count, uint64_t seed, uint64_t offset) {
+  uint32_t x[4];
+  for (size_t i = 0; i < count; i++) {
+    uint64_t e = 2 * (offset + i);
+    if (i == 0 || e % 4 == 0)
+      philox4x32(e / 4, seed, x);
+    out[i] = ((double)(x[e % 4] >> 5) * 67108864.0 + (double)(x[e % 4 + 1] >> 6)) * (1.0 / 9007199254740992.0);
+  }
+}
+
+void rng_normal_host(float *out, size_t count, uint64_t seed, uint64_t offset, float mean, float stddev) {
+  uint32_t x[4];
+  float v[4];
+  for (size_t i = 0; i < count; i++) {
+    uint64_t e = offset + i;
+    if (i == 0 || e % 4 == 0) {
+      philox4x32(e / 4, seed, x);
+      for (int p = 0; p < 4; p += 2) {
+        float r = sqrtf(-2.0f * logf(1.0f - unit(x[p]))), t = 6.2831853f * unit(x[p+1]);
+        v[p] = mean + stddev * (r * cosf(t));
+        v[p+1] = mean + stddev * (r * sinf(t));
+      }
+    }
+    out[i] = v[e % 4];
+  }
+}
+
+cl_int rng_init(rng_ctx *r, cl_context context, cl_device_id device) {
+  cl_int err;
+  memset(r, 0, sizeof(*r));
+  r->ko_uniform = get_kernel(context, device, "rng.cl", "rng_uniform", NULL, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  r->ko_normal = get_kernel(context, device, "rng.cl", "rng_normal", NULL, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  return CL_SUCCESS;
+
+fail:
+  rng_release(r);
+  return err;
+}
+
+// One work-item per block of four touching [offset, offset + count)
+static cl_int launch(cl_command_queue commands, cl_kernel kernel, const char *name, cl_mem buf, unsigned int count,
+                     uint64_t seed, uint64_t offset) {
+  cl_int err;
+  cl_ulong off = offset, s = seed;
+  err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &buf);
+  err |= clSetKernelArg(kernel, 1, sizeof(unsigned int), &count);
+  err |= clSetKernelArg(kernel, 2, sizeof(cl_ulong), &off);
+  err |= clSetKernelArg(kernel, 3, sizeof(cl_ulong), &s);
+  if (err != CL_SUCCESS)
+    return err;
+  size_t global = (offset + count + 3) / 4 - offset / 4;
+  return clEnqueueNDRangeKernel(commands, kernel, 1, NULL, &global, NULL, 0, NULL, TRACE_EV("kernel", name));
+}
+
+cl_int rng_uniform(rng_ctx *r, cl_command_queue commands, cl_mem buf, unsigned int count, uint64_t seed, uint64_t offset) {
+  return launch(commands, r->ko_uniform, "rng_uniform", buf, count, seed, offset);
+}
+
+cl_int rng_normal(rng_ctx *r, cl_command_queue commands, cl_mem buf, unsigned int count, uint64_t seed, uint64_t offset,
+                  float mean, float stddev) {
+  cl_int err;
+  err = clSetKernelArg(r->ko_normal, 4, sizeof(float), &mean);
+  err |= clSetKernelArg(r->ko_normal, 5, sizeof(float), &stddev);
+  if (err != CL_SUCCESS)
+    return err;
+  return launch(commands, r->ko_normal, "rng_normal", buf, count, seed, offset);
+}
+
+void rng_release(rng_ctx *r) {
+  if (r->ko_uniform)
+    clReleaseKernel(r->ko_uniform);
+  if (r->ko_normal)
+    clReleaseKernel(r->ko_normal);
+  memset(r, 0, sizeof(*r));
+}
@@ -0,0 +1,72 @@
+#include "kernel_common.clh"
+
+// Counter-based Philox4x32-10. Element e of the stream for a seed is word
+// e % 4 of the block for counter e / 4, so any range fills independently
+// and rng.c reproduces it bit for bit (uniforms; normals go through log,
+// sqrt and sin/cos and can differ in the last few ulp).
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+// Ten rounds on the counter (block, 0) under the key seed, as in rng.c
+void philox(ulong block, ulong seed, uint x[4]) {
+  uint c0 = (uint)block, c1 = (uint)(block >> 32), c2 = 0, c3 = 0;
+  uint k0 = (uint)seed, k1 = (uint)(seed >> 32);
+  for (int r = 0; r < 10; r++) {
+    uint n0 = mul_hi(PHILOX_M1, c2) ^ c1 ^ k0;
+    uint n2 = mul_hi(PHILOX_M0, c0) ^ c3 ^ k1;
+    c1 = PHILOX_M1 * c2;
+    c3 = PHILOX_M0 * c0;
+    c0 = n0;
+    c2 = n2;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+  x[0] = c0;
+  x[1] = c1;
+  x[2] = c2;
+  x[3] = c3;
+}
+
+// Top 24 bits as a float in [0, 1), exact
+float unit(uint x) {
+  return (float)(x >> 8) * (1.0f / 16777216.0f);
+}
+
+// Writes the elements of block that fall in [offset, offset + count), out
+// holding element offset at index 0
+void store_block(__global float *out, const float v[4], ulong block, ulong offset, uint count) {
+  long base = (long)(block * 4) - (long)offset;
+  for (int i = 0; i < 4; i++) {
+    long e = base + i;
+    if (e >= 0 && e < count)
+      out[e] = v[i];
+  }
+}
+
+__kernel void rng_uniform(__global float *out, const unsigned int count, const ulong offset, const ulong seed) {
+  ulong block = offset / 4 + get_global_id(0);
+  uint x[4];
+  float v[4];
+  philox(block, seed, x);
+  for (int i = 0; i < 4; i++)
+    v[i] = unit(x[i]);
+  store_block(out, v, block, offset, count);
+}
+
+// Normal(mean, stddev) by Box-Muller on the two word pairs of a block
+__kernel void rng_normal(__global float *out, const unsigned int count, const ulong offset, const ulong seed,
+                         const float mean, const float stddev) {
+  ulong block = offset / 4 + get_global_id(0);
+  uint x[4];
+  float v[4];
+  philox(block, seed, x);
+  for (int p = 0; p < 4; p += 2) {
+    float r = sqrt(-2.0f * log(1.0f - unit(x[p]))), t = 6.2831853f * unit(x[p+1]);
+    v[p] = mean + stddev * (r * cos(t));
+    v[p+1] = mean + stddev * (r * sin(t));
+  }
+  store_block(out, v, block, offset, count);
+}
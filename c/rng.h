@@ -0,0 +1,34 @@
+#ifndef RNG
+#define RNG
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#define RNG_SEED (42)  // Seed the drivers fill their operands with
+
+// Philox4x32-10 fills from rng.cl. A (seed, offset) pair names a position
+// in an endless stream, so a buffer filled on the device and its host
+// reference from rng_*_host agree without any transfer.
+typedef struct {
+  cl_kernel ko_uniform;
+  cl_kernel ko_normal;
+} rng_ctx;
+
+void philox4x32(uint64_t block, uint64_t seed, uint32_t out[4]);
+void rng_uniform_host(float *out, size_t count, uint64_t seed, uint64_t offset);
+void rng_uniform_host_double(double *out, size_t count, uint64_t seed, uint64_t offset);
+void rng_normal_host(float *out, size_t count, uint64_t seed, uint64_t offset, float mean, float stddev);
+
+cl_int rng_init(rng_ctx *r, cl_context context, cl_device_id device);
+cl_int rng_uniform(rng_ctx *r, cl_command_queue commands, cl_mem buf, unsigned int count, uint64_t seed, uint64_t offset);
+cl_int rng_normal(rng_ctx *r, cl_command_queue commands, cl_mem buf, unsigned int count, uint64_t seed, uint64_t offset,
+                  float mean, float stddev);
+void rng_release(rng_ctx *r);
+
+#endif
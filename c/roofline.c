@@ -0,0 +1,154 @@
+/*
+ * Roofline measurement and reporting
+ *
+ * Achievable bandwidth comes from STREAM copy/scale/add/triad kernels and
+ * peak compute from independent FMA chains. Kernels are then rated by
+ * arithmetic intensity against min(peak, intensity * bandwidth).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "roofline.h"
+#include "kernel_cache.h"
+#include "trace.h"
+
+extern double wtime();
+
+// Best-of-STREAM_REPS seconds for one launch of kernel over global items
+static double best_time(cl_command_queue commands, cl_kernel kernel, size_t global, cl_int *err) {
+  double best = 1e30;
+  for (int r = 0; r <= STREAM_REPS; r++) {
+    double t = wtime();
+    *err = clEnqueueNDRangeKernel(commands, kernel, 1, NULL, &global, NULL, 0, NULL, TRACE_EV("kernel", "roofline"));
+    if (*err != CL_SUCCESS)
+      return 0.0;
+    *err = clFinish(commands);
+    if (*err != CL_SUCCESS)
+      return 0.0;
+    t = wtime() - t;
+    // First launch is warm-up
+    if (r > 0 && t < best)
+      best = t;
+  }
+  return best;
+}
+
+cl_int roofline_measure(cl_context context, cl_device_id device, cl_command_queue commands, const device_caps *caps, roofline *roof) {
+  cl_int err;
+  cl_kernel ko[5] = {NULL};
+  cl_mem d[3] = {NULL};
+  cl_mem d_out = NULL;
+  const char *names[] = {"stream_copy", "stream_scale", "stream_add", "stream_triad", "peak_fma"};
+
+  size_t len = STREAM_MAX_LEN;
+  while (len * sizeof(float) > caps->max_alloc)
+    len /= 2;
+
+  for (int k = 0; k < 5; k++) {
+    ko[k] = get_kernel(context, device, "roofline.cl", names[k], NULL, &err);
+    if (err != CL_SUCCESS)
+      goto done;
+  }
+
+  float zero = 0.0f;
+  for (int i = 0; i < 3; i++) {
+    d[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * len, NULL, &err);
+    if (err != CL_SUCCESS)
+      goto done;
+    err = clEnqueueFillBuffer(commands, d[i], &zero, sizeof(float), 0, sizeof(float) * len, 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+      goto done;
+  }
+
+  float s = 3.0f;
+  err = clSetKernelArg(ko[0], 0, sizeof(cl_mem), &d[0]);
+  err |= clSetKernelArg(ko[0], 1, sizeof(cl_mem), &d[2]);
+  err |= clSetKernelArg(ko[1], 0, sizeof(cl_mem), &d[1]);
+  err |= clSetKernelArg(ko[1], 1, sizeof(cl_mem), &d[2]);
+  err |= clSetKernelArg(ko[1], 2, sizeof(float), &s);
+  err |= clSetKernelArg(ko[2], 0, sizeof(cl_mem), &d[0]);
+  err |= clSetKernelArg(ko[2], 1, sizeof(cl_mem), &d[1]);
+  err |= clSetKernelArg(ko[2], 2, sizeof(cl_mem), &d[2]);
+  err |= clSetKernelArg(ko[3], 0, sizeof(cl_mem), &d[0]);
+  err |= clSetKernelArg(ko[3], 1, sizeof(cl_mem), &d[1]);
+  err |= clSetKernelArg(ko[3], 2, sizeof(cl_mem), &d[2]);
+  err |= clSetKernelArg(ko[3], 3, sizeof(float), &s);
+  if (err != CL_SUCCESS)
+    goto done;
+
+  // Bytes moved per element: copy and scale 2 floats, add and triad 3
+  double bytes = sizeof(float) * (double)len;
+  roof->copy_gbs = 2 * bytes / best_time(commands, ko[0], len, &err) * 1e-9;
+  if (err == CL_SUCCESS)
+    roof->scale_gbs = 2 * bytes / best_time(commands, ko[1], len, &err) * 1e-9;
+  if (err == CL_SUCCESS)
+    roof->add_gbs = 3 * bytes / best_time(commands, ko[2], len, &err) * 1e-9;
+  if (err == CL_SUCCESS)
+    roof->triad_gbs = 3 * bytes / best_time(commands, ko[3], len, &err) * 1e-9;
+  if (err != CL_SUCCESS)
+    goto done;
+
+  roof->bandwidth_gbs = roof->copy_gbs;
+  if (roof->scale_gbs > roof->bandwidth_gbs)
+    roof->bandwidth_gbs = roof->scale_gbs;
+  if (roof->add_gbs > roof->bandwidth_gbs)
+    roof->bandwidth_gbs = roof->add_gbs;
+  if (roof->triad_gbs > roof->bandwidth_gbs)
+    roof->bandwidth_gbs = roof->triad_gbs;
+
+  // Enough work-items to fill every compute unit several times over
+  size_t items = (size_t)caps->compute_units * caps->max_work_group_size * 8;
+  int iters = PEAK_ITERS;
+  float m = 0.999f, c = 0.001f;
+  d_out = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(float) * items, NULL, &err);
+  if (err != CL_SUCCESS)
+    goto done;
+  err = clSetKernelArg(ko[4], 0, sizeof(cl_mem), &d_out);
+  err |= clSetKernelArg(ko[4], 1, sizeof(float), &m);
+  err |= clSetKernelArg(ko[4], 2, sizeof(float), &c);
+  err |= clSetKernelArg(ko[4], 3, sizeof(int), &iters);
+  if (err != CL_SUCCESS)
+    goto done;
+  double t = best_time(commands, ko[4], items, &err);
+  roof->peak_gflops = (double)items * iters * 64 / t * 1e-9;
+
+done:
+  for (int k = 0; k < 5; k++) {
+    if (ko[k])
+      clReleaseKernel(ko[k]);
+  }
+  for (int i = 0; i < 3; i++) {
+    if (d[i])
+      clReleaseMemObject(d[i]);
+  }
+  if (d_out)
+    clReleaseMemObject(d_out);
+  return err;
+}
+
+// Attainable GFLOPS at the given flops/byte
+double roofline_bound(const roofline *roof, double intensity) {
+  double mem = intensity * roof->bandwidth_gbs;
+  return mem < roof->peak_gflops ? mem : roof->peak_gflops;
+}
+
+void roofline_print(const roofline *roof) {
+  printf("\nSTREAM (GB/s): copy %.2f  scale %.2f  add %.2f  triad %.2f\n",
+    roof->copy_gbs, roof->scale_gbs, roof->add_gbs, roof->triad_gbs);
+  printf("Peak fp32 FMA: %.2f GFLOPS, ridge point %.2f flops/byte\n\n",
+    roof->peak_gflops, roof->peak_gflops / roof->bandwidth_gbs);
+}
+
+void roofline_header(void) {
+  printf("%-24s %12s %10s %10s %10s %8s %9s\n", "kernel", "seconds", "GFLOPS", "GB/s", "flops/B", "bound", "roofline");
+}
+
+// bytes is the compulsory traffic (each operand read or written once)
+void roofline_report(const roofline *roof, const char *name, double flops, double bytes, double seconds) {
+  double intensity = flops / bytes;
+  double gflops = flops / seconds * 1e-9;
+  double bound = roofline_bound(roof, intensity);
+  printf("%-24s %12lf %10.2f %10.2f %10.3f %8s %8.1f%%\n", name, seconds, gflops, bytes / seconds * 1e-9,
+    intensity, bound < roof->peak_gflops ? "memory" : "compute", 100.0 * gflops / bound);
+}
@@ -0,0 +1,40 @@
+// STREAM-style bandwidth kernels and an FMA throughput kernel used to
+// measure the roofline of the current device
+
+__kernel void stream_copy(__global float *a, __global float *c) {
+  size_t i = get_global_id(0);
+  c[i] = a[i];
+}
+
+__kernel void stream_scale(__global float *b, __global float *c, const float s) {
+  size_t i = get_global_id(0);
+  b[i] = s * c[i];
+}
+
+__kernel void stream_add(__global float *a, __global float *b, __global float *c) {
+  size_t i = get_global_id(0);
+  c[i] = a[i] + b[i];
+}
+
+__kernel void stream_triad(__global float *a, __global float *b, __global float *c, const float s) {
+  size_t i = get_global_id(0);
+  a[i] = b[i] + s * c[i];
+}
+
+// 8 independent float4 FMA chains per work-item, 64 flops per iteration.
+// The multiplier and addend keep the values bounded and away from denormals;
+// the sum is stored so the chains can't be optimised away.
+__kernel void peak_fma(__global float *out, const float m, const float c, const int iters) {
+  float4 mv = (float4)(m), cv = (float4)(c);
+  float4 x0 = (float4)(get_global_id(0) * 1e-6f);
+  float4 x1 = x0 + 0.1f, x2 = x0 + 0.2f, x3 = x0 + 0.3f;
+  float4 x4 = x0 + 0.4f, x5 = x0 + 0.5f, x6 = x0 + 0.6f, x7 = x0 + 0.7f;
+
+  for (int i = 0; i < iters; i++) {
+    x0 = fma(x0, mv, cv); x1 = fma(x1, mv, cv); x2 = fma(x2, mv, cv); x3 = fma(x3, mv, cv);
+    x4 = fma(x4, mv, cv); x5 = fma(x5, mv, cv); x6 = fma(x6, mv, cv); x7 = fma(x7, mv, cv);
+  }
+
+  float4 s = x0 + x1 + x2 + x3 + x4 + x5 + x6 + x7;
+  out[get_global_id(0)] = s.x + s.y + s.z + s.w;
+}
@@ -0,0 +1,32 @@
+#ifndef ROOFLINE
+#define ROOFLINE
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "device_info.h"
+
+#define STREAM_MAX_LEN  (1 << 24)  // Floats per STREAM array, capped by max alloc
+#define STREAM_REPS     (10)       // Best-of count, as in STREAM
+#define PEAK_ITERS      (4096)     // FMA iterations per work-item
+
+// Measured limits of the device
+typedef struct {
+  double copy_gbs;
+  double scale_gbs;
+  double add_gbs;
+  double triad_gbs;
+  double bandwidth_gbs;  // best of the four, the slope of the roofline
+  double peak_gflops;    // fp32 FMA throughput, the flat part
+} roofline;
+
+cl_int roofline_measure(cl_context context, cl_device_id device, cl_command_queue commands, const device_caps *caps, roofline *roof);
+double roofline_bound(const roofline *roof, double intensity);
+void roofline_print(const roofline *roof);
+void roofline_header(void);
+void roofline_report(const roofline *roof, const char *name, double flops, double bytes, double seconds);
+
+#endif
@@ -0,0 +1,174 @@
+/*
+ * Dense linear solve (A x = b) by mixed-precision iterative refinement
+ *
+ *   solve [n] [nb]    matrix order (default 512) and LU panel width
+ *
+ * A is factored in fp32 on the device, the solution is then refined on the
+ * host with fp64 residuals. Exits nonzero if refinement doesn't reach fp64
+ * backward error.
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include<sys/types.h>
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#include <unistd.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "err_code.h"
+#include "device_info.h"
+#include "kernel_cache.h"
+#include "lu.h"
+#include "trace.h"
+
+#ifndef DEVICE
+#define DEVICE CL_DEVICE_TYPE_DEFAULT
+#endif
+
+extern double wtime();
+
+#define N  (512)  // Default matrix order, override with argv[1]
+
+// Max-norm forward error against the known solution
+double forward_error(const double *x, const double *x_true, int n) {
+  double diff = 0.0, norm = 0.0;
+  for (int i = 0; i < n; i++) {
+    diff = fmax(diff, fabs(x[i] - x_true[i]));
+    norm = fmax(norm, fabs(x_true[i]));
+  }
+  return diff / norm;
+}
+
+int main(int argc, char** argv) {
+  int err;
+  int n = (argc > 1) ? atoi(argv[1]) : N;
+  int nb = (argc > 2) ? atoi(argv[2]) : 0;
+  size_t count = (size_t)n * n;
+
+  double* h_A = (double *) calloc(count, sizeof(double));
+  float* h_lu = (float *) calloc(count, sizeof(float));
+  double* h_b = (double *) calloc(n, sizeof(double));
+  double* h_x = (double *) calloc(n, sizeof(double));
+  double* h_x_true = (double *) calloc(n, sizeof(double));
+  int* ipiv = (int *) calloc(n, sizeof(int));
+
+  cl_device_id device_id;
+  cl_context context;
+  cl_command_queue commands;
+
+  // Random nonsymmetric A, so pivoting matters, and b = A x_true
+  srand(42);
+  int i;
+  for (i = 0; i < count; i++) {
+    h_A[i] = rand() / (double)RAND_MAX - 0.5;
+    h_lu[i] = (float)h_A[i];
+  }
+  for (i = 0; i < n; i++)
+    h_x_true[i] = rand() / (double)RAND_MAX - 0.5;
+  for (i = 0; i < n; i++) {
+    h_b[i] = 0.0;
+    for (int j = 0; j < n; j++)
+      h_b[i] += h_A[(size_t)i*n+j] * h_x_true[j];
+  }
+
+  // Set up platform and GPU device
+  TRACE_BEGIN("setup", "platform and device");
+  cl_uint numPlatforms;
+  err = clGetPlatformIDs(0, NULL, &numPlatforms);
+  checkError(err, "Finding platforms");
+  if (numPlatforms == 0) {
+    printf("Found 0 platforms\n");
+    return EXIT_FAILURE;
+  }
+
+  // Get all platforms
+  cl_platform_id Platform[numPlatforms];
+  err = clGetPlatformIDs(numPlatforms, Platform, NULL);
+  checkError(err, "Getting platforms");
+
+  // Secure a GPU
+  for (i = 0; i < numPlatforms; i++) {
+    err = clGetDeviceIDs(Platform[i], DEVICE, 1, &device_id, NULL);
+    if (err == CL_SUCCESS) {
+      break;
+    }
+  }
+
+  if (device_id == NULL)
+    checkError(err, "Finding a device");
+
+  err = output_device_info(device_id);
+  checkError(err, "Finding device output");
+
+  context = clCreateContext(0, 1, &device_id, NULL, NULL, &err);
+  checkError(err, "Creating context");
+
+  commands = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
+  checkError(err, "Creating command queue");
+  TRACE_END();
+
+  lu_ctx lu;
+  err = lu_init(&lu, context, device_id, nb);
+  checkError(err, "Creating LU solver");
+
+  cl_mem d_a = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(float) * count, h_lu, &err);
+  checkError(err, "Creating buffer d_a");
+
+  // Warm-up factorization so kernel builds aren't timed, then the real one
+  int info;
+  err = lu_factor(&lu, commands, d_a, n, ipiv, &info);
+  checkError(err, "Factoring A");
+  err = clEnqueueWriteBuffer(commands, d_a, CL_TRUE, 0, sizeof(float) * count, h_lu, 0, NULL, NULL);
+  checkError(err, "Copying h_lu to device at d_a");
+
+  double t_factor = wtime();
+  err = lu_factor(&lu, commands, d_a, n, ipiv, &info);
+  checkError(err, "Factoring A");
+  t_factor = wtime() - t_factor;
+  if (info != 0) {
+    printf("A is singular in fp32, zero pivot at %d\n", info);
+    return EXIT_FAILURE;
+  }
+
+  err = clEnqueueReadBuffer(commands, d_a, CL_TRUE, 0, sizeof(float) * count, h_lu, 0, NULL, NULL);
+  checkError(err, "Reading factors");
+
+  // fp32 solve alone, then refined
+  double berr;
+  for (i = 0; i < n; i++)
+    h_x[i] = h_b[i];
+  lu_solve_host(h_lu, ipiv, n, h_x);
+  double ferr32 = forward_error(h_x, h_x_true, n);
+
+  double t_refine = wtime();
+  int iters;
+  TRACE("lu", "lu_refine", iters = lu_refine(h_A, h_lu, ipiv, h_b, h_x, n, &berr));
+  t_refine = wtime() - t_refine;
+  double ferr = forward_error(h_x, h_x_true, n);
+
+  printf("\nN = %d, panel %d\n", n, lu.nb);
+  printf("%-10s %12lf %10.2f GFLOPS\n", "factor", t_factor, 2.0 / 3.0 * n * (double)n * n / t_factor * 1e-9);
+  printf("%-10s %12lf %10d steps\n", "refine", t_refine, iters);
+  printf("%-10s fp32 forward error %.3e, refined %.3e, backward error %.3e\n", "", ferr32, ferr, berr);
+
+  TRACE_DUMP(getenv("TRACE_FILE") ? getenv("TRACE_FILE") : "solve.trace.json");
+
+  clReleaseMemObject(d_a);
+  lu_release(&lu);
+  release_programs();
+  clReleaseCommandQueue(commands);
+  clReleaseContext(context);
+
+  free(h_A);
+  free(h_lu);
+  free(h_b);
+  free(h_x);
+  free(h_x_true);
+  free(ipiv);
+
+  return (iters >= 0) ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,282 @@
+/*
+ * Sparse (CSR / ELLPACK) times dense multiplication
+ *
+ * Host conversion from the dense row-major layout used in mat_lib.c, format
+ * selection from measured sparsity, and device upload and dispatch.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sparse.h"
+#include "kernel_cache.h"
+#include "trace.h"
+
+// Fraction of nonzero entries
+double mat_density(float *A, int rows, int cols) {
+  long nnz = 0;
+  for (long i = 0; i < (long)rows * cols; i++) {
+    if (A[i] != 0.0f)
+      nnz++;
+  }
+  return (double)nnz / ((double)rows * cols);
+}
+
+cl_int dense_to_csr(float *A, int rows, int cols, csr_mat *csr) {
+  int nnz = 0;
+  for (long i = 0; i < (long)rows * cols; i++) {
+    if (A[i] != 0.0f)
+      nnz++;
+  }
+
+  csr->rows = rows;
+  csr->cols = cols;
+  csr->nnz = nnz;
+  csr->row_ptr = (int *) calloc(rows + 1, sizeof(int));
+  csr->col_idx = (int *) calloc(nnz ? nnz : 1, sizeof(int));
+  csr->val = (float *) calloc(nnz ? nnz : 1, sizeof(float));
+  if (!csr->row_ptr || !csr->col_idx || !csr->val) {
+    free_csr(csr);
+    return CL_OUT_OF_HOST_MEMORY;
+  }
+
+  int k = 0;
+  for (int j = 0; j < rows; j++) {
+    csr->row_ptr[j] = k;
+    for (int i = 0; i < cols; i++) {
+      float v = A[(long)j*cols+i];
+      if (v != 0.0f) {
+        csr->col_idx[k] = i;
+        csr->val[k] = v;
+        k++;
+      }
+    }
+  }
+  csr->row_ptr[rows] = k;
+  return CL_SUCCESS;
+}
+
+cl_int dense_to_ell(float *A, int rows, int cols, ell_mat *ell) {
+  int width = 0, nnz = 0;
+  for (int j = 0; j < rows; j++) {
+    int row_nnz = 0;
+    for (int i = 0; i < cols; i++) {
+      if (A[(long)j*cols+i] != 0.0f)
+        row_nnz++;
+    }
+    if (row_nnz > width)
+      width = row_nnz;
+    nnz += row_nnz;
+  }
+
+  ell->rows = rows;
+  ell->cols = cols;
+  ell->width = width;
+  ell->nnz = nnz;
+  size_t padded = (size_t)rows * (width ? width : 1);
+  ell->col_idx = (int *) malloc(padded * sizeof(int));
+  ell->val = (float *) calloc(padded, sizeof(float));
+  if (!ell->col_idx || !ell->val) {
+    free_ell(ell);
+    return CL_OUT_OF_HOST_MEMORY;
+  }
+  for (size_t i = 0; i < padded; i++)
+    ell->col_idx[i] = -1;
+
+  for (int j = 0; j < rows; j++) {
+    int k = 0;
+    for (int i = 0; i < cols; i++) {
+      float v = A[(long)j*cols+i];
+      if (v != 0.0f) {
+        ell->col_idx[(long)k*rows+j] = i;
+        ell->val[(long)k*rows+j] = v;
+        k++;
+      }
+    }
+  }
+  return CL_SUCCESS;
+}
+
+void free_csr(csr_mat *csr) {
+  free(csr->row_ptr);
+  free(csr->col_idx);
+  free(csr->val);
+  csr->row_ptr = csr->col_idx = NULL;
+  csr->val = NULL;
+}
+
+void free_ell(ell_mat *ell) {
+  free(ell->col_idx);
+  free(ell->val);
+  ell->col_idx = NULL;
+  ell->val = NULL;
+}
+
+// Dense above SPARSE_MAX_DENSITY, otherwise ELL when the longest row pads
+// the matrix by at most ELL_MAX_PADDING, otherwise CSR
+int choose_format(float *A, int rows, int cols) {
+  long nnz = 0;
+  int width = 0;
+  for (int j = 0; j < rows; j++) {
+    int row_nnz = 0;
+    for (int i = 0; i < cols; i++) {
+      if (A[(long)j*cols+i] != 0.0f)
+        row_nnz++;
+    }
+    if (row_nnz > width)
+      width = row_nnz;
+    nnz += row_nnz;
+  }
+
+  if (nnz > SPARSE_MAX_DENSITY * rows * cols)
+    return FORMAT_DENSE;
+  if (nnz == 0 || (double)width * rows <= ELL_MAX_PADDING * nnz)
+    return FORMAT_ELL;
+  return FORMAT_CSR;
+}
+
+const char* format_name(int format) {
+  switch (format) {
+    case FORMAT_DENSE:
+      return "dense";
+    case FORMAT_CSR:
+      return "csr";
+    case FORMAT_ELL:
+      return "ell";
+    default:
+      return "auto";
+  }
+}
+
+// Converts A to format, uploads it and creates the SpMV and SpMM kernels
+// suited to its row lengths. FORMAT_AUTO picks ELL or CSR, and CSR where
+// choose_format would say dense: whether to go dense at all is the
+// caller's call. FORMAT_DENSE is not a sparse format and is rejected.
+cl_int sparse_prepare(cl_context context, cl_device_id device, float *A, int rows, int cols, int format, sparse_dev *sp) {
+  cl_int err;
+  memset(sp, 0, sizeof(*sp));
+  if (format != FORMAT_AUTO && format != FORMAT_CSR && format != FORMAT_ELL)
+    return CL_INVALID_VALUE;
+  char defines[128];
+  snprintf(defines, sizeof(defines), "-D SPARSE_WG=%d -D SPMM_COLS=%d -D SPMM_LANES=%d", SPARSE_WG, SPMM_COLS, SPMM_LANES);
+  kernel_spec spec = {0};
+  spec.defines = defines;
+
+  if (format == FORMAT_AUTO) {
+    format = choose_format(A, rows, cols);
+    if (format == FORMAT_DENSE)
+      format = FORMAT_CSR;
+  }
+
+  sp->format = format;
+  sp->rows = rows;
+  sp->cols = cols;
+
+  if (format == FORMAT_CSR) {
+    csr_mat csr;
+    err = dense_to_csr(A, rows, cols, &csr);
+    if (err != CL_SUCCESS)
+      goto fail;
+    sp->nnz = csr.nnz;
+    sp->width = 0;
+    sp->long_rows = csr.nnz >= CSR_LONG_ROW * rows;
+
+    sp->row_ptr = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(int) * (rows + 1), csr.row_ptr, &err);
+    if (err == CL_SUCCESS)
+      sp->col_idx = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(int) * (csr.nnz ? csr.nnz : 1), csr.col_idx, &err);
+    if (err == CL_SUCCESS)
+      sp->val = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * (csr.nnz ? csr.nnz : 1), csr.val, &err);
+    free_csr(&csr);
+    if (err != CL_SUCCESS)
+      goto fail;
+
+    sp->ko_spmv = get_kernel(context, device, "sparse.cl", sp->long_rows ? "spmv_csr_wg" : "spmv_csr", &spec, &err);
+    if (err != CL_SUCCESS)
+      goto fail;
+    sp->ko_spmm = get_kernel(context, device, "sparse.cl", sp->long_rows ? "spmm_csr_wg" : "spmm_csr", &spec, &err);
+  } else {
+    ell_mat ell;
+    err = dense_to_ell(A, rows, cols, &ell);
+    if (err != CL_SUCCESS)
+      goto fail;
+    sp->nnz = ell.nnz;
+    sp->width = ell.width;
+    sp->long_rows = 0;
+
+    size_t padded = (size_t)rows * (ell.width ? ell.width : 1);
+    sp->col_idx = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(int) * padded, ell.col_idx, &err);
+    if (err == CL_SUCCESS)
+      sp->val = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * padded, ell.val, &err);
+    free_ell(&ell);
+    if (err != CL_SUCCESS)
+      goto fail;
+
+    sp->ko_spmv = get_kernel(context, device, "sparse.cl", "spmv_ell", &spec, &err);
+    if (err != CL_SUCCESS)
+      goto fail;
+    sp->ko_spmm = get_kernel(context, device, "sparse.cl", "spmm_ell", &spec, &err);
+  }
+  if (err == CL_SUCCESS)
+    return CL_SUCCESS;
+
+fail:
+  sparse_release(sp);
+  return err;
+}
+
+static size_t round_up(size_t x, size_t m) {
+  return (x + m - 1) / m * m;
+}
+
+// C = A B for dense B with ncols columns; ncols == 1 runs the SpMV kernel
+cl_int sparse_mmul(cl_command_queue commands, sparse_dev *sp, cl_mem d_b, cl_mem d_c, int ncols) {
+  cl_int err;
+  cl_uint arg = 0;
+  cl_kernel kernel = (ncols == 1) ? sp->ko_spmv : sp->ko_spmm;
+
+  if (sp->format == FORMAT_CSR)
+    err = clSetKernelArg(kernel, arg++, sizeof(cl_mem), &sp->row_ptr);
+  else
+    err = CL_SUCCESS;
+  err |= clSetKernelArg(kernel, arg++, sizeof(cl_mem), &sp->col_idx);
+  err |= clSetKernelArg(kernel, arg++, sizeof(cl_mem), &sp->val);
+  err |= clSetKernelArg(kernel, arg++, sizeof(cl_mem), &d_b);
+  err |= clSetKernelArg(kernel, arg++, sizeof(cl_mem), &d_c);
+  err |= clSetKernelArg(kernel, arg++, sizeof(int), &sp->rows);
+  if (sp->format == FORMAT_ELL)
+    err |= clSetKernelArg(kernel, arg++, sizeof(int), &sp->width);
+  if (ncols != 1)
+    err |= clSetKernelArg(kernel, arg++, sizeof(int), &ncols);
+  if (err != CL_SUCCESS)
+    return err;
+
+  if (ncols == 1) {
+    size_t global = sp->long_rows ? (size_t)sp->rows * SPARSE_WG : (size_t)sp->rows;
+    size_t local = SPARSE_WG;
+    return clEnqueueNDRangeKernel(commands, kernel, 1, NULL, &global, sp->long_rows ? &local : NULL, 0, NULL, TRACE_EV("kernel", "spmv"));
+  }
+
+  if (sp->long_rows) {
+    const size_t global[2] = {round_up(ncols, SPMM_COLS), (size_t)sp->rows * SPMM_LANES};
+    const size_t local[2] = {SPMM_COLS, SPMM_LANES};
+    return clEnqueueNDRangeKernel(commands, kernel, 2, NULL, global, local, 0, NULL, TRACE_EV("kernel", "spmm"));
+  }
+  const size_t global[2] = {ncols, sp->rows};
+  return clEnqueueNDRangeKernel(commands, kernel, 2, NULL, global, NULL, 0, NULL, TRACE_EV("kernel", "spmm"));
+}
+
+// Safe on a partly prepared operand
+void sparse_release(sparse_dev *sp) {
+  if (sp->row_ptr)
+    clReleaseMemObject(sp->row_ptr);
+  if (sp->col_idx)
+    clReleaseMemObject(sp->col_idx);
+  if (sp->val)
+    clReleaseMemObject(sp->val);
+  if (sp->ko_spmv)
+    clReleaseKernel(sp->ko_spmv);
+  if (sp->ko_spmm)
+    clReleaseKernel(sp->ko_spmm);
+  memset(sp, 0, sizeof(*sp));
+}
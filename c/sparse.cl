@@ -0,0 +1,113 @@
+#include "kernel_common.clh"
+
+#ifndef SPARSE_WG
+#define SPARSE_WG 64
+#endif
+#ifndef SPMM_COLS
+#define SPMM_COLS 16
+#endif
+#ifndef SPMM_LANES
+#define SPMM_LANES 16
+#endif
+
+// y = A x, one work-item per row of a CSR matrix
+__kernel void spmv_csr(__global int *row_ptr, __global int *col_idx, __global DTYPE *val, __global DTYPE *x, __global DTYPE *y, const int rows) {
+  int row = get_global_id(0);
+  if (row < rows) {
+    DTYPE sum = 0;
+    for (int k = row_ptr[row]; k < row_ptr[row+1]; k++)
+      sum += val[k] * x[col_idx[k]];
+    y[row] = sum;
+  }
+}
+
+// y = A x, one work-group of SPARSE_WG per CSR row with a local-memory
+// reduction, for rows long enough to keep a work-group busy
+__kernel void spmv_csr_wg(__global int *row_ptr, __global int *col_idx, __global DTYPE *val, __global DTYPE *x, __global DTYPE *y, const int rows) {
+  __local DTYPE partial[SPARSE_WG];
+  int row = get_group_id(0);
+  int lid = get_local_id(0);
+
+  DTYPE sum = 0;
+  if (row < rows) {
+    for (int k = row_ptr[row] + lid; k < row_ptr[row+1]; k += SPARSE_WG)
+      sum += val[k] * x[col_idx[k]];
+  }
+  partial[lid] = sum;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (int s = SPARSE_WG/2; s > 0; s >>= 1) {
+    if (lid < s)
+      partial[lid] += partial[lid+s];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  if (lid == 0 && row < rows)
+    y[row] = partial[0];
+}
+
+// y = A x for an ELL matrix, one work-item per row
+__kernel void spmv_ell(__global int *col_idx, __global DTYPE *val, __global DTYPE *x, __global DTYPE *y, const int rows, const int width) {
+  int row = get_global_id(0);
+  if (row < rows) {
+    DTYPE sum = 0;
+    for (int k = 0; k < width; k++) {
+      int col = col_idx[k*rows+row];
+      if (col >= 0)
+        sum += val[k*rows+row] * x[col];
+    }
+    y[row] = sum;
+  }
+}
+
+// C = A B with A in CSR and B dense rows x ncols, one work-item per element of C
+__kernel void spmm_csr(__global int *row_ptr, __global int *col_idx, __global DTYPE *val, __global DTYPE *b, __global DTYPE *c, const int rows, const int ncols) {
+  int i = get_global_id(0);
+  int row = get_global_id(1);
+  if (i < ncols && row < rows) {
+    DTYPE sum = 0;
+    for (int k = row_ptr[row]; k < row_ptr[row+1]; k++)
+      sum += val[k] * b[col_idx[k]*ncols+i];
+    c[row*ncols+i] = sum;
+  }
+}
+
+// C = A B with a SPMM_COLS x SPMM_LANES work-group per (row, column block):
+// the lanes split the row's nonzeros and are reduced in local memory
+__kernel void spmm_csr_wg(__global int *row_ptr, __global int *col_idx, __global DTYPE *val, __global DTYPE *b, __global DTYPE *c, const int rows, const int ncols) {
+  __local DTYPE partial[SPMM_LANES][SPMM_COLS];
+  int i = get_global_id(0);
+  int row = get_group_id(1);
+  int li = get_local_id(0);
+  int lk = get_local_id(1);
+
+  DTYPE sum = 0;
+  if (i < ncols && row < rows) {
+    for (int k = row_ptr[row] + lk; k < row_ptr[row+1]; k += SPMM_LANES)
+      sum += val[k] * b[col_idx[k]*ncols+i];
+  }
+  partial[lk][li] = sum;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (int s = SPMM_LANES/2; s > 0; s >>= 1) {
+    if (lk < s)
+      partial[lk][li] += partial[lk+s][li];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  if (lk == 0 && i < ncols && row < rows)
+    c[row*ncols+i] = partial[0][li];
+}
+
+// C = A B with A in ELL, one work-item per element of C
+__kernel void spmm_ell(__global int *col_idx, __global DTYPE *val, __global DTYPE *b, __global DTYPE *c, const int rows, const int width, const int ncols) {
+  int i = get_global_id(0);
+  int row = get_global_id(1);
+  if (i < ncols && row < rows) {
+    DTYPE sum = 0;
+    for (int k = 0; k < width; k++) {
+      int col = col_idx[k*rows+row];
+      if (col >= 0)
+        sum += val[k*rows+row] * b[col*ncols+i];
+    }
+    c[row*ncols+i] = sum;
+  }
+}
@@ -0,0 +1,61 @@
+#ifndef SPARSE
+#define SPARSE
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#define FORMAT_AUTO  (-1)
+#define FORMAT_DENSE (0)
+#define FORMAT_CSR   (1)
+#define FORMAT_ELL   (2)
+
+#define SPARSE_MAX_DENSITY (0.25)  // Above this the dense GEMM wins
+#define ELL_MAX_PADDING    (1.5)   // Max padded/actual nonzeros before ELL loses to CSR
+#define CSR_LONG_ROW       (32)    // Mean nonzeros per row that switches CSR to a work-group per row
+#define SPARSE_WG          (64)    // Work-group size of the long-row SpMV kernel
+#define SPMM_COLS          (16)    // Output columns per work-group in the long-row SpMM kernel
+#define SPMM_LANES         (16)    // Work-items splitting one row in the long-row SpMM kernel
+
+// Compressed sparse row
+typedef struct {
+  int rows, cols, nnz;
+  int *row_ptr;   // rows+1 offsets into col_idx/val
+  int *col_idx;
+  float *val;
+} csr_mat;
+
+// ELLPACK, every row padded to width entries and stored column-major
+// (entry k of row r at k*rows + r) so neighbouring work-items coalesce.
+// Padding has col_idx -1 and val 0.
+typedef struct {
+  int rows, cols, width, nnz;
+  int *col_idx;
+  float *val;
+} ell_mat;
+
+// Sparse operand resident on the device with its kernels chosen
+typedef struct {
+  int format;     // FORMAT_CSR or FORMAT_ELL
+  int rows, cols, width, nnz;
+  int long_rows;  // CSR uses the work-group-per-row kernels
+  cl_mem row_ptr, col_idx, val;
+  cl_kernel ko_spmv;
+  cl_kernel ko_spmm;
+} sparse_dev;
+
+double mat_density(float *A, int rows, int cols);
+cl_int dense_to_csr(float *A, int rows, int cols, csr_mat *csr);
+cl_int dense_to_ell(float *A, int rows, int cols, ell_mat *ell);
+void free_csr(csr_mat *csr);
+void free_ell(ell_mat *ell);
+int choose_format(float *A, int rows, int cols);
+const char* format_name(int format);
+
+cl_int sparse_prepare(cl_context context, cl_device_id device, float *A, int rows, int cols, int format, sparse_dev *sp);
+cl_int sparse_mmul(cl_command_queue commands, sparse_dev *sp, cl_mem d_b, cl_mem d_c, int ncols);
+void sparse_release(sparse_dev *sp);
+
+#endif
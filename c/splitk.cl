@@ -0,0 +1,35 @@
+#include "kernel_common.clh"
+
+// Rectangular c = a * b with K cut into slices: a is m x k, b is k x n, both
+// row-major, and slice s of work-item (i, j) lands in
+// partial[s*m*n + j*n + i]. With one slice partial is c itself.
+__kernel void mmul_splitk(__global DTYPE *a, __global DTYPE *b, __global DTYPE *partial,
+                          const int m, const int n, const int k, const int kslice) {
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  int s = get_global_id(2);
+  if (i >= n || j >= m)
+    return;
+
+  int k0 = s * kslice;
+  int k1 = min(k0 + kslice, k);
+  DTYPE tmp = 0;
+  for (int kk = k0; kk < k1; kk++) {
+    tmp += a[j*k+kk] * b[kk*n+i];
+  }
+  partial[(size_t)s*m*n + j*n + i] = tmp;
+}
+
+// c[idx] = sum of the splits partials of idx, in slice order so the result
+// doesn't depend on scheduling
+__kernel void splitk_reduce(__global DTYPE *partial, __global DTYPE *c, const int mn, const int splits) {
+  int idx = get_global_id(0);
+  if (idx >= mn)
+    return;
+
+  DTYPE tmp = 0;
+  for (int s = 0; s < splits; s++) {
+    tmp += partial[(size_t)s*mn + idx];
+  }
+  c[idx] = tmp;
+}
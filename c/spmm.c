@@ -0,0 +1,239 @@
+/*
+ * Sparse x dense multiplication benchmark (C = A * B, y = A * x)
+ *
+ * Sweeps the density of A and times the dense tiled mmul against the CSR
+ * and ELL kernels, marking the format choose_format() picks. Every SpMM and
+ * SpMV result is checked against the dense product.
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include<sys/types.h>
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#include <unistd.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "err_code.h"
+#include "mat_lib.h"
+#include "kernel_cache.h"
+#include "sparse.h"
+#include "device_info.h"
+
+#ifndef DEVICE
+#define DEVICE CL_DEVICE_TYPE_DEFAULT
+#endif
+
+extern double wtime();
+
+#define N     (512)  // Default matrix order, override with argv[1]
+#define REPS  (10)
+#define TOL   (0.0001)  // Max relative error of the sparse results
+
+static const double densities[] = {0.5, 0.1, 0.05, 0.01, 0.001};
+
+// Mean seconds per launch of the dense kernel
+double time_dense(cl_command_queue commands, cl_kernel kernel, cl_mem d_a, cl_mem d_b, cl_mem d_c, int n, const size_t *local) {
+  int err;
+  const size_t global[2] = {n, n};
+  err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_a);
+  err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_b);
+  err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_c);
+  err |= clSetKernelArg(kernel, 3, sizeof(int), &n);
+  checkError(err, "Setting kernel arguments");
+
+  double rtime = 0.0;
+  for (int r = 0; r <= REPS; r++) {
+    if (r == 1)
+      rtime = wtime();
+    err = clEnqueueNDRangeKernel(commands, kernel, 2, NULL, global, local, 0, NULL, NULL);
+    checkError(err, "Enqueueing kernel");
+    if (r == 0) {
+      err = clFinish(commands);
+      checkError(err, "Waiting for kernel to finish");
+    }
+  }
+  err = clFinish(commands);
+  checkError(err, "Waiting for kernel to finish");
+  return (wtime() - rtime) / REPS;
+}
+
+// Mean seconds per sparse_mmul, the first (warm-up) launch untimed
+double time_sparse(cl_command_queue commands, sparse_dev *sp, cl_mem d_b, cl_mem d_c, int ncols) {
+  int err;
+  double rtime = 0.0;
+  for (int r = 0; r <= REPS; r++) {
+    if (r == 1)
+      rtime = wtime();
+    err = sparse_mmul(commands, sp, d_b, d_c, ncols);
+    checkError(err, "Enqueueing sparse kernel");
+    if (r == 0) {
+      err = clFinish(commands);
+      checkError(err, "Waiting for kernel to finish");
+    }
+  }
+  err = clFinish(commands);
+  checkError(err, "Waiting for kernel to finish");
+  return (wtime() - rtime) / REPS;
+}
+
+// Relative error of y = A x, x the first column of B, against the first
+// column of the dense reference C
+double spmv_error(const float *ref, const float *y, int n) {
+  double diff = 0.0, norm = 0.0;
+  for (int i = 0; i < n; i++) {
+    double d = (double)y[i] - ref[(size_t)i*n];
+    diff += d * d;
+    norm += (double)ref[(size_t)i*n] * ref[(size_t)i*n];
+  }
+  return norm > 0.0 ? sqrt(diff / norm) : sqrt(diff);
+}
+
+int main(int argc, char** argv) {
+  int err;
+  int n = (argc > 1) ? atoi(argv[1]) : N;
+  int size = n*n;
+  int count = size;
+  int i;
+
+  float* h_a = (float *) calloc(size, sizeof(float));
+  float* h_b = (float *) calloc(size, sizeof(float));
+  float* h_c = (float *) calloc(size, sizeof(float));
+  float* h_ref = (float *) calloc(size, sizeof(float));
+
+  cl_device_id device_id;
+  cl_context context;
+  cl_command_queue commands;
+
+  srand(42);
+  for (i = 0; i < count; i++)
+    h_b[i] = rand() / (float)RAND_MAX;
+
+  // Set up platform and GPU device
+  cl_uint numPlatforms;
+  err = clGetPlatformIDs(0, NULL, &numPlatforms);
+  checkError(err, "Finding platforms");
+  if (numPlatforms == 0) {
+    printf("Found 0 platforms\n");
+    return EXIT_FAILURE;
+  }
+
+  cl_platform_id Platform[numPlatforms];
+  err = clGetPlatformIDs(numPlatforms, Platform, NULL);
+  checkError(err, "Getting platforms");
+
+  for (i = 0; i < numPlatforms; i++) {
+    err = clGetDeviceIDs(Platform[i], DEVICE, 1, &device_id, NULL);
+    if (err == CL_SUCCESS) {
+      break;
+    }
+  }
+
+  if (device_id == NULL)
+    checkError(err, "Finding a device");
+
+  err = output_device_info(device_id);
+  checkError(err, "Finding device output");
+
+  device_caps caps;
+  err = query_device_caps(device_id, &caps);
+  checkError(err, "Querying device capabilities");
+  int tile = caps_gemm_tile(&caps);
+
+  context = clCreateContext(0, 1, &device_id, NULL, NULL, &err);
+  checkError(err, "Creating context");
+
+  commands = clCreateCommandQueue(context, device_id, 0, &err);
+  checkError(err, "Creating command queue");
+
+  cl_mem d_a = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float) * count, NULL, &err);
+  checkError(err, "Creating buffer d_a");
+  cl_mem d_b = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float) * count, NULL, &err);
+  checkError(err, "Creating buffer d_b");
+  cl_mem d_c = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(float) * count, NULL, &err);
+  checkError(err, "Creating buffer d_c");
+  err = clEnqueueWriteBuffer(commands, d_b, CL_TRUE, 0, sizeof(float) * count, h_b, 0, NULL, NULL);
+  checkError(err, "Copying h_b to device at d_b");
+
+  kernel_spec tiled = choose_mmul_spec(n, tile);
+  const size_t local_work_size[2] = {tile, tile};
+  cl_kernel ko_dense = get_kernel(context, device_id, "kernel.cl", tiled.tile ? "mmul_tiled" : "mmul", &tiled, &err);
+  checkError(err, "Creating kernel");
+
+  int failures = 0;
+  printf("\nN = %d, %d launches per kernel, * marks the automatic choice\n", n, REPS);
+  printf("%-9s %-6s %12s %12s %12s %12s %s\n", "density", "op", "dense", "csr", "ell", "best", "rel err csr/ell");
+
+  for (int d = 0; d < sizeof(densities) / sizeof(densities[0]); d++) {
+    for (i = 0; i < count; i++)
+      h_a[i] = (rand() / (float)RAND_MAX < densities[d]) ? rand() / (float)RAND_MAX : 0.0f;
+    sequential_mat_mul(h_a, h_b, h_ref, n);
+    int choice = choose_format(h_a, n, n);
+
+    err = clEnqueueWriteBuffer(commands, d_a, CL_TRUE, 0, sizeof(float) * count, h_a, 0, NULL, NULL);
+    checkError(err, "Copying h_a to device at d_a");
+
+    sparse_dev csr, ell;
+    err = sparse_prepare(context, device_id, h_a, n, n, FORMAT_CSR, &csr);
+    checkError(err, "Preparing CSR operand");
+    err = sparse_prepare(context, device_id, h_a, n, n, FORMAT_ELL, &ell);
+    checkError(err, "Preparing ELL operand");
+
+    // SpMM against the whole of B
+    double t_dense = time_dense(commands, ko_dense, d_a, d_b, d_c, n, tiled.tile ? local_work_size : NULL);
+    double t_csr = time_sparse(commands, &csr, d_b, d_c, n);
+    err = clEnqueueReadBuffer(commands, d_c, CL_TRUE, 0, sizeof(float) * count, h_c, 0, NULL, NULL);
+    checkError(err, "Reading CSR result");
+    double e_csr = rel_error(h_ref, h_c, n);
+    double t_ell = time_sparse(commands, &ell, d_b, d_c, n);
+    err = clEnqueueReadBuffer(commands, d_c, CL_TRUE, 0, sizeof(float) * count, h_c, 0, NULL, NULL);
+    checkError(err, "Reading ELL result");
+    double e_ell = rel_error(h_ref, h_c, n);
+    failures += (e_csr > TOL) + (e_ell > TOL);
+
+    printf("%-9g %-6s %11lf%s %11lf%s %11lf%s %12s %.1e/%.1e\n", densities[d], "spmm",
+      t_dense, choice == FORMAT_DENSE ? "*" : " ",
+      t_csr, choice == FORMAT_CSR ? "*" : " ",
+      t_ell, choice == FORMAT_ELL ? "*" : " ",
+      t_dense <= t_csr && t_dense <= t_ell ? "dense" : (t_csr <= t_ell ? "csr" : "ell"), e_csr, e_ell);
+
+    // SpMV against the first column of B, stored as a vector
+    for (i = 0; i < n; i++)
+      h_c[i] = h_b[i*n];
+    err = clEnqueueWriteBuffer(commands, d_a, CL_TRUE, 0, sizeof(float) * n, h_c, 0, NULL, NULL);
+    checkError(err, "Copying x to device");
+    double t_csr_v = time_sparse(commands, &csr, d_a, d_c, 1);
+    err = clEnqueueReadBuffer(commands, d_c, CL_TRUE, 0, sizeof(float) * n, h_c, 0, NULL, NULL);
+    checkError(err, "Reading CSR SpMV result");
+    double e_csr_v = spmv_error(h_ref, h_c, n);
+    double t_ell_v = time_sparse(commands, &ell, d_a, d_c, 1);
+    err = clEnqueueReadBuffer(commands, d_c, CL_TRUE, 0, sizeof(float) * n, h_c, 0, NULL, NULL);
+    checkError(err, "Reading ELL SpMV result");
+    double e_ell_v = spmv_error(h_ref, h_c, n);
+    failures += (e_csr_v > TOL) + (e_ell_v > TOL);
+    printf("%-9s %-6s %12s %11lf%s %11lf%s %12s %.1e/%.1e (%s rows)\n", "", "spmv", "-",
+      t_csr_v, choice == FORMAT_CSR ? "*" : " ", t_ell_v, choice == FORMAT_ELL ? "*" : " ",
+      t_csr_v <= t_ell_v ? "csr" : "ell", e_csr_v, e_ell_v, csr.long_rows ? "long" : "short");
+
+    sparse_release(&csr);
+    sparse_release(&ell);
+  }
+
+  clReleaseKernel(ko_dense);
+  clReleaseMemObject(d_a);
+  clReleaseMemObject(d_b);
+  clReleaseMemObject(d_c);
+  release_programs();
+  clReleaseCommandQueue(commands);
+  clReleaseContext(context);
+
+  free(h_a);
+  free(h_b);
+  free(h_c);
+  free(h_ref);
+
+  return failures ? EXIT_FAILURE : 0;
+}
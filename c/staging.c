@@ -0,0 +1,155 @@
+/*
+ * Pinned staging-buffer ring for asynchronous host <-> device transfers
+ *
+ * Transfers from pageable (malloc) memory make the driver bounce through its
+ * own pinned copy and block the host. Here the bounce buffers are ours:
+ * CL_MEM_ALLOC_HOST_PTR buffers mapped once, used round robin, each guarded
+ * by the event of the last transfer through it.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "staging.h"
+#include "trace.h"
+
+// Seconds between start and end of a command, 0 if the queue isn't profiling
+double event_seconds(cl_event event) {
+  cl_ulong start, end;
+  if (clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL) != CL_SUCCESS ||
+      clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL) != CL_SUCCESS)
+    return 0.0;
+  return (end - start) * 1e-9;
+}
+
+void print_transfer(const char *label, size_t bytes, double host_secs, double device_secs) {
+  printf("%-20s %10.3f ms host %10.3f ms device %9.2f GB/s\n", label, host_secs * 1e3, device_secs * 1e3,
+    device_secs > 0.0 ? bytes / device_secs * 1e-9 : 0.0);
+}
+
+// Wait for the slot's last transfer, then account for it and copy out a read
+static cl_int reclaim(staging_ring *r, staging_slot *s) {
+  if (s->done == NULL)
+    return CL_SUCCESS;
+
+  cl_int err;
+  TRACE("staging", "reclaim wait", err = clWaitForEvents(1, &s->done));
+  if (err == CL_SUCCESS) {
+    double t = event_seconds(s->done);
+    if (s->dst) {
+      TRACE("staging", "copy out", memcpy(s->dst, s->host, s->bytes));
+      r->read_secs += t;
+      r->read_bytes += s->bytes;
+    } else {
+      r->write_secs += t;
+      r->write_bytes += s->bytes;
+    }
+  }
+  clReleaseEvent(s->done);
+  s->done = NULL;
+  s->dst = NULL;
+  return err;
+}
+
+cl_int staging_init(staging_ring *r, cl_context context, cl_command_queue commands, size_t slot_size) {
+  cl_int err = CL_SUCCESS;
+  memset(r, 0, sizeof(*r));
+  r->commands = commands;
+  r->slot_size = slot_size ? slot_size : STAGING_SLOT_BYTES;
+
+  for (int i = 0; i < STAGING_SLOTS; i++) {
+    staging_slot *s = &r->slot[i];
+    s->buf = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, r->slot_size, NULL, &err);
+    if (err != CL_SUCCESS)
+      return err;
+    s->host = clEnqueueMapBuffer(commands, s->buf, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, r->slot_size, 0, NULL, NULL, &err);
+    if (err != CL_SUCCESS)
+      return err;
+  }
+  return err;
+}
+
+// Next slot for the caller to fill, at most slot_size bytes, then staging_submit
+void *staging_acquire(staging_ring *r, cl_int *err) {
+  staging_slot *s = &r->slot[r->next];
+  *err = reclaim(r, s);
+  return (*err == CL_SUCCESS) ? s->host : NULL;
+}
+
+// Enqueue the acquired slot's contents to dst and move on to the next slot
+cl_int staging_submit(staging_ring *r, cl_mem dst, size_t offset, size_t bytes) {
+  staging_slot *s = &r->slot[r->next];
+  cl_int err = clEnqueueWriteBuffer(r->commands, dst, CL_FALSE, offset, bytes, s->host, 0, NULL, &s->done);
+  if (err != CL_SUCCESS)
+    return err;
+  TRACE_EVENT("transfer", "staged write", s->done);
+  s->bytes = bytes;
+  r->next = (r->next + 1) % STAGING_SLOTS;
+  // Start the transfer now rather than at the next blocking call
+  return clFlush(r->commands);
+}
+
+// Returns once src has been copied into the ring, the device write may
+// still be in flight
+cl_int staging_write(staging_ring *r, cl_mem dst, size_t offset, const void *src, size_t bytes) {
+  cl_int err = CL_SUCCESS;
+  for (size_t done = 0; done < bytes; done += r->slot_size) {
+    size_t chunk = (bytes - done < r->slot_size) ? bytes - done : r->slot_size;
+    void *host = staging_acquire(r, &err);
+    if (host == NULL)
+      return err;
+    TRACE("staging", "copy in", memcpy(host, (const char *)src + done, chunk));
+    err = staging_submit(r, dst, offset + done, chunk);
+    if (err != CL_SUCCESS)
+      return err;
+  }
+  return err;
+}
+
+// Up to STAGING_SLOTS chunks are read ahead; returns with dst filled
+cl_int staging_read(staging_ring *r, cl_mem src, size_t offset, void *dst, size_t bytes) {
+  cl_int err;
+  for (size_t done = 0; done < bytes; done += r->slot_size) {
+    size_t chunk = (bytes - done < r->slot_size) ? bytes - done : r->slot_size;
+    staging_slot *s = &r->slot[r->next];
+    err = reclaim(r, s);
+    if (err != CL_SUCCESS)
+      return err;
+    err = clEnqueueReadBuffer(r->commands, src, CL_FALSE, offset + done, chunk, s->host, 0, NULL, &s->done);
+    if (err != CL_SUCCESS)
+      return err;
+    TRACE_EVENT("transfer", "staged read", s->done);
+    s->dst = (char *)dst + done;
+    s->bytes = chunk;
+    r->next = (r->next + 1) % STAGING_SLOTS;
+  }
+  err = clFlush(r->commands);
+  if (err != CL_SUCCESS)
+    return err;
+  return staging_finish(r);
+}
+
+// Wait for every slot; pending reads land in their destinations
+cl_int staging_finish(staging_ring *r) {
+  cl_int err = CL_SUCCESS;
+  for (int i = 0; i < STAGING_SLOTS; i++) {
+    cl_int e = reclaim(r, &r->slot[i]);
+    if (err == CL_SUCCESS)
+      err = e;
+  }
+  return err;
+}
+
+void staging_release(staging_ring *r) {
+  staging_finish(r);
+  for (int i = 0; i < STAGING_SLOTS; i++) {
+    staging_slot *s = &r->slot[i];
+    if (s->host)
+      clEnqueueUnmapMemObject(r->commands, s->buf, s->host, 0, NULL, NULL);
+  }
+  clFinish(r->commands);
+  for (int i = 0; i < STAGING_SLOTS; i++) {
+    if (r->slot[i].buf)
+      clReleaseMemObject(r->slot[i].buf);
+  }
+}
@@ -0,0 +1,47 @@
+#ifndef STAGING
+#define STAGING
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#define STAGING_SLOTS      (4)          // Transfers that can be in flight at once
+#define STAGING_SLOT_BYTES (4 << 20)    // Default slot size, larger transfers are chunked
+
+// One pinned staging buffer, mapped for the life of the ring
+typedef struct {
+  cl_mem buf;      // CL_MEM_ALLOC_HOST_PTR buffer backing host
+  void *host;
+  cl_event done;   // last transfer through the slot, NULL when idle
+  void *dst;       // where a pending read is copied out to on reclaim
+  size_t bytes;
+} staging_slot;
+
+// Ring of staging slots on one queue. Writes copy into the next free slot
+// and return as soon as the non-blocking transfer is enqueued; a slot is
+// reclaimed by waiting on its event when the ring comes round to it again.
+typedef struct {
+  cl_command_queue commands;
+  size_t slot_size;
+  int next;
+  staging_slot slot[STAGING_SLOTS];
+  double write_secs;   // device time of reclaimed transfers, needs a profiling queue
+  double read_secs;
+  size_t write_bytes;
+  size_t read_bytes;
+} staging_ring;
+
+cl_int staging_init(staging_ring *r, cl_context context, cl_command_queue commands, size_t slot_size);
+void *staging_acquire(staging_ring *r, cl_int *err);
+cl_int staging_submit(staging_ring *r, cl_mem dst, size_t offset, size_t bytes);
+cl_int staging_write(staging_ring *r, cl_mem dst, size_t offset, const void *src, size_t bytes);
+cl_int staging_read(staging_ring *r, cl_mem src, size_t offset, void *dst, size_t bytes);
+cl_int staging_finish(staging_ring *r);
+void staging_release(staging_ring *r);
+
+double event_seconds(cl_event event);
+void print_transfer(const char *label, size_t bytes, double host_secs, double device_secs);
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * Strassen-Winograd matrix multiplication on top of the OpenCL GEMM
+ *
+ * Each level splits A and B into quadrants, forms the Winograd sums with
+ * the madd kernel and recurses on 7 half-size products. Below the cutoff
+ * (or once the order turns odd) the tiled mmul kernel takes over.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "strassen.h"
+#include "kernel_cache.h"
+#include "trace.h"
+
+enum { A11, A12, A21, A22, B11, B12, B21, B22, C11, C12, C21, C22, X, Y, P, Q };
+
+// Number of halvings of n before reaching the cutoff
+int strassen_levels(int n, int cutoff) {
+  int levels = 0;
+  while (n > cutoff && n % 2 == 0) {
+    n /= 2;
+    levels++;
+  }
+  return levels;
+}
+
+cl_int strassen_init(strassen_ws *ws, cl_context context, cl_device_id device, int n, int cutoff, int tile) {
+  cl_int err;
+  memset(ws, 0, sizeof(*ws));
+
+  ws->n = n;
+  ws->levels = strassen_levels(n, cutoff);
+  ws->bufs = calloc(ws->levels * STRASSEN_BUFS, sizeof(cl_mem));
+  if (!ws->bufs) {
+    ws->levels = 0;
+    return CL_OUT_OF_HOST_MEMORY;
+  }
+
+  for (int l = 0; l < ws->levels; l++) {
+    int h = n >> (l+1);
+    for (int b = 0; b < STRASSEN_BUFS; b++) {
+      ws->bufs[l*STRASSEN_BUFS+b] = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * h * h, NULL, &err);
+      if (err != CL_SUCCESS)
+        goto fail;
+    }
+  }
+
+  ws->ko_madd = get_kernel(context, device, "strassen.cl", "madd", NULL, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  ws->ko_split = get_kernel(context, device, "strassen.cl", "split_quad", NULL, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  ws->ko_merge = get_kernel(context, device, "strassen.cl", "merge_quad", NULL, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+
+  int base_n = n >> ws->levels;
+  kernel_spec spec = choose_mmul_spec(base_n, tile);
+  ws->base_tiled = spec.tile > 0;
+  ws->base_local[0] = ws->base_local[1] = tile;
+  ws->ko_base = get_kernel(context, device, "kernel.cl", ws->base_tiled ? "mmul_tiled" : "mmul", &spec, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  return CL_SUCCESS;
+
+fail:
+  strassen_release(ws);
+  return err;
+}
+
+// c = a + beta * b over count elements
+static cl_int madd(strassen_ws *ws, cl_command_queue commands, cl_mem a, cl_mem b, cl_mem c, float beta, unsigned int count) {
+  cl_int err;
+  size_t global = count;
+  err = clSetKernelArg(ws->ko_madd, 0, sizeof(cl_mem), &a);
+  err |= clSetKernelArg(ws->ko_madd, 1, sizeof(cl_mem), &b);
+  err |= clSetKernelArg(ws->ko_madd, 2, sizeof(cl_mem), &c);
+  err |= clSetKernelArg(ws->ko_madd, 3, sizeof(float), &beta);
+  err |= clSetKernelArg(ws->ko_madd, 4, sizeof(unsigned int), &count);
+  if (err != CL_SUCCESS)
+    return err;
+  return clEnqueueNDRangeKernel(commands, ws->ko_madd, 1, NULL, &global, NULL, 0, NULL, TRACE_EV("kernel", "madd"));
+}
+
+// Splits (merge == 0) or merges (merge == 1) a 2h x 2h matrix and its quadrants
+static cl_int quads(cl_command_queue commands, cl_kernel kernel, cl_mem full, cl_mem *q, int h, int merge) {
+  cl_int err;
+  const size_t global[2] = {h, h};
+  err = clSetKernelArg(kernel, merge ? 4 : 0, sizeof(cl_mem), &full);
+  for (int i = 0; i < 4; i++)
+    err |= clSetKernelArg(kernel, (merge ? 0 : 1) + i, sizeof(cl_mem), &q[i]);
+  err |= clSetKernelArg(kernel, 5, sizeof(int), &h);
+  if (err != CL_SUCCESS)
+    return err;
+  return clEnqueueNDRangeKernel(commands, kernel, 2, NULL, global, NULL, 0, NULL, TRACE_EV("kernel", merge ? "merge_quad" : "split_quad"));
+}
+
+static cl_int base_mmul(strassen_ws *ws, cl_command_queue commands, cl_mem a, cl_mem b, cl_mem c, int n) {
+  cl_int err;
+  const size_t global[2] = {n, n};
+  err = clSetKernelArg(ws->ko_base, 0, sizeof(cl_mem), &a);
+  err |= clSetKernelArg(ws->ko_base, 1, sizeof(cl_mem), &b);
+  err |= clSetKernelArg(ws->ko_base, 2, sizeof(cl_mem), &c);
+  err |= clSetKernelArg(ws->ko_base, 3, sizeof(int), &n);
+  if (err != CL_SUCCESS)
+    return err;
+  return clEnqueueNDRangeKernel(commands, ws->ko_base, 2, NULL, global, ws->base_tiled ? ws->base_local : NULL, 0, NULL, TRACE_EV("kernel", "strassen base"));
+}
+
+#define TRY(call) do { cl_int e_ = (call); if (e_ != CL_SUCCESS) return e_; } while (0)
+
+static cl_int recurse(strassen_ws *ws, cl_command_queue commands, cl_mem a, cl_mem b, cl_mem c, int level, int n) {
+  if (level == ws->levels)
+    return base_mmul(ws, commands, a, b, c, n);
+
+  int h = n / 2;
+  unsigned int count = h * h;
+  cl_mem *w = &ws->bufs[level*STRASSEN_BUFS];
+
+  TRY(quads(commands, ws->ko_split, a, &w[A11], h, 0));
+  TRY(quads(commands, ws->ko_split, b, &w[B11], h, 0));
+
+  // C11 = M1 + M2, keeping M1 in P
+  TRY(recurse(ws, commands, w[A11], w[B11], w[P], level+1, h));
+  TRY(recurse(ws, commands, w[A12], w[B21], w[C11], level+1, h));
+  TRY(madd(ws, commands, w[C11], w[P], w[C11], 1.0f, count));
+
+  // M5 = S1 * T1 into C22
+  TRY(madd(ws, commands, w[A21], w[A22], w[X], 1.0f, count));
+  TRY(madd(ws, commands, w[B12], w[B11], w[Y], -1.0f, count));
+  TRY(recurse(ws, commands, w[X], w[Y], w[C22], level+1, h));
+
+  // U2 = M1 + M6 into P, with M6 = S2 * T2
+  TRY(madd(ws, commands, w[X], w[A11], w[X], -1.0f, count));
+  TRY(madd(ws, commands, w[B22], w[Y], w[Y], -1.0f, count));
+  TRY(recurse(ws, commands, w[X], w[Y], w[Q], level+1, h));
+  TRY(madd(ws, commands, w[P], w[Q], w[P], 1.0f, count));
+
+  // C12 = U2 + M5 + M3, with M3 = S4 * B22
+  TRY(madd(ws, commands, w[A12], w[X], w[X], -1.0f, count));
+  TRY(recurse(ws, commands, w[X], w[B22], w[C12], level+1, h));
+  TRY(madd(ws, commands, w[C12], w[C22], w[C12], 1.0f, count));
+  TRY(madd(ws, commands, w[C12], w[P], w[C12], 1.0f, count));
+
+  // M4 = A22 * T4 into Q
+  TRY(madd(ws, commands, w[Y], w[B21], w[Y], -1.0f, count));
+  TRY(recurse(ws, commands, w[A22], w[Y], w[Q], level+1, h));
+
+  // U3 = U2 + M7 into C21, with M7 = S3 * T3; then C22 = U3 + M5, C21 = U3 - M4
+  TRY(madd(ws, commands, w[A11], w[A21], w[X], -1.0f, count));
+  TRY(madd(ws, commands, w[B22], w[B12], w[Y], -1.0f, count));
+  TRY(recurse(ws, commands, w[X], w[Y], w[C21], level+1, h));
+  TRY(madd(ws, commands, w[C21], w[P], w[C21], 1.0f, count));
+  TRY(madd(ws, commands, w[C22], w[C21], w[C22], 1.0f, count));
+  TRY(madd(ws, commands, w[C21], w[Q], w[C21], -1.0f, count));
+
+  return quads(commands, ws->ko_merge, c, &w[C11], h, 1);
+}
+
+// c = a * b for the n x n matrices the workspace was initialised for
+cl_int strassen_mmul(strassen_ws *ws, cl_command_queue commands, cl_mem d_a, cl_mem d_b, cl_mem d_c) {
+  return recurse(ws, commands, d_a, d_b, d_c, 0, ws->n);
+}
+
+void strassen_release(strassen_ws *ws) {
+  for (int i = 0; ws->bufs && i < ws->levels * STRASSEN_BUFS; i++) {
+    if (ws->bufs[i])
+      clReleaseMemObject(ws->bufs[i]);
+  }
+  free(ws->bufs);
+  if (ws->ko_madd)
+    clReleaseKernel(ws->ko_madd);
+  if (ws->ko_split)
+    clReleaseKernel(ws->ko_split);
+  if (ws->ko_merge)
+    clReleaseKernel(ws->ko_merge);
+  if (ws->ko_base)
+    clReleaseKernel(ws->ko_base);
+  memset(ws, 0, sizeof(*ws));
+}
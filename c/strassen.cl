@@ -0,0 +1,34 @@
+#include "kernel_common.clh"
+
+// Element-wise c = a + beta * b, the vadd pattern with a sign/scale on b.
+// c may alias a or b since every work-item reads before it writes.
+__kernel void madd(__global DTYPE *a, __global DTYPE *b, __global DTYPE *c, const DTYPE beta, const unsigned int count) {
+  int i = get_global_id(0);
+  if (i < count)
+    c[i] = a[i] + beta * b[i];
+}
+
+// Copies the four dim x dim quadrants of a (2*dim) x (2*dim) matrix into
+// contiguous buffers
+__kernel void split_quad(__global DTYPE *src, __global DTYPE *q11, __global DTYPE *q12, __global DTYPE *q21, __global DTYPE *q22, const int dim) {
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  int ld = 2*dim;
+
+  q11[j*dim+i] = src[j*ld+i];
+  q12[j*dim+i] = src[j*ld+dim+i];
+  q21[j*dim+i] = src[(j+dim)*ld+i];
+  q22[j*dim+i] = src[(j+dim)*ld+dim+i];
+}
+
+// Inverse of split_quad
+__kernel void merge_quad(__global DTYPE *q11, __global DTYPE *q12, __global DTYPE *q21, __global DTYPE *q22, __global DTYPE *dst, const int dim) {
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  int ld = 2*dim;
+
+  dst[j*ld+i] = q11[j*dim+i];
+  dst[j*ld+dim+i] = q12[j*dim+i];
+  dst[(j+dim)*ld+i] = q21[j*dim+i];
+  dst[(j+dim)*ld+dim+i] = q22[j*dim+i];
+}
@@ -0,0 +1,32 @@
+#ifndef STRASSEN
+#define STRASSEN
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+// Buffers per recursion level: quadrants of A, B and C plus four temporaries
+#define STRASSEN_BUFS (16)
+
+// Workspace for Strassen-Winograd on n x n matrices. All device buffers are
+// allocated up front by strassen_init and reused by every strassen_mmul call.
+typedef struct {
+  int n;
+  int levels;          // recursion depth before falling back to GEMM
+  size_t base_local[2];
+  int base_tiled;
+  cl_mem *bufs;        // levels * STRASSEN_BUFS buffers, level l holds (n>>(l+1))^2 floats
+  cl_kernel ko_madd;
+  cl_kernel ko_split;
+  cl_kernel ko_merge;
+  cl_kernel ko_base;   // GEMM used below the cutoff
+} strassen_ws;
+
+int strassen_levels(int n, int cutoff);
+cl_int strassen_init(strassen_ws *ws, cl_context context, cl_device_id device, int n, int cutoff, int tile);
+cl_int strassen_mmul(strassen_ws *ws, cl_command_queue commands, cl_mem d_a, cl_mem d_b, cl_mem d_c);
+void strassen_release(strassen_ws *ws);
+
+#endif
@@ -0,0 +1,300 @@
+/*
+ * Work-stealing thread pool for the host backend
+ *
+ * A job is a range of task indices, dealt out in equal slices to per-worker
+ * deques. Owners work through their slice a grain at a time; a worker that
+ * runs dry steals half of the remainder of another worker's slice, trying
+ * workers on its own NUMA node before going across nodes. On Linux the
+ * workers are pinned to the CPUs the process may run on, grouped by node;
+ * pools alive at the same time get different CPUs, and a pool that can't
+ * find enough free ones leaves its workers to the scheduler.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "threadpool.h"
+
+#ifdef __linux__
+// Node of each CPU from /sys, -1 where it isn't listed
+static void cpu_nodes(int *node, int max_cpu) {
+  for (int c = 0; c < max_cpu; c++)
+    node[c] = -1;
+  for (int n = 0; n < 1024; n++) {
+    char path[64], list[4096];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+      break;
+    if (fgets(list, sizeof(list), fp)) {
+      // Ranges like "0-3,8-11"
+      char *p = list;
+      while (*p >= '0' && *p <= '9') {
+        int lo = (int)strtol(p, &p, 10), hi = lo;
+        if (*p == '-')
+          hi = (int)strtol(p + 1, &p, 10);
+        for (int c = lo; c <= hi && c < max_cpu; c++)
+          node[c] = n;
+        if (*p == ',')
+          p++;
+      }
+    }
+    fclose(fp);
+  }
+}
+
+// CPUs that workers of live pools are pinned to
+static pthread_mutex_t claim_lock = PTHREAD_MUTEX_INITIALIZER;
+static cpu_set_t claimed;
+
+// Gives workers 1.. a CPU each from the process's affinity mask that no
+// other live pool has claimed, CPUs of one node next to each other so
+// neighbouring workers share a node. Worker 0 is the caller and stays as is.
+static void place_workers(thread_pool *p) {
+  static int node[CPU_SETSIZE];
+  int cpus[CPU_SETSIZE], count = 0;
+  cpu_set_t mask;
+  if (sched_getaffinity(0, sizeof(mask), &mask) != 0)
+    return;
+  pthread_mutex_lock(&claim_lock);
+  cpu_nodes(node, CPU_SETSIZE);
+  for (int n = -1; n < 1024 && count < CPU_COUNT(&mask); n++) {
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+      if (CPU_ISSET(c, &mask) && node[c] == n && !CPU_ISSET(c, &claimed))
+        cpus[count++] = c;
+    }
+  }
+  // Oversubscribed, or short of CPUs another pool left free: leave it to
+  // the scheduler. cpus[0] is kept for the caller.
+  if (count >= p->threads) {
+    for (int i = 1; i < p->threads; i++) {
+      p->deque[i].cpu = cpus[i];
+      p->deque[i].node = node[cpus[i]];
+      CPU_SET(cpus[i], &claimed);
+    }
+  }
+  pthread_mutex_unlock(&claim_lock);
+}
+
+// Hands the CPUs of workers from.. back for other pools
+static void unplace_workers(thread_pool *p, int from) {
+  pthread_mutex_lock(&claim_lock);
+  for (int i = from; i < p->threads; i++) {
+    if (p->deque[i].cpu >= 0)
+      CPU_CLR(p->deque[i].cpu, &claimed);
+    p->deque[i].cpu = -1;
+  }
+  pthread_mutex_unlock(&claim_lock);
+}
+
+static void pin(pool_deque *d) {
+  cpu_set_t mask;
+  if (d->cpu < 0)
+    return;
+  CPU_ZERO(&mask);
+  CPU_SET(d->cpu, &mask);
+  pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+}
+#else
+static void place_workers(thread_pool *p) {
+  (void)p;
+}
+
+static void unplace_workers(thread_pool *p, int from) {
+  (void)p;
+  (void)from;
+}
+
+static void pin(pool_deque *d) {
+  (void)d;
+}
+#endif
+
+// Next grain of self's own deque, taken from the top
+static int take(thread_pool *p, int self, long *begin, long *end) {
+  pool_deque *d = &p->deque[self];
+  int got = 0;
+  pthread_mutex_lock(&d->lock);
+  if (d->lo < d->hi) {
+    *end = d->hi;
+    *begin = (d->hi - d->lo > p->grain) ? d->hi - p->grain : d->lo;
+    d->hi = *begin;
+    got = 1;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return got;
+}
+
+// Moves half of a victim's remaining tasks, from the bottom, into self's
+// deque; same-node victims first
+static int steal(thread_pool *p, int self) {
+  int node = p->deque[self].node;
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 1; i < p->threads; i++) {
+      pool_deque *v = &p->deque[(self + i) % p->threads];
+      if ((v->node == node) != (pass == 0))
+        continue;
+      long lo = 0, hi = 0;
+      pthread_mutex_lock(&v->lock);
+      if (v->lo < v->hi) {
+        lo = v->lo;
+        hi = v->lo + (v->hi - v->lo + 1) / 2;
+        v->lo = hi;
+      }
+      pthread_mutex_unlock(&v->lock);
+      if (lo < hi) {
+        pool_deque *d = &p->deque[self];
+        pthread_mutex_lock(&d->lock);
+        d->lo = lo;
+        d->hi = hi;
+        pthread_mutex_unlock(&d->lock);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// Runs tasks of the current job until every one of them has finished
+static void work(thread_pool *p, int self, pool_task fn, void *arg) {
+  long begin, end;
+  while (__atomic_load_n(&p->pending, __ATOMIC_ACQUIRE) > 0) {
+    if (take(p, self, &begin, &end)) {
+      fn(arg, begin, end);
+      __atomic_sub_fetch(&p->pending, end - begin, __ATOMIC_ACQ_REL);
+    } else if (!steal(p, self)) {
+      sched_yield();
+    }
+  }
+}
+
+static void* worker(void *a) {
+  thread_pool *p = ((pool_worker *)a)->pool;
+  int self = ((pool_worker *)a)->self;
+  unsigned long seen = 0;
+  pin(&p->deque[self]);
+
+  pthread_mutex_lock(&p->lock);
+  for (;;) {
+    while (p->generation == seen && !p->stop)
+      pthread_cond_wait(&p->wake, &p->lock);
+    if (p->stop)
+      break;
+    seen = p->generation;
+    // Join only while the job is unfinished, pool_run waits for joiners
+    if (__atomic_load_n(&p->pending, __ATOMIC_ACQUIRE) == 0)
+      continue;
+    pool_task fn = p->fn;
+    void *arg = p->arg;
+    p->active++;
+    pthread_mutex_unlock(&p->lock);
+
+    work(p, self, fn, arg);
+
+    pthread_mutex_lock(&p->lock);
+    p->active--;
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+// threads 0 takes CLRT_THREADS from the environment, or one per CPU the
+// process may run on
+int pool_init(thread_pool *p, int threads) {
+  memset(p, 0, sizeof(*p));
+  if (threads <= 0) {
+    const char *env = getenv("CLRT_THREADS");
+    threads = env ? atoi(env) : 0;
+  }
+  if (threads <= 0) {
+#ifdef __linux__
+    cpu_set_t mask;
+    threads = (sched_getaffinity(0, sizeof(mask), &mask) == 0) ? CPU_COUNT(&mask) : 0;
+#endif
+    if (threads <= 0)
+      threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (threads <= 0)
+    threads = 1;
+  if (threads > POOL_MAX_THREADS)
+    threads = POOL_MAX_THREADS;
+  p->threads = threads;
+
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->wake, NULL);
+  for (int i = 0; i < threads; i++) {
+    pthread_mutex_init(&p->deque[i].lock, NULL);
+    p->deque[i].cpu = -1;
+    p->deque[i].node = -1;
+  }
+  place_workers(p);
+
+  for (int i = 1; i < threads; i++) {
+    p->worker[i].pool = p;
+    p->worker[i].self = i;
+    if (pthread_create(&p->tid[i], NULL, worker, &p->worker[i]) != 0) {
+      fprintf(stderr, "Could only start %d of %d pool threads\n", i, threads);
+      unplace_workers(p, i);
+      p->threads = i;
+      break;
+    }
+  }
+  return p->threads;
+}
+
+// Calls fn on [0, tasks) in chunks of up to grain tasks, returns when all
+// of them are done. One job at a time per pool.
+void pool_run(thread_pool *p, long tasks, long grain, pool_task fn, void *arg) {
+  if (tasks <= 0)
+    return;
+  if (p->threads == 1) {
+    fn(arg, 0, tasks);
+    return;
+  }
+
+  pthread_mutex_lock(&p->lock);
+  p->fn = fn;
+  p->arg = arg;
+  p->grain = (grain > 0) ? grain : 1;
+  for (int i = 0; i < p->threads; i++) {
+    pool_deque *d = &p->deque[i];
+    pthread_mutex_lock(&d->lock);
+    d->lo = tasks * i / p->threads;
+    d->hi = tasks * (i + 1) / p->threads;
+    pthread_mutex_unlock(&d->lock);
+  }
+  __atomic_store_n(&p->pending, tasks, __ATOMIC_RELEASE);
+  p->generation++;
+  pthread_cond_broadcast(&p->wake);
+  pthread_mutex_unlock(&p->lock);
+
+  work(p, 0, fn, arg);
+
+  // Workers that joined may still hold fn and arg
+  pthread_mutex_lock(&p->lock);
+  while (p->active > 0) {
+    pthread_mutex_unlock(&p->lock);
+    sched_yield();
+    pthread_mutex_lock(&p->lock);
+  }
+  pthread_mutex_unlock(&p->lock);
+}
+
+void pool_release(thread_pool *p) {
+  pthread_mutex_lock(&p->lock);
+  p->stop = 1;
+  pthread_cond_broadcast(&p->wake);
+  pthread_mutex_unlock(&p->lock);
+  for (int i = 1; i < p->threads; i++)
+    pthread_join(p->tid[i], NULL);
+  unplace_workers(p, 0);
+  for (int i = 0; i < p->threads; i++)
+    pthread_mutex_destroy(&p->deque[i].lock);
+  pthread_cond_destroy(&p->wake);
+  pthread_mutex_destroy(&p->lock);
+}
@@ -0,0 +1,52 @@
+#ifndef THREADPOOL
+#define THREADPOOL
+
+#include <pthread.h>
+
+#define POOL_MAX_THREADS (256)
+
+// Runs tasks [begin, end) of the current job
+typedef void (*pool_task)(void *arg, long begin, long end);
+
+// One worker's deque of task indices: the owner takes grain-sized chunks
+// off the top, thieves take half of what is left off the bottom
+typedef struct {
+  pthread_mutex_t lock;
+  long lo;
+  long hi;
+  int cpu;              // pinned CPU, -1 when not pinned
+  int node;             // NUMA node of cpu
+  char pad[64];
+} pool_deque;
+
+// Work-stealing pool for NDRange-like jobs: every task index of a job is
+// dealt out evenly, then idle workers steal, from workers on their own NUMA
+// node first. The calling thread works as worker 0.
+typedef struct thread_pool thread_pool;
+
+typedef struct {
+  thread_pool *pool;
+  int self;
+} pool_worker;
+
+struct thread_pool {
+  int threads;
+  pthread_t tid[POOL_MAX_THREADS];
+  pool_worker worker[POOL_MAX_THREADS];
+  pool_deque deque[POOL_MAX_THREADS];
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  unsigned long generation;   // bumped for every job
+  int stop;
+  pool_task fn;
+  void *arg;
+  long grain;
+  long pending;               // tasks of the job not yet finished
+  int active;                 // workers that joined the job
+};
+
+int pool_init(thread_pool *p, int threads);
+void pool_run(thread_pool *p, long tasks, long grain, pool_task fn, void *arg);
+void pool_release(thread_pool *p);
+
+#endif
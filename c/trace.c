@@ -0,0 +1,185 @@
+/*
+ * Span tracing with per-thread ring buffers, dumped as Chrome trace JSON
+ *
+ * Each thread records into its own ring, so the hot path takes no lock.
+ * Device commands are kept as pending events and only read back (which
+ * waits for them) when the pending list fills up or the trace is dumped.
+*/
+
+#ifdef TRACING
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+typedef struct {
+  const char *cat;
+  const char *name;
+  int64_t ts;       // ns on the host clock
+  int64_t dur;
+  int device;
+} span;
+
+typedef struct {
+  const char *cat;
+  const char *name;
+  int64_t host;     // host ns as the command was enqueued
+  cl_event event;
+} pending;
+
+typedef struct trace_buf {
+  int tid;
+  unsigned long count;  // spans ever recorded, the ring keeps the last TRACE_RING
+  span ring[TRACE_RING];
+  span stack[TRACE_DEPTH];
+  int depth;
+  pending pend[TRACE_PENDING];
+  int npend;
+  struct trace_buf *next;
+} trace_buf;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_buf *buffers = NULL;
+static int num_threads = 0;
+static __thread trace_buf *local = NULL;
+
+static int64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static trace_buf* get_buf(void) {
+  if (local)
+    return local;
+  local = calloc(1, sizeof(trace_buf));
+  if (!local) {
+    fputs("trace buffer alloc failed", stderr);
+    exit(1);
+  }
+  pthread_mutex_lock(&lock);
+  local->tid = ++num_threads;
+  local->next = buffers;
+  buffers = local;
+  pthread_mutex_unlock(&lock);
+  return local;
+}
+
+static void record(trace_buf *b, const char *cat, const char *name, int64_t ts, int64_t dur, int device) {
+  span *s = &b->ring[b->count++ % TRACE_RING];
+  s->cat = cat;
+  s->name = name;
+  s->ts = ts;
+  s->dur = dur;
+  s->device = device;
+}
+
+// Waits for the command and records it on the host clock
+static void resolve(trace_buf *b, pending *p) {
+  cl_ulong queued, start, end;
+  if (p->event == NULL)
+    return;
+  if (clWaitForEvents(1, &p->event) == CL_SUCCESS &&
+      clGetEventProfilingInfo(p->event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, NULL) == CL_SUCCESS &&
+      clGetEventProfilingInfo(p->event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL) == CL_SUCCESS &&
+      clGetEventProfilingInfo(p->event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL) == CL_SUCCESS) {
+    int64_t offset = p->host - (int64_t)queued;
+    record(b, p->cat, p->name, (int64_t)start + offset, (int64_t)(end - start), 1);
+  }
+  clReleaseEvent(p->event);
+  p->event = NULL;
+}
+
+static void resolve_all(trace_buf *b) {
+  for (int i = 0; i < b->npend; i++)
+    resolve(b, &b->pend[i]);
+  b->npend = 0;
+}
+
+void trace_begin(const char *cat, const char *name) {
+  trace_buf *b = get_buf();
+  if (b->depth < TRACE_DEPTH) {
+    span *s = &b->stack[b->depth];
+    s->cat = cat;
+    s->name = name;
+    s->ts = now_ns();
+  }
+  b->depth++;
+}
+
+void trace_end(void) {
+  trace_buf *b = get_buf();
+  if (b->depth == 0)
+    return;
+  b->depth--;
+  if (b->depth < TRACE_DEPTH) {
+    span *s = &b->stack[b->depth];
+    record(b, s->cat, s->name, s->ts, now_ns() - s->ts, 0);
+  }
+}
+
+// Event slot for the enqueue call this is an argument of
+cl_event* trace_ev(const char *cat, const char *name) {
+  trace_buf *b = get_buf();
+  if (b->npend == TRACE_PENDING)
+    resolve_all(b);
+  pending *p = &b->pend[b->npend++];
+  p->cat = cat;
+  p->name = name;
+  p->event = NULL;
+  p->host = now_ns();
+  return &p->event;
+}
+
+void trace_event(const char *cat, const char *name, cl_event event) {
+  if (event == NULL)
+    return;
+  clRetainEvent(event);
+  *trace_ev(cat, name) = event;
+}
+
+static void write_span(FILE *fp, const span *s, int tid, int64_t base) {
+  fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+    s->name, s->cat, tid, (s->ts - base) * 1e-3, s->dur * 1e-3);
+}
+
+// Call once the traced threads are done, device spans show up as thread 0
+int trace_dump(const char *path) {
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    perror(path);
+    return -1;
+  }
+
+  pthread_mutex_lock(&lock);
+  int64_t base = INT64_MAX;
+  for (trace_buf *b = buffers; b; b = b->next) {
+    resolve_all(b);
+    unsigned long n = b->count < TRACE_RING ? b->count : TRACE_RING;
+    for (unsigned long i = 0; i < n; i++) {
+      if (b->ring[i].ts < base)
+        base = b->ring[i].ts;
+    }
+  }
+
+  fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  fprintf(fp, "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"OpenCL device\"}}");
+  for (trace_buf *b = buffers; b; b = b->next) {
+    fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"host %d\"}}", b->tid, b->tid);
+    unsigned long n = b->count < TRACE_RING ? b->count : TRACE_RING;
+    for (unsigned long i = 0; i < n; i++)
+      write_span(fp, &b->ring[i], b->ring[i].device ? 0 : b->tid, base);
+  }
+  fprintf(fp, "\n]}\n");
+  pthread_mutex_unlock(&lock);
+
+  fclose(fp);
+  printf("Trace written to %s\n", path);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef TRACE_LIB
+#define TRACE_LIB
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+// Span tracing exported as Chrome trace JSON (chrome://tracing, Perfetto).
+// Compiled in with -D TRACING (make TRACE=1), otherwise every macro below is
+// the bare statement or nothing. Names and categories must be string
+// literals, only the pointers are stored.
+//
+//   TRACE_BEGIN("cat", "name") ... TRACE_END();   host span, nests per thread
+//   TRACE("cat", "name", stmt);                   host span around stmt
+//   clEnqueue...(..., TRACE_EV("cat", "name"));   device span of the command
+//   TRACE_EVENT("cat", "name", ev);               device span of an event the
+//                                                 caller keeps
+//   TRACE_DUMP("file.json");                      resolve and write the trace
+//
+// Device spans need a queue created with CL_QUEUE_PROFILING_ENABLE, others
+// are dropped. They are moved onto the host clock per command: the host time
+// taken as the command is enqueued is matched to its CL_PROFILING_COMMAND_QUEUED
+// timestamp.
+
+#define TRACE_RING    (1 << 16)  // Spans kept per thread, the oldest are overwritten
+#define TRACE_PENDING (1024)     // Unresolved device events per thread
+#define TRACE_DEPTH   (64)       // Nesting depth of host spans
+
+#ifdef TRACING
+
+void trace_begin(const char *cat, const char *name);
+void trace_end(void);
+cl_event* trace_ev(const char *cat, const char *name);
+void trace_event(const char *cat, const char *name, cl_event event);
+int trace_dump(const char *path);
+
+#define TRACE_BEGIN(cat, name)        trace_begin(cat, name)
+#define TRACE_END()                   trace_end()
+#define TRACE(cat, name, stmt)        do { trace_begin(cat, name); stmt; trace_end(); } while (0)
+#define TRACE_EV(cat, name)           trace_ev(cat, name)
+#define TRACE_EVENT(cat, name, event) trace_event(cat, name, event)
+#define TRACE_DUMP(path)              trace_dump(path)
+
+#else
+
+#define TRACE_BEGIN(cat, name)
+#define TRACE_END()
+#define TRACE(cat, name, stmt)        do { stmt; } while (0)
+#define TRACE_EV(cat, name)           NULL
+#define TRACE_EVENT(cat, name, event)
+#define TRACE_DUMP(path)
+
+#endif
+
+#endif
@@ -0,0 +1,77 @@
+#include "kernel_common.clh"
+
+// Tile edge for the transpose kernels. Local tiles are padded by one column
+// so the column-wise reads hit TDIM different banks instead of one.
+#ifndef TDIM
+#define TDIM 16
+#endif
+
+// Panel width for the packed B layout, matches the GEMM tile
+#ifndef PANEL
+#ifdef TILE
+#define PANEL TILE
+#else
+#define PANEL 16
+#endif
+#endif
+
+// out = in^T, in is rows x cols row-major. Also converts row-major to
+// column-major (and back with rows and cols swapped).
+__kernel void transpose(__global DTYPE *in, __global DTYPE *out, const int rows, const int cols) {
+  __local DTYPE tile[TDIM][TDIM+1];
+  int bx = get_group_id(0) * TDIM;
+  int by = get_group_id(1) * TDIM;
+  int lx = get_local_id(0);
+  int ly = get_local_id(1);
+
+  if (by+ly < rows && bx+lx < cols)
+    tile[ly][lx] = in[(by+ly)*cols+bx+lx];
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  if (bx+ly < cols && by+lx < rows)
+    out[(bx+ly)*rows+by+lx] = tile[lx][ly];
+}
+
+// a = a^T for a square n x n matrix. Work-group (bx, by) with bx >= by swaps
+// tile (by, bx) with its mirror (bx, by); groups below the diagonal exit.
+__kernel void transpose_inplace(__global DTYPE *a, const int n) {
+  __local DTYPE t1[TDIM][TDIM+1];
+  __local DTYPE t2[TDIM][TDIM+1];
+  int bx = get_group_id(0);
+  int by = get_group_id(1);
+  if (bx < by)
+    return;
+
+  int lx = get_local_id(0);
+  int ly = get_local_id(1);
+  int r1 = by*TDIM+ly, c1 = bx*TDIM+lx;
+  int r2 = bx*TDIM+ly, c2 = by*TDIM+lx;
+
+  if (r1 < n && c1 < n)
+    t1[ly][lx] = a[r1*n+c1];
+  if (r2 < n && c2 < n)
+    t2[ly][lx] = a[r2*n+c2];
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  if (r2 < n && c2 < n)
+    a[r2*n+c2] = t1[lx][ly];
+  if (bx != by && r1 < n && c1 < n)
+    a[r1*n+c1] = t2[lx][ly];
+}
+
+// Packs a row-major rows x cols matrix into column panels of width PANEL,
+// each panel stored row-major and contiguous. cols must be a multiple of PANEL.
+__kernel void pack_panels(__global DTYPE *src, __global DTYPE *dst, const int rows, const int cols) {
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  if (i < cols && j < rows)
+    dst[(i/PANEL)*rows*PANEL + j*PANEL + i%PANEL] = src[j*cols+i];
+}
+
+// Inverse of pack_panels
+__kernel void unpack_panels(__global DTYPE *src, __global DTYPE *dst, const int rows, const int cols) {
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  if (i < cols && j < rows)
+    dst[j*cols+i] = src[(i/PANEL)*rows*PANEL + j*PANEL + i%PANEL];
+}
@@ -4,6 +4,7 @@
 
 #include<stdio.h>
 #include<stdlib.h>
+#include<math.h>
 #include<sys/types.h>
 #ifdef __APPLE__ 
 #include <OpenCL/opencl.h>
@@ -13,6 +14,14 @@
 #endif
 
 #include "err_code.h"
+#include "device_info.h"
+#include "vector_ops.h"
+#include "kernel_cache.h"
+#include "staging.h"
+#include "trace.h"
+#include "rng.h"
+#include "clrt.h"
+#include "host_ops.h"
 
 // Pick up device type from compiler commd line or from the default type
 #ifndef DEVICE
@@ -20,43 +29,57 @@
 #endif
 
 extern double wtime();
-extern int output_device_info(cl_device_id);
 
 #define TOL     (0.001) // Tolerance used inf loating point comparisons
-#define LENGTH  (1024)  // Length of vectors a, b, and c
+#define LENGTH  (1024)  // Default length of vectors a, b, and c, override with argv[1]
+#define VEC     (0)     // vadd width: 1 scalar, 4 or 8 grid-stride, 0 from the device; argv[2]
 
+// c = a + b and sum(c) on the host backend, for when there is no OpenCL
+// platform or CLRT_BACKEND=host
+int run_host(const float *h_a, const float *h_b, float *h_c, int count) {
+  thread_pool pool;
+  int threads = pool_init(&pool, 0);
+  printf("Host backend, %d thread%s\n", threads, threads == 1 ? "" : "s");
 
-const char *KernelSource = "\n" \
-"__kernel void vadd(                      \n" \
-" __global float* a,                      \n" \
-" __global float* b,                      \n" \
-" __global float* c,                      \n" \
-" const unsigned int count) {             \n" \
-"   int i = get_global_id(0);             \n" \
-"   if (i < count)                        \n" \
-"     c[i] = a[i] + b[i];                 \n" \
-"}                                        \n" \
-"\n";
+  double rtime = wtime();
+  host_vadd(&pool, h_a, h_b, h_c, count);
+  rtime = wtime() - rtime;
+  printf("host_vadd ran in %lf seconds\n", rtime);
+
+  int correct = 0;
+  double ref = 0.0;
+  for (int i = 0; i < count; i++) {
+    float tmp = h_a[i] + h_b[i] - h_c[i];
+    correct += (tmp*tmp < TOL*TOL);
+    ref += h_c[i];
+  }
+  printf("C = A+B: %d out of %d results were correct.\n", correct, count);
+
+  double sum = host_sum(&pool, h_c, count);
+  int sum_ok = fabs(sum - ref) <= TOL * fabs(ref);
+  printf("sum(C): %f, expected %f%s\n", sum, ref, sum_ok ? "" : "  MISMATCH");
+
+  pool_release(&pool);
+  return (correct == count && sum_ok) ? 0 : EXIT_FAILURE;
+}
 
 
 int main(int argc, char** argv) {
   int err;
+  int length = (argc > 1) ? atoi(argv[1]) : LENGTH;
+  int vec = (argc > 2) ? atoi(argv[2]) : VEC;
 
-  float* h_a = (float*) calloc(LENGTH, sizeof(float));
-  float* h_b = (float*) calloc(LENGTH, sizeof(float));
-  float* h_c = (float*) calloc(LENGTH, sizeof(float));
+  float* h_a = (float*) calloc(length, sizeof(float));
+  float* h_b = (float*) calloc(length, sizeof(float));
+  float* h_c = (float*) calloc(length, sizeof(float));
   
   // Number of correct results
   unsigned int correct;
   
-  // Global domain size
-  size_t global;
-  
   cl_device_id device_id;
   cl_context context;
   cl_command_queue commands;
-  cl_program program;
-  cl_kernel ko_vadd;            // Compute kernel
+  vec_ctx vadd;                 // Compute kernel and its launch shape
   
   // Device memory used for a, b, c vectors
   cl_mem d_a; 
@@ -65,13 +88,20 @@ int main(int argc, char** argv) {
 
   // Fill vectors a and b with random float values
   int i = 0;
-  int count = LENGTH;
-  for (i = 0; i < count; i++) {
-    h_a[i] = rand() / (float)RAND_MAX;
-    h_b[i] = rand() / (float)RAND_MAX;
+  int count = length;
+  rng_uniform_host(h_a, count, RNG_SEED, 0);
+  rng_uniform_host(h_b, count, RNG_SEED, count);
+
+  if (clrt_select_backend() == CLRT_HOST) {
+    err = run_host(h_a, h_b, h_c, count);
+    free(h_a);
+    free(h_b);
+    free(h_c);
+    return err;
   }
 
   // Set up platform and GPU device
+  TRACE_BEGIN("setup", "platform and device");
   
   cl_uint numPlatforms;
   err = clGetPlatformIDs(0, NULL, &numPlatforms);
@@ -100,64 +130,74 @@ int main(int argc, char** argv) {
   err = output_device_info(device_id); 
   checkError(err, "Finding device output");
 
+  device_caps caps;
+  err = query_device_caps(device_id, &caps);
+  checkError(err, "Querying device capabilities");
+
   // Create a compute context
   context = clCreateContext(0, 1, &device_id, NULL, NULL, &err);
   checkError(err, "Creating context");
 
-  // Create a command queue
-  commands = clCreateCommandQueue(context, device_id, 0, &err);
+  // Create a command queue, profiled for the transfer breakdown
+  commands = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
   checkError(err, "Creating command queue");
 
-  // Create the compute program from the source buffer
-  program = clCreateProgramWithSource(context, 1, (const char **) & KernelSource, NULL, &err);
-  checkError(err, "Creating program");
+  TRACE_END();
 
-  // Build the program 
-  err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-  if (err != CL_SUCCESS) {
-    size_t len; 
-    char buffer[2048];
-
-    printf("Error: Failed to build program executable!\n%s\n", err_code(err));
-    clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
-    printf("%s\n", buffer);
-    return EXIT_FAILURE;
-  }
-
-  // Create the compute kernel from the program
-  ko_vadd = clCreateKernel(program, "vadd", &err);
+  // Create the compute kernel, vectorised to suit the device
+  TRACE("build", "vec_init", err = vec_init(&vadd, context, device_id, &caps, vec));
   checkError(err, "Creating kernel");
 
   // Create the input (a, b) and output (c) arrays in device memory
+  TRACE_BEGIN("alloc", "device buffers");
   d_a = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float) * count, NULL, &err);
   checkError(err, "Creating buffer d_a");
 
   d_b = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float) * count, NULL, &err);
   checkError(err, "Creating buffer d_b");
 
-  d_c = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(float) * count, NULL, &err);
+  d_c = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * count, NULL, &err);
   checkError(err, "Creating buffer d_c");
-
-  // Write a and b vectors into compute device memory 
-  err = clEnqueueWriteBuffer(commands, d_a, CL_TRUE, 0, sizeof(float) * count, h_a, 0, NULL, NULL);
+  TRACE_END();
+
+  // Write a and b vectors into compute device memory, first straight from
+  // the calloc'd arrays with blocking writes, then through the pinned ring
+  size_t bytes = sizeof(float) * count;
+  cl_event ev[2];
+  double host = wtime();
+  err = clEnqueueWriteBuffer(commands, d_a, CL_TRUE, 0, bytes, h_a, 0, NULL, &ev[0]);
   checkError(err, "Copying h_a to device at d_a");
 
-  err = clEnqueueWriteBuffer(commands, d_b, CL_TRUE, 0, sizeof(float) * count, h_b, 0, NULL, NULL);
+  err = clEnqueueWriteBuffer(commands, d_b, CL_TRUE, 0, bytes, h_b, 0, NULL, &ev[1]);
   checkError(err, "Copying h_b to device at d_b");
-
-  // Set the arguments to our compute kernel
-  err = clSetKernelArg(ko_vadd, 0, sizeof(cl_mem), &d_a);
-  err |= clSetKernelArg(ko_vadd, 1, sizeof(cl_mem), &d_b);
-  err |= clSetKernelArg(ko_vadd, 2, sizeof(cl_mem), &d_c);
-  err |= clSetKernelArg(ko_vadd, 3, sizeof(unsigned int), &count);
-  checkError(err, "Setting kernel arguments");
+  host = wtime() - host;
+  printf("\n");
+  print_transfer("write a,b pageable", 2 * bytes, host, event_seconds(ev[0]) + event_seconds(ev[1]));
+  TRACE_EVENT("transfer", "pageable write", ev[0]);
+  TRACE_EVENT("transfer", "pageable write", ev[1]);
+  clReleaseEvent(ev[0]);
+  clReleaseEvent(ev[1]);
+
+  staging_ring ring;
+  err = staging_init(&ring, context, commands, 0);
+  checkError(err, "Creating staging buffers");
+
+  host = wtime();
+  err = staging_write(&ring, d_a, 0, h_a, bytes);
+  checkError(err, "Staging h_a to device at d_a");
+  err = staging_write(&ring, d_b, 0, h_b, bytes);
+  checkError(err, "Staging h_b to device at d_b");
+  double host_enqueue = wtime() - host;
+  err = staging_finish(&ring);
+  checkError(err, "Waiting for staged writes");
+  host = wtime() - host;
+  print_transfer("write a,b staged", 2 * bytes, host, ring.write_secs);
+  printf("%-20s %10.3f ms before the host was free\n", "", host_enqueue * 1e3);
 
   double rtime = wtime();
 
-  // Execute the kernel over the entire range of our 1d input data 
-  // letting the OpenCL runtime choose the work-group size
-  global = count;
-  err = clEnqueueNDRangeKernel(commands, ko_vadd, 1, NULL, &global, NULL, 0, NULL, NULL);
+  // Execute the kernel over the entire range of our 1d input data
+  err = vec_add(&vadd, commands, d_a, d_b, d_c, count);
   checkError(err, "Enqueueing kernel");
 
   // Wait for the commands to complete before stopping the timer
@@ -165,16 +205,30 @@ int main(int argc, char** argv) {
   checkError(err, "Waiting for kernel to finish");
 
   rtime = wtime() - rtime;
-  printf("\nThe kernel ran in %lf seconds\n", rtime);
+  printf("The kernel (width %d) ran in %lf seconds\n", vadd.vec, rtime);
   
-  // Read back the results from the compute device 
-  err = clEnqueueReadBuffer(commands, d_c, CL_TRUE, 0, sizeof(float) * count, h_c, 0, NULL, NULL);
+  // Read back the results from the compute device, both ways
+  host = wtime();
+  err = clEnqueueReadBuffer(commands, d_c, CL_TRUE, 0, bytes, h_c, 0, NULL, &ev[0]);
   if (err != CL_SUCCESS) {
     printf("Error: Failed to read output array!\n%s\n", err_code(err));
     exit(1);
   }
+  host = wtime() - host;
+  print_transfer("read c pageable", bytes, host, event_seconds(ev[0]));
+  TRACE_EVENT("transfer", "pageable read", ev[0]);
+  clReleaseEvent(ev[0]);
+
+  for (i = 0; i < count; i++)
+    h_c[i] = 0.0f;
+  host = wtime();
+  err = staging_read(&ring, d_c, 0, h_c, bytes);
+  checkError(err, "Reading output array through staging buffers");
+  host = wtime() - host;
+  print_transfer("read c staged", bytes, host, ring.read_secs);
 
   // Test the results 
+  TRACE_BEGIN("verify", "check c");
   correct = 0;
   float tmp;
 
@@ -189,15 +243,47 @@ int main(int argc, char** argv) {
     }
   }
 
+  TRACE_END();
+
   // Summarize results
   printf("C = A+B: %d out of %d results were correct.\n", correct, count);
 
+  // Reduction over c against the host sum
+  double sum, ref = 0.0;
+  for (i = 0; i < count; i++)
+    ref += h_c[i];
+  err = vec_sum(&vadd, commands, d_c, count, &sum);
+  checkError(err, "Summing c");
+  int sum_ok = fabs(sum - ref) <= TOL * fabs(ref);
+  printf("sum(C): %f, expected %f%s\n", sum, ref, sum_ok ? "" : "  MISMATCH");
+
+  // Device-side fill of b against the host's: no upload, same bits
+  rng_ctx rng;
+  err = rng_init(&rng, context, device_id);
+  checkError(err, "Creating RNG kernels");
+  host = wtime();
+  err = rng_uniform(&rng, commands, d_c, count, RNG_SEED, count);
+  checkError(err, "Generating c");
+  err = clFinish(commands);
+  checkError(err, "Waiting for RNG");
+  host = wtime() - host;
+  err = staging_read(&ring, d_c, 0, h_c, bytes);
+  checkError(err, "Reading generated c");
+  int rng_same = 0;
+  for (i = 0; i < count; i++)
+    rng_same += (h_c[i] == h_b[i]);
+  printf("RNG fill: %d out of %d bit-identical to the host, %.2f GB/s\n", rng_same, count, bytes / host * 1e-9);
+  rng_release(&rng);
+
+  TRACE_DUMP(getenv("TRACE_FILE") ? getenv("TRACE_FILE") : "vadd.trace.json");
+
   // Clean up 
   clReleaseMemObject(d_a);
   clReleaseMemObject(d_b);
   clReleaseMemObject(d_c);
-  clReleaseProgram(program);
-  clReleaseKernel(ko_vadd);
+  staging_release(&ring);
+  vec_release(&vadd);
+  release_programs();
   clReleaseCommandQueue(commands);
   clReleaseContext(context);
   
@@ -205,5 +291,5 @@ int main(int argc, char** argv) {
   free(h_b);
   free(h_c);
 
-  return 0;
+  return (correct == count && sum_ok && rng_same == count) ? 0 : EXIT_FAILURE;
 }
@@ -0,0 +1,60 @@
+#include "kernel_common.clh"
+
+// c = a + b, one element per work-item
+__kernel void vadd(__global DTYPE *a, __global DTYPE *b, __global DTYPE *c, const unsigned int count) {
+  int i = get_global_id(0);
+  if (i < count)
+    c[i] = a[i] + b[i];
+}
+
+// Grid-stride variants: a fixed number of work-groups (sized to the compute
+// units) walks the vector in float4/float8 steps, then the first
+// count % width work-items pick up the scalar tail
+__kernel void vadd4(__global DTYPE *a, __global DTYPE *b, __global DTYPE *c, const unsigned int count) {
+  size_t gid = get_global_id(0);
+  size_t stride = get_global_size(0);
+  size_t nvec = count / 4;
+
+  for (size_t i = gid; i < nvec; i += stride)
+    vstore4(vload4(i, a) + vload4(i, b), i, c);
+
+  size_t t = nvec * 4 + gid;
+  if (t < count)
+    c[t] = a[t] + b[t];
+}
+
+__kernel void vadd8(__global DTYPE *a, __global DTYPE *b, __global DTYPE *c, const unsigned int count) {
+  size_t gid = get_global_id(0);
+  size_t stride = get_global_size(0);
+  size_t nvec = count / 8;
+
+  for (size_t i = gid; i < nvec; i += stride)
+    vstore8(vload8(i, a) + vload8(i, b), i, c);
+
+  size_t t = nvec * 8 + gid;
+  if (t < count)
+    c[t] = a[t] + b[t];
+}
+
+// Work-group partial sums: each work-item accumulates a grid-stride run of a,
+// the group reduces in local memory (local size a power of two) and work-item
+// 0 writes partial[group]
+__kernel void vsum(__global DTYPE *a, __global DTYPE *partial, const unsigned int count, __local DTYPE *scratch) {
+  size_t gid = get_global_id(0);
+  size_t lid = get_local_id(0);
+  size_t stride = get_global_size(0);
+
+  DTYPE acc = 0;
+  for (size_t i = gid; i < count; i += stride)
+    acc += a[i];
+  scratch[lid] = acc;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (size_t s = get_local_size(0) / 2; s > 0; s >>= 1) {
+    if (lid < s)
+      scratch[lid] += scratch[lid + s];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  if (lid == 0)
+    partial[get_group_id(0)] = scratch[0];
+}
@@ -0,0 +1,108 @@
+/*
+ * Vector operations: element-wise c = a + b and the sum of a
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "vector_ops.h"
+#include "kernel_cache.h"
+#include "trace.h"
+
+// vec 0 picks the width from the device's preferred float vector width
+cl_int vec_init(vec_ctx *v, cl_context context, cl_device_id device, const device_caps *caps, int vec) {
+  cl_int err;
+  memset(v, 0, sizeof(*v));
+  if (vec == 0)
+    vec = (caps->vec_float >= 8) ? 8 : 4;
+
+  v->vec = vec;
+  v->local = caps_work_group(caps, VADD_WG);
+  // vsum's tree reduction halves the work-group, keep it a power of two
+  while (v->local & (v->local - 1))
+    v->local &= v->local - 1;
+  v->groups = (size_t)caps->compute_units * VADD_GROUPS_PER_CU;
+  v->ko_vadd = get_kernel(context, device, "vadd.cl", vec == 8 ? "vadd8" : (vec == 4 ? "vadd4" : "vadd"), NULL, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  v->ko_sum = get_kernel(context, device, "vadd.cl", "vsum", NULL, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  v->partial = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * v->groups, NULL, &err);
+  if (err != CL_SUCCESS)
+    goto fail;
+  return CL_SUCCESS;
+
+fail:
+  vec_release(v);
+  return err;
+}
+
+cl_int vec_add(vec_ctx *v, cl_command_queue commands, cl_mem d_a, cl_mem d_b, cl_mem d_c, unsigned int count) {
+  cl_int err;
+  err = clSetKernelArg(v->ko_vadd, 0, sizeof(cl_mem), &d_a);
+  err |= clSetKernelArg(v->ko_vadd, 1, sizeof(cl_mem), &d_b);
+  err |= clSetKernelArg(v->ko_vadd, 2, sizeof(cl_mem), &d_c);
+  err |= clSetKernelArg(v->ko_vadd, 3, sizeof(unsigned int), &count);
+  if (err != CL_SUCCESS)
+    return err;
+
+  size_t global;
+  if (v->vec == 1) {
+    global = (count + v->local - 1) / v->local * v->local;
+  } else {
+    // No more work-groups than there are vectors to go round, but at least
+    // enough work-items to cover the scalar tail
+    size_t items = count / v->vec;
+    if (items < v->vec)
+      items = v->vec;
+    size_t groups = (items + v->local - 1) / v->local;
+    if (groups > v->groups)
+      groups = v->groups;
+    global = groups * v->local;
+    if (global < v->vec)
+      global = (v->vec + v->local - 1) / v->local * v->local;
+  }
+  return clEnqueueNDRangeKernel(commands, v->ko_vadd, 1, NULL, &global, &v->local, 0, NULL, TRACE_EV("kernel", "vadd"));
+}
+
+// Device partial sums per work-group, finished on the host in double
+cl_int vec_sum(vec_ctx *v, cl_command_queue commands, cl_mem d_a, unsigned int count, double *sum) {
+  cl_int err;
+  err = clSetKernelArg(v->ko_sum, 0, sizeof(cl_mem), &d_a);
+  err |= clSetKernelArg(v->ko_sum, 1, sizeof(cl_mem), &v->partial);
+  err |= clSetKernelArg(v->ko_sum, 2, sizeof(unsigned int), &count);
+  err |= clSetKernelArg(v->ko_sum, 3, sizeof(float) * v->local, NULL);
+  if (err != CL_SUCCESS)
+    return err;
+
+  size_t groups = (count + v->local - 1) / v->local;
+  if (groups > v->groups)
+    groups = v->groups;
+  if (groups == 0)
+    groups = 1;
+  size_t global = groups * v->local;
+  err = clEnqueueNDRangeKernel(commands, v->ko_sum, 1, NULL, &global, &v->local, 0, NULL, TRACE_EV("kernel", "vsum"));
+  if (err != CL_SUCCESS)
+    return err;
+
+  float partial[groups];
+  err = clEnqueueReadBuffer(commands, v->partial, CL_TRUE, 0, sizeof(float) * groups, partial, 0, NULL, TRACE_EV("transfer", "vsum partials"));
+  if (err != CL_SUCCESS)
+    return err;
+  *sum = 0.0;
+  for (size_t g = 0; g < groups; g++)
+    *sum += partial[g];
+  return CL_SUCCESS;
+}
+
+// Safe on a partly initialised or already released context
+void vec_release(vec_ctx *v) {
+  if (v->ko_vadd)
+    clReleaseKernel(v->ko_vadd);
+  if (v->ko_sum)
+    clReleaseKernel(v->ko_sum);
+  if (v->partial)
+    clReleaseMemObject(v->partial);
+  memset(v, 0, sizeof(*v));
+}
@@ -0,0 +1,30 @@
+#ifndef VECTOR_OPS
+#define VECTOR_OPS
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "device_info.h"
+
+#define VADD_WG            (256)  // Work-group size asked of the device
+#define VADD_GROUPS_PER_CU (4)    // Work-groups per compute unit for the grid-stride kernels
+
+// Element-wise vector kernels from vadd.cl and their launch shape
+typedef struct {
+  int vec;          // 1 = one element per work-item, 4 or 8 = grid-stride vloadn
+  size_t local;
+  size_t groups;    // fixed work-group count of the grid-stride kernels
+  cl_kernel ko_vadd;
+  cl_kernel ko_sum;
+  cl_mem partial;   // one partial sum per work-group
+} vec_ctx;
+
+cl_int vec_init(vec_ctx *v, cl_context context, cl_device_id device, const device_caps *caps, int vec);
+cl_int vec_add(vec_ctx *v, cl_command_queue commands, cl_mem d_a, cl_mem d_b, cl_mem d_c, unsigned int count);
+cl_int vec_sum(vec_ctx *v, cl_command_queue commands, cl_mem d_a, unsigned int count, double *sum);
+void vec_release(vec_ctx *v);
+
+#endif
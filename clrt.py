@@ -0,0 +1,176 @@
+"""
+ctypes bindings for the C runtime in c/ (build it with: cd c && make shared)
+
+  import clrt
+  rt = clrt.Runtime()
+  c = rt.gemm(a, b)      # float32 (m, k) @ (k, n) on the tuned GEMM driver
+  c = rt.vadd(a, b)      # element-wise a + b
+  s = rt.sum(a)          # sum of all elements
+
+Runtime(backend="host") runs on the host backend's thread pool instead of an
+OpenCL device, "opencl" insists on a device; by default it's CLRT_BACKEND
+from the environment, else OpenCL with the host as the fallback.
+
+Arrays go over as raw pointers: C-contiguous float32 arrays are used as they
+are, anything else is converted once with np.ascontiguousarray. Results can
+be written into an existing array with out=. vadd's out may be one of its
+inputs (in place); an out that only partly overlaps an input, or gemm's out
+overlapping anything, goes through a temporary. ctypes releases the GIL for
+the length of every call, so other Python threads keep running.
+
+CLRT_LIB overrides the library path, by default c/build/release/libclrt.so.
+"""
+
+import ctypes
+import os
+import sys
+
+import numpy as np
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+EXT = "dylib" if sys.platform == "darwin" else "so"
+LIB_PATH = os.environ.get("CLRT_LIB", os.path.join(HERE, "c", "build", "release", "libclrt." + EXT))
+
+float_p = ctypes.POINTER(ctypes.c_float)
+
+# Backend numbers from clrt.h
+BACKENDS = {None: -1, "opencl": 0, "host": 1}
+
+def _load(path):
+  lib = ctypes.CDLL(path)
+  lib.clrt_open.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_int)]
+  lib.clrt_open.restype = ctypes.c_void_p
+  lib.clrt_open_backend.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.POINTER(ctypes.c_int)]
+  lib.clrt_open_backend.restype = ctypes.c_void_p
+  lib.clrt_backend.argtypes = [ctypes.c_void_p]
+  lib.clrt_device_name.argtypes = [ctypes.c_void_p]
+  lib.clrt_device_name.restype = ctypes.c_char_p
+  lib.clrt_gemm.argtypes = [ctypes.c_void_p, float_p, float_p, float_p, ctypes.c_int, ctypes.c_int, ctypes.c_int]
+  lib.clrt_vadd.argtypes = [ctypes.c_void_p, float_p, float_p, float_p, ctypes.c_uint]
+  lib.clrt_sum.argtypes = [ctypes.c_void_p, float_p, ctypes.c_uint, ctypes.POINTER(ctypes.c_double)]
+  lib.clrt_close.argtypes = [ctypes.c_void_p]
+  return lib
+
+# Contiguous float32 view of a, a copy only when a isn't one already
+def _as_input(a):
+  return np.ascontiguousarray(a, dtype=np.float32)
+
+def _as_output(out, shape):
+  if out is None:
+    return np.empty(shape, dtype=np.float32)
+  if out.dtype != np.float32 or not out.flags.c_contiguous or out.shape != shape:
+    raise ValueError("out must be a C-contiguous float32 array of shape %s" % (shape,))
+  return out
+
+# Whether out overlaps an input the C side can't take it alongside; in_place
+# lets out be exactly one of the inputs
+def _overlaps(out, inputs, in_place=False):
+  for a in inputs:
+    if in_place and out.ctypes.data == a.ctypes.data:
+      continue
+    if np.may_share_memory(out, a):
+      return True
+  return False
+
+def _ptr(a):
+  return a.ctypes.data_as(float_p)
+
+def _check(err, name):
+  if err != 0:
+    raise RuntimeError("%s failed with OpenCL error %d" % (name, err))
+
+class Runtime:
+  def __init__(self, lib_path=LIB_PATH, kernel_dir=os.path.join(HERE, "c"), backend=None):
+    self.rt = None
+    if backend not in BACKENDS:
+      raise ValueError("backend must be 'opencl', 'host' or None, got %r" % (backend,))
+    self.lib = _load(lib_path)
+    err = ctypes.c_int(0)
+    self.rt = self.lib.clrt_open_backend(kernel_dir.encode(), BACKENDS[backend], ctypes.byref(err))
+    if not self.rt:
+      _check(err.value or -1, "clrt_open")
+
+  def close(self):
+    if self.rt:
+      self.lib.clrt_close(self.rt)
+      self.rt = None
+
+  def __del__(self):
+    self.close()
+
+  def __enter__(self):
+    return self
+
+  def __exit__(self, *exc):
+    self.close()
+
+  @property
+  def device(self):
+    return self.lib.clrt_device_name(self.rt).decode()
+
+  @property
+  def backend(self):
+    return "host" if self.lib.clrt_backend(self.rt) == BACKENDS["host"] else "opencl"
+
+  def gemm(self, a, b, out=None):
+    a = _as_input(a)
+    b = _as_input(b)
+    if a.ndim != 2 or b.ndim != 2 or a.shape[1] != b.shape[0]:
+      raise ValueError("gemm needs (m, k) and (k, n) matrices, got %s and %s" % (a.shape, b.shape))
+    m, k = a.shape
+    n = b.shape[1]
+    c = _as_output(out, (m, n))
+    if _overlaps(c, (a, b)):
+      c = np.empty_like(c)
+    _check(self.lib.clrt_gemm(self.rt, _ptr(a), _ptr(b), _ptr(c), m, n, k), "clrt_gemm")
+    if out is not None and c is not out:
+      out[...] = c
+      return out
+    return c
+
+  def vadd(self, a, b, out=None):
+    a = _as_input(a)
+    b = _as_input(b)
+    if a.shape != b.shape:
+      raise ValueError("vadd needs arrays of one shape, got %s and %s" % (a.shape, b.shape))
+    c = _as_output(out, a.shape)
+    if _overlaps(c, (a, b), in_place=True):
+      c = np.empty_like(c)
+    _check(self.lib.clrt_vadd(self.rt, _ptr(a), _ptr(b), _ptr(c), a.size), "clrt_vadd")
+    if out is not None and c is not out:
+      out[...] = c
+      return out
+    return c
+
+  def sum(self, a):
+    a = _as_input(a)
+    s = ctypes.c_double(0.0)
+    _check(self.lib.clrt_sum(self.rt, _ptr(a), a.size, ctypes.byref(s)), "clrt_sum")
+    return s.value
+
+# Small self check, run by make test
+if __name__ == "__main__":
+  failures = 0
+  with Runtime() as rt:
+    print("Device is %s (%s backend)" % (rt.device, rt.backend))
+    for m, n, k in [(64, 64, 64), (100, 100, 100), (64, 64, 65536), (33, 17, 250)]:
+      a = np.random.rand(m, k).astype(np.float32)
+      b = np.random.rand(k, n).astype(np.float32)
+      c = rt.gemm(a, b)
+      ref = a.astype(np.float64) @ b.astype(np.float64)
+      rel = np.linalg.norm(c - ref) / np.linalg.norm(ref)
+      failures += rel > 1e-4
+      print("gemm %dx%dx%d: rel err %.3e" % (m, n, k, rel))
+
+    a = np.random.rand(100003).astype(np.float32)
+    b = np.random.rand(100003).astype(np.float32)
+    c = rt.vadd(a, b)
+    ok = np.allclose(c, a + b)
+    failures += not ok
+    print("vadd %d: %s" % (a.size, "ok" if ok else "MISMATCH"))
+
+    s = rt.sum(a)
+    ref = a.astype(np.float64).sum()
+    failures += abs(s - ref) > 1e-4 * abs(ref)
+    print("sum %d: %f, expected %f" % (a.size, s, ref))
+  sys.exit(1 if failures else 0)
@@ -1,16 +1,12 @@
+import numpy as np
+
 TOL = 0.0001
 LENGTH = 16
 
-# Function to compute the matrix product
+# Function to compute the matrix product, a, b and c flat N*N arrays.
+# NumPy's matmul instead of a Python triple loop, which took minutes at N=512
 def sequential(N, a, b, c):
-  # Iterate over the rows of A
-  for i in range(N):
-    # Iterate over the columbs of B 
-    for j in range(N):
-      tmp = 0.0
-      for k in range(N):
-        tmp += a[i * N + k] * b[k * N + j]
-      c[i * N + j] = tmp 
+  c[:] = (np.reshape(a, (N, N)) @ np.reshape(b, (N, N))).ravel()
 
 # im not sure if this flops thing is right
 def flops(N, run_time):